@@ -0,0 +1,106 @@
+#pragma once
+
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "UVIndex.hpp"
+
+// Функция для извлечения 3D точек, соответствующих UV-точкам (u, v подряд): точки меша
+// в координатах модели (x, y, z подряд). Для точек вне развертки found = 0.
+inline void get_uv_3d_points(const UVIndex& index, const std::vector<float>& uvs, std::vector<float>& points, std::vector<uint8_t>& found) {
+    const size_t count = uvs.size() / 2;
+    points.assign(count * 3, 0.0f);
+    found.assign(count, 0);
+    if (index.GetNumberOfTriangles() == 0) {
+        std::cerr << "Error: Points or texture coordinates not found." << std::endl;
+        return;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        double point[3];
+        if (index.Lookup(uvs[i * 2], uvs[i * 2 + 1], point)) {
+            points[i * 3] = static_cast<float>(point[0]);
+            points[i * 3 + 1] = static_cast<float>(point[1]);
+            points[i * 3 + 2] = static_cast<float>(point[2]);
+            found[i] = 1;
+        }
+    }
+}
+
+// UV-точки штрих-кода: сначала 4 угла рамки (tl, tr, br, bl), а при grid > 0 еще
+// узлы сетки grid x grid по строкам сверху вниз — углы всех модулей
+inline std::vector<float> get_barcode_uv_keypoints(const std::array<double, 4>& barcodeCoords, int grid) {
+    // Нормализованные границы текстурных координат штрих-кода
+    const double left = barcodeCoords[0], top = barcodeCoords[1];
+    const double right = barcodeCoords[2], bottom = barcodeCoords[3];
+
+    std::vector<double> uvs = {left, top, right, top, right, bottom, left, bottom};
+    for (int j = 0; grid > 0 && j <= grid; ++j) {
+        for (int i = 0; i <= grid; ++i) {
+            uvs.push_back(left + (right - left) * i / grid);
+            uvs.push_back(top + (bottom - top) * j / grid);
+        }
+    }
+    return std::vector<float>(uvs.begin(), uvs.end());
+}
+
+// Настройки аннотации ключевых точек
+struct AnnotationOptions {
+    int grid = 0;           // --keypoints N: узлы сетки N x N на штрих-коде
+    bool occlusion = false; // --occlusion: проверять точки по z-буферу кадра
+    float depthBias = 1e-4f;
+};
+
+// Аннотация в JSON-формате: углы штрих-кода (углы вне развертки пропускаются, как
+// раньше) с флагами видимости и, если есть, плотная сетка ключевых точек — она
+// пишется целиком, у точек без проекции координаты -1
+inline std::string AnnotationToJSON(const std::vector<float>& xy, const std::vector<uint8_t>& found,
+                             const std::vector<uint8_t>& visible, int grid) {
+    std::vector<size_t> corners;
+    for (size_t i = 0; i < 4; ++i) {
+        if (found[i] && !std::isnan(xy[i * 2])) {
+            corners.push_back(i);
+        }
+    }
+    auto list = [](std::ostream& out, size_t count, const auto& value) {
+        out << "[";
+        for (size_t i = 0; i < count; ++i) {
+            out << (i > 0 ? ", " : "") << value(i);
+        }
+        out << "]";
+    };
+    auto coordinate = [&](size_t i, int axis) {
+        return found[i] && !std::isnan(xy[i * 2]) ? xy[i * 2 + axis] : -1.0f;
+    };
+
+    std::ostringstream out;
+    out << "{" << std::endl;
+    out << "  \"all_points_x\": ";
+    list(out, corners.size(), [&](size_t i) { return xy[corners[i] * 2]; });
+    out << "," << std::endl;
+    out << "  \"all_points_y\": ";
+    list(out, corners.size(), [&](size_t i) { return xy[corners[i] * 2 + 1]; });
+    out << "," << std::endl;
+    out << "  \"visible\": ";
+    list(out, corners.size(), [&](size_t i) { return static_cast<int>(visible[corners[i]]); });
+    if (grid > 0) {
+        const size_t count = xy.size() / 2 - 4;
+        out << "," << std::endl;
+        out << "  \"keypoints_grid\": " << grid << "," << std::endl;
+        out << "  \"keypoints_x\": ";
+        list(out, count, [&](size_t i) { return coordinate(i + 4, 0); });
+        out << "," << std::endl;
+        out << "  \"keypoints_y\": ";
+        list(out, count, [&](size_t i) { return coordinate(i + 4, 1); });
+        out << "," << std::endl;
+        out << "  \"keypoints_visible\": ";
+        list(out, count, [&](size_t i) { return static_cast<int>(visible[i + 4]); });
+    }
+    out << std::endl << "}" << std::endl;
+    return out.str();
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <vtkImageData.h>
+#include <vtkNew.h>
+#include <vtkType.h>
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// Белый холст текстуры, в который штрих-код вклеивается прямо в памяти (раньше
+// это делал save_combined_image.py через JPEG на диске). Буфер vtkImageData
+// выделяется один раз; между сэмплами белым закрашивается только прямоугольник
+// предыдущего штрих-кода.
+// Строки vtkImageData идут снизу вверх, как их отдает vtkJPEGReader, поэтому
+// холст совпадает с тем, что раньше читалось из combined_*.jpg.
+class TextureCanvas {
+public:
+    // 484x884 — размер холста из save_combined_image.py, под него сделана развертка mesh.obj
+    explicit TextureCanvas(int width = 484, int height = 884) : width(width), height(height) {
+        image->SetDimensions(width, height, 1);
+        image->AllocateScalars(VTK_UNSIGNED_CHAR, 3);
+        std::memset(image->GetScalarPointer(), 255, static_cast<size_t>(width) * height * 3);
+    }
+
+    TextureCanvas(const TextureCanvas&) = delete;
+
+    // Вклеивает штрих-код, увеличенный в scale раз (билинейно), левым верхним углом
+    // в (x, y) — пиксели холста сверху вниз. Штрих-код, который не влезает, уменьшается,
+    // позиция прижимается к краям. В box пишется UV-рамка в тех же единицах, что
+    // печатал save_combined_image.py: x0/W, y0/H, x1/W, y1/H.
+    bool Paste(vtkImageData* barcode, double scale, int x, int y, std::array<double, 4>& box) {
+        int dims[3];
+        barcode->GetDimensions(dims);
+        const int components = barcode->GetNumberOfScalarComponents();
+        if (barcode->GetScalarType() != VTK_UNSIGNED_CHAR || dims[0] <= 0 || dims[1] <= 0 || components <= 0) {
+            return false;
+        }
+        const int sourceWidth = dims[0];
+        const int sourceHeight = dims[1];
+        scale = std::min({scale, static_cast<double>(width) / sourceWidth, static_cast<double>(height) / sourceHeight});
+        const int w = std::clamp(static_cast<int>(std::lround(sourceWidth * scale)), 1, width);
+        const int h = std::clamp(static_cast<int>(std::lround(sourceHeight * scale)), 1, height);
+        x = std::clamp(x, 0, width - w);
+        y = std::clamp(y, 0, height - h);
+
+        clear();
+
+        // Таблицы выборки по x считаются один раз на вклейку
+        columns.resize(w);
+        for (int dx = 0; dx < w; ++dx) {
+            columns[dx] = sampleAt(dx, w, sourceWidth);
+        }
+
+        const auto* source = static_cast<const uint8_t*>(barcode->GetScalarPointer());
+        auto* target = static_cast<uint8_t*>(image->GetScalarPointer());
+        const size_t sourceStride = static_cast<size_t>(sourceWidth) * components;
+        // Цветной штрих-код копируется по каналам, серый размножается на все три
+        const int channels[3] = {0, components >= 3 ? 1 : 0, components >= 3 ? 2 : 0};
+        for (int dy = 0; dy < h; ++dy) {
+            // Строки считаем сверху вниз и переводим в нижний левый угол VTK
+            Tap row = sampleAt(dy, h, sourceHeight);
+            const uint8_t* top = source + static_cast<size_t>(sourceHeight - 1 - row.first) * sourceStride;
+            const uint8_t* bottom = source + static_cast<size_t>(sourceHeight - 1 - row.second) * sourceStride;
+            uint8_t* out = target + (static_cast<size_t>(height - 1 - (y + dy)) * width + x) * 3;
+            for (int dx = 0; dx < w; ++dx) {
+                const Tap& column = columns[dx];
+                const size_t left = static_cast<size_t>(column.first) * components;
+                const size_t right = static_cast<size_t>(column.second) * components;
+                for (int c = 0; c < 3; ++c) {
+                    const int k = channels[c];
+                    float upper = top[left + k] + (top[right + k] - top[left + k]) * column.weight;
+                    float lower = bottom[left + k] + (bottom[right + k] - bottom[left + k]) * column.weight;
+                    out[dx * 3 + c] = static_cast<uint8_t>(upper + (lower - upper) * row.weight + 0.5f);
+                }
+            }
+        }
+        pasted = {x, y, w, h};
+        image->Modified();
+
+        box = {static_cast<double>(x) / width, static_cast<double>(y) / height,
+               static_cast<double>(x + w) / width, static_cast<double>(y + h) / height};
+        return true;
+    }
+
+    vtkImageData* GetImage() { return image; }
+
+    int GetWidth() const { return width; }
+
+    int GetHeight() const { return height; }
+
+private:
+    // Два соседних пикселя источника и вес второго из них
+    struct Tap {
+        int first;
+        int second;
+        float weight;
+    };
+
+    // Центры пикселей результата проецируются на источник, как в resize с INTER_LINEAR;
+    // при масштабе 1 вес нулевой и пиксели копируются как есть
+    static Tap sampleAt(int index, int size, int sourceSize) {
+        double position = (index + 0.5) * sourceSize / size - 0.5;
+        position = std::clamp(position, 0.0, static_cast<double>(sourceSize - 1));
+        int first = static_cast<int>(position);
+        int second = std::min(first + 1, sourceSize - 1);
+        return {first, second, static_cast<float>(position - first)};
+    }
+
+    // Закрашивает белым прямоугольник прошлой вклейки
+    void clear() {
+        auto* target = static_cast<uint8_t*>(image->GetScalarPointer());
+        for (int dy = 0; dy < pasted[3]; ++dy) {
+            uint8_t* out = target + (static_cast<size_t>(height - 1 - (pasted[1] + dy)) * width + pasted[0]) * 3;
+            std::memset(out, 255, static_cast<size_t>(pasted[2]) * 3);
+        }
+        pasted = {0, 0, 0, 0};
+    }
+
+    int width;
+    int height;
+    vtkNew<vtkImageData> image;
+    std::array<int, 4> pasted = {0, 0, 0, 0}; // x, y, w, h
+    std::vector<Tap> columns;
+};
@@ -0,0 +1,251 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Seeds.hpp"
+
+// Один сэмпл пакетного рендера: текстура со штрих-кодом, фон и UV-рамка штрих-кода.
+// Вместо готовой текстуры можно дать сам штрих-код (barcode): тогда Scene вклеивает
+// его в холст в памяти со случайным масштабом из scale и случайной позицией
+// (или заданной в position) и сама считает box.
+struct Sample {
+    std::string texture;
+    std::string background;
+    std::array<double, 4> box = {0, 0, 0, 0}; // top_left_x, top_left_y, bottom_right_x, bottom_right_y
+
+    std::string barcode;
+    std::array<double, 2> scale = {1, 1};       // диапазон масштаба штрих-кода
+    std::array<double, 2> position = {-1, -1};  // левый верхний угол в долях холста; < 0 — случайно
+
+    // Процедурная поверхность вместо mesh.obj, см. parseSurfaceSpec; пусто — из --surface
+    std::string surface;
+
+    // Камера по умолчанию совпадает с той, что раньше была захардкожена в main()
+    std::array<double, 3> cameraPosition = {-7, -16, -40};
+    std::array<double, 3> cameraFocalPoint = {0, 0, 0};
+    std::array<double, 3> cameraViewUp = {0, -1, 0};
+
+    // Разрешение кадра; 0 — разрешение по умолчанию из командной строки
+    int width = 0;
+    int height = 0;
+
+    // Зерно случайного масштаба, позиции и поверхности сэмпла и префикс его имени,
+    // см. selectSamples
+    uint64_t seed = 0;
+};
+
+// Достает значение поля key из плоского JSON-объекта в одну строку.
+// Поддерживаются только строки и массивы чисел — больше манифесту не нужно.
+inline bool findJsonField(const std::string& line, const std::string& key, std::string& value) {
+    size_t pos = line.find("\"" + key + "\"");
+    if (pos == std::string::npos) {
+        return false;
+    }
+    pos = line.find(':', pos + key.size() + 2);
+    if (pos == std::string::npos) {
+        return false;
+    }
+    pos = line.find_first_not_of(" \t", pos + 1);
+    if (pos == std::string::npos) {
+        return false;
+    }
+    char open = line[pos];
+    if (open == '"') {
+        size_t end = line.find('"', pos + 1);
+        if (end == std::string::npos) {
+            return false;
+        }
+        value = line.substr(pos + 1, end - pos - 1);
+        return true;
+    }
+    if (open == '[') {
+        size_t end = line.find(']', pos);
+        if (end == std::string::npos) {
+            return false;
+        }
+        value = line.substr(pos + 1, end - pos - 1);
+        return true;
+    }
+    size_t end = line.find_first_of(",}", pos);
+    value = line.substr(pos, end == std::string::npos ? std::string::npos : end - pos);
+    return true;
+}
+
+template <size_t N>
+bool parseNumbers(std::string text, std::array<double, N>& out) {
+    for (char& c : text) {
+        if (c == ',') {
+            c = ' ';
+        }
+    }
+    std::istringstream stream(text);
+    for (size_t i = 0; i < N; ++i) {
+        if (!(stream >> out[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+inline bool parseJsonSample(const std::string& line, Sample& sample) {
+    std::string value;
+    if (!findJsonField(line, "background", sample.background)) {
+        return false;
+    }
+    if (findJsonField(line, "barcode", sample.barcode)) {
+        if (findJsonField(line, "scale", value) && !parseNumbers(value, sample.scale)) {
+            return false;
+        }
+        if (findJsonField(line, "position", value) && !parseNumbers(value, sample.position)) {
+            return false;
+        }
+    } else if (!findJsonField(line, "texture", sample.texture) ||
+               !findJsonField(line, "box", value) || !parseNumbers(value, sample.box)) {
+        return false;
+    }
+    findJsonField(line, "surface", sample.surface);
+    if (findJsonField(line, "camera", value) && !parseNumbers(value, sample.cameraPosition)) {
+        return false;
+    }
+    if (findJsonField(line, "focal_point", value) && !parseNumbers(value, sample.cameraFocalPoint)) {
+        return false;
+    }
+    if (findJsonField(line, "view_up", value) && !parseNumbers(value, sample.cameraViewUp)) {
+        return false;
+    }
+    if (findJsonField(line, "size", value)) {
+        std::array<double, 2> size;
+        if (!parseNumbers(value, size)) {
+            return false;
+        }
+        sample.width = static_cast<int>(size[0]);
+        sample.height = static_cast<int>(size[1]);
+    }
+    return true;
+}
+
+// Строка простого списка: texture background tl_x tl_y br_x br_y [cam_x cam_y cam_z]
+// или barcode <штрих-код> background [scale_min scale_max] [cam_x cam_y cam_z]
+inline bool parsePlainSample(const std::string& line, Sample& sample) {
+    std::istringstream stream(line);
+    std::string first;
+    if (!(stream >> first)) {
+        return false;
+    }
+    if (first == "barcode") {
+        if (!(stream >> sample.barcode >> sample.background)) {
+            return false;
+        }
+        std::vector<double> numbers;
+        for (double value; stream >> value;) {
+            numbers.push_back(value);
+        }
+        if (numbers.size() != 0 && numbers.size() != 2 && numbers.size() != 3 && numbers.size() != 5) {
+            return false;
+        }
+        size_t next = 0;
+        if (numbers.size() % 3 != 0) {
+            sample.scale = {numbers[0], numbers[1]};
+            next = 2;
+        }
+        if (numbers.size() - next == 3) {
+            sample.cameraPosition = {numbers[next], numbers[next + 1], numbers[next + 2]};
+        }
+        return true;
+    }
+    sample.texture = first;
+    if (!(stream >> sample.background)) {
+        return false;
+    }
+    for (double& value : sample.box) {
+        if (!(stream >> value)) {
+            return false;
+        }
+    }
+    std::array<double, 3> position;
+    if (stream >> position[0] >> position[1] >> position[2]) {
+        sample.cameraPosition = position;
+    }
+    return true;
+}
+
+// Читает манифест пакетного режима: либо простой список, либо JSONL
+// ({"texture": ..., "background": ..., "box": [..4..], "camera": [..3..], "size": [w, h]},
+// вместо texture и box — "barcode": ... с необязательными "scale": [min, max] и "position": [x, y];
+// "surface": "cylinder:radius=5" — поверхность сэмпла).
+// Пустые строки и строки, начинающиеся с '#', пропускаются.
+inline std::vector<Sample> readManifest(const std::string& path) {
+    std::vector<Sample> samples;
+    std::ifstream in(path);
+    if (!in.is_open()) {
+        std::cerr << "Не удалось открыть манифест: " << path << std::endl;
+        return samples;
+    }
+
+    size_t lineNumber = 0;
+    for (std::string line; std::getline(in, line);) {
+        ++lineNumber;
+        size_t start = line.find_first_not_of(" \t\r");
+        if (start == std::string::npos || line[start] == '#') {
+            continue;
+        }
+        Sample sample;
+        bool ok = line[start] == '{' ? parseJsonSample(line, sample) : parsePlainSample(line, sample);
+        if (!ok) {
+            std::cerr << "Warning: " << path << ":" << lineNumber << " doesn't satisfy manifest format\n";
+            continue;
+        }
+        samples.push_back(std::move(sample));
+    }
+    return samples;
+}
+
+// Ключ сэмпла — хэш всего, что определяет кадр: штрих-код или текстура, фон,
+// поверхность, камера и размер. Не зависит от порядка строк в манифесте
+inline uint64_t sampleKey(const Sample& sample) {
+    std::ostringstream key;
+    key.precision(17);
+    key << sample.texture << '\n' << sample.background << '\n' << sample.barcode << '\n' << sample.surface << '\n';
+    for (double value : sample.box) {
+        key << value << ' ';
+    }
+    for (double value : sample.scale) {
+        key << value << ' ';
+    }
+    for (double value : sample.position) {
+        key << value << ' ';
+    }
+    for (const auto* vector : {&sample.cameraPosition, &sample.cameraFocalPoint, &sample.cameraViewUp}) {
+        for (double value : *vector) {
+            key << value << ' ';
+        }
+    }
+    key << sample.width << 'x' << sample.height;
+    return HashString(key.str());
+}
+
+// Оставляет сэмплы узла shard (--shard i/N) и выдает каждому зерно от ключа и
+// --seed. Одинаковые строки манифеста различаются номером повтора, так что
+// все узлы делят работу одинаково без координации, имена не пересекаются, а
+// любой шард можно перезапустить отдельно с тем же результатом
+inline std::vector<Sample> selectSamples(const std::vector<Sample>& samples, uint64_t seed, const WorkShard& shard) {
+    std::vector<Sample> selected;
+    std::unordered_map<uint64_t, uint64_t> repeats;
+    for (const auto& sample : samples) {
+        const uint64_t key = sampleKey(sample);
+        const uint64_t id = CombineSeed(key, repeats[key]++);
+        if (!shard.Owns(id)) {
+            continue;
+        }
+        selected.push_back(sample);
+        selected.back().seed = CombineSeed(seed, id);
+    }
+    return selected;
+}
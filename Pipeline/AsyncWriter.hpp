@@ -0,0 +1,200 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "Codec.hpp"
+#include "Shards.hpp"
+#include "ThreadPool.hpp"
+#include "Trace.hpp"
+
+// Background encode/write stage. Producers (render loop, distortion workers)
+// hand over raw pixels and go on with the next sample; a pool of encoder
+// threads compresses them and writes loose files or shard members. The queue
+// is the pool's bounded backlog, so a producer only blocks when the encoders
+// are `capacity` images behind, and that wait is reported with the rest.
+class AsyncWriter {
+public:
+    // Encodes one image into the buffer, returns false on failure. Called
+    // concurrently from the encoder threads.
+    using Encoder = std::function<bool(const EncodeImage&, std::vector<uint8_t>&)>;
+
+    // Extra files stored next to the image: {extension, content}
+    using Extras = std::vector<std::pair<std::string, std::string>>;
+
+    AsyncWriter(Encoder encoder, std::string extension, size_t threads, size_t capacity = 0, ShardWriter* shards = nullptr) :
+            encoder(std::move(encoder)), extension(std::move(extension)), shards(shards), pool(threads, capacity) {}
+
+    AsyncWriter(const AsyncWriter&) = delete;
+
+    ~AsyncWriter() {
+        Wait();
+    }
+
+    // `name` is the path without extension for loose files, the sample key for
+    // shards. Blocks while the queue is full.
+    void Submit(std::string name, EncodeImage image, Extras extras = {}) {
+        Enqueue(std::make_shared<Job>(Job{std::move(name), std::move(image), std::move(extras), {}}));
+    }
+
+    // An image the producer has already compressed into the file at `path`
+    // (imgen --strips encodes as it distorts). It's only moved into place here:
+    // renamed to the output file, or copied into the shard and removed. `path`
+    // should be on the output file system for the rename.
+    void SubmitFile(std::string name, std::string path, Extras extras = {}) {
+        Enqueue(std::make_shared<Job>(Job{std::move(name), {}, std::move(extras), std::move(path)}));
+    }
+
+    // Blocks until everything submitted so far is written
+    void Wait() { pool.Wait(); }
+
+    const std::string& Extension() const { return extension; }
+
+    bool IsSharded() const { return shards != nullptr; }
+
+    size_t Failed() const { return failed; }
+
+    void Report(std::ostream& out) const {
+        const size_t count = submitted.load();
+        const double mb = static_cast<double>(bytes.load()) / (1 << 20);
+        out << "Writer: " << written << "/" << count << " images, " << mb << " MB as " << extension
+            << ", queue depth avg " << (count > 0 ? static_cast<double>(depth_sum) / count : 0.0)
+            << " max " << max_depth << " of " << pool.Capacity()
+            << ", producers waited " << waited_ns / 1e9 << " s"
+            << ", encode " << (encodes > 0 ? encode_ns / 1e6 / encodes : 0.0) << " ms per image\n";
+    }
+
+private:
+    struct Job {
+        std::string name;
+        EncodeImage image;
+        Extras extras;
+        std::string encoded_path; // set by SubmitFile
+    };
+
+    void Enqueue(std::shared_ptr<Job> job) {
+        const size_t depth = pool.Pending();
+        const auto start = std::chrono::steady_clock::now();
+        pool.Submit([this, job] { Run(*job); });
+        waited_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        depth_sum += depth;
+        TRACE_GAUGE("writer queue", depth);
+        size_t seen = max_depth.load();
+        while (depth > seen && !max_depth.compare_exchange_weak(seen, depth)) {
+        }
+        ++submitted;
+    }
+
+    void Run(const Job& job) {
+        if (!job.encoded_path.empty()) {
+            Move(job);
+            return;
+        }
+        thread_local std::vector<uint8_t> buffer;
+        {
+            const auto start = std::chrono::steady_clock::now();
+            TRACE_SCOPE("encode");
+            if (!encoder(job.image, buffer)) {
+                PIPELINE_LOG(LogLevel::Error, "Can't encode " << job.name << '.' << extension);
+                ++failed;
+                return;
+            }
+            encode_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+            ++encodes;
+        }
+        Write(job, {extension, buffer.data(), buffer.size()});
+    }
+
+    // A SubmitFile job: only the extras are in memory
+    void Move(const Job& job) {
+        std::error_code error;
+        const uint64_t size = std::filesystem::file_size(job.encoded_path, error);
+        if (error) {
+            PIPELINE_LOG(LogLevel::Error, "Can't read " << job.encoded_path << " : " << error.message());
+            ++failed;
+            return;
+        }
+        if (shards) {
+            Write(job, {extension, nullptr, size, job.encoded_path.c_str()});
+            std::filesystem::remove(job.encoded_path, error);
+            return;
+        }
+        const std::string path = job.name + "." + extension;
+        std::filesystem::rename(job.encoded_path, path, error);
+        if (error) {
+            PIPELINE_LOG(LogLevel::Error, "Can't move " << job.encoded_path << " to " << path << " : " << error.message());
+            std::filesystem::remove(job.encoded_path, error);
+            ++failed;
+            return;
+        }
+        Write(job, {extension, nullptr, size, nullptr});
+    }
+
+    // The image (already in place if it has no data) and the extras
+    void Write(const Job& job, const ShardFile& image) {
+        TRACE_SCOPE("write");
+        uint64_t total = image.size;
+        bool ok = true;
+        if (shards) {
+            std::vector<ShardFile> files = {image};
+            for (const auto& [extra_extension, content] : job.extras) {
+                files.push_back({extra_extension, content.data(), content.size()});
+                total += content.size();
+            }
+            ok = shards->Write(job.name, files);
+        } else {
+            if (image.data) {
+                ok = WriteFile(job.name + "." + extension, image.data, image.size);
+            }
+            for (const auto& [extra_extension, content] : job.extras) {
+                ok = WriteFile(job.name + "." + extra_extension, content.data(), content.size()) && ok;
+                total += content.size();
+            }
+        }
+        if (!ok) {
+            ++failed;
+            return;
+        }
+        bytes += total;
+        ++written;
+        TRACE_COUNT("bytes written", total);
+        TRACE_COUNT("images written", 1);
+    }
+
+    static bool WriteFile(const std::string& path, const void* data, size_t size) {
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        out.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+        if (!out) {
+            PIPELINE_LOG(LogLevel::Error, "Can't write " << path);
+            return false;
+        }
+        return true;
+    }
+
+    Encoder encoder;
+    std::string extension;
+    ShardWriter* shards;
+
+    std::atomic<size_t> submitted{0};
+    std::atomic<size_t> written{0};
+    std::atomic<size_t> failed{0};
+    std::atomic<uint64_t> bytes{0};
+    std::atomic<uint64_t> depth_sum{0};
+    std::atomic<size_t> max_depth{0};
+    std::atomic<uint64_t> waited_ns{0};
+    std::atomic<uint64_t> encode_ns{0};
+    std::atomic<size_t> encodes{0};
+
+    // Last, so it's destroyed (and drained) first while the rest is still alive
+    ThreadPool pool;
+};
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Bounded queue between two stages of a streaming pipeline. Producers block
+// while it's full, so a fast stage can't run ahead of a slow one and the
+// number of images in flight stays bounded; consumers block while it's empty.
+// Close() is called once every producer is done: consumers drain what is left
+// and then Pop returns false.
+template <class T>
+class Channel {
+public:
+    explicit Channel(size_t capacity) : capacity(std::max<size_t>(capacity, 1)) {}
+
+    Channel(const Channel&) = delete;
+
+    // Blocks while the channel is full; false if it's closed, the item is dropped
+    bool Push(T item) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            space.wait(lock, [this] { return closed || items.size() < capacity; });
+            if (closed) {
+                return false;
+            }
+            items.push_back(std::move(item));
+        }
+        ready.notify_one();
+        return true;
+    }
+
+    // Blocks while the channel is empty; false once it's closed and drained
+    bool Pop(T& item) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            ready.wait(lock, [this] { return closed || !items.empty(); });
+            if (items.empty()) {
+                return false;
+            }
+            item = std::move(items.front());
+            items.pop_front();
+        }
+        space.notify_one();
+        return true;
+    }
+
+    void Close() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            closed = true;
+        }
+        ready.notify_all();
+        space.notify_all();
+    }
+
+    size_t Size() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return items.size();
+    }
+
+    size_t Capacity() const { return capacity; }
+
+private:
+    size_t capacity;
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::condition_variable space;
+    std::deque<T> items;
+    bool closed = false;
+};
+
+// Threads of one pipeline stage. Each runs `body` with its index (a stage with
+// per-thread state, like a renderer, builds it at the top of the body); `done`
+// runs once, after the last of them has returned, and usually closes the
+// stage's output channel.
+class Stage {
+public:
+    Stage(size_t threads, std::function<void(size_t)> body, std::function<void()> done = nullptr) :
+            body(std::move(body)), done(std::move(done)), remaining(std::max<size_t>(threads, 1)) {
+        const size_t count = remaining;
+        for (size_t i = 0; i < count; ++i) {
+            workers.emplace_back([this, i] {
+                this->body(i);
+                if (--remaining == 0 && this->done) {
+                    this->done();
+                }
+            });
+        }
+    }
+
+    Stage(const Stage&) = delete;
+
+    ~Stage() {
+        Join();
+    }
+
+    void Join() {
+        for (auto& worker : workers) {
+            if (worker.joinable()) {
+                worker.join();
+            }
+        }
+    }
+
+    size_t Size() const { return workers.size(); }
+
+private:
+    std::function<void(size_t)> body;
+    std::function<void()> done;
+    std::atomic<size_t> remaining;
+    std::vector<std::thread> workers;
+};
@@ -0,0 +1,157 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Pixels handed to the encoder stage: tightly packed 8-bit rows, 1, 3 or 4
+// channels. The producer copies its frame in, so its own buffer can be
+// reused for the next sample right away.
+struct EncodeImage {
+    std::vector<uint8_t> pixels;
+    int width = 0;
+    int height = 0;
+    int channels = 0;
+    bool bottom_up = false; // VTK order: the first row in memory is the bottom one
+
+    // Row y counted from the top of the picture
+    const uint8_t* Row(int y) const {
+        const int row = bottom_up ? height - 1 - y : y;
+        return pixels.data() + static_cast<size_t>(row) * width * channels;
+    }
+};
+
+enum class Codec {
+    Jpeg,
+    Png,
+    Qoi, // fast lossless, see qoiformat.org
+    Raw  // binary PNM, no compression at all
+};
+
+struct CodecOptions {
+    Codec codec = Codec::Png;
+    int quality = -1; // JPEG quality 0..100, -1 - the library default
+    int level = -1;   // PNG compression level 0..9, -1 - the library default
+};
+
+// "jpg[:quality]", "png[:level]", "qoi" or "raw"
+inline bool ParseCodec(const std::string& text, CodecOptions& options) {
+    const size_t colon = text.find(':');
+    const std::string name = text.substr(0, colon);
+    const int value = colon == std::string::npos ? -1 : std::stoi(text.substr(colon + 1));
+    if (name == "jpg" || name == "jpeg") {
+        options = {Codec::Jpeg, value, -1};
+    } else if (name == "png") {
+        options = {Codec::Png, -1, value};
+    } else if (name == "qoi") {
+        options = {Codec::Qoi, -1, -1};
+    } else if (name == "raw") {
+        options = {Codec::Raw, -1, -1};
+    } else {
+        return false;
+    }
+    return true;
+}
+
+inline const char* CodecExtension(Codec codec) {
+    switch (codec) {
+        case Codec::Jpeg: return "jpg";
+        case Codec::Png: return "png";
+        case Codec::Qoi: return "qoi";
+        case Codec::Raw: return "pnm";
+    }
+    return "";
+}
+
+// P5 for grayscale, P6 for color (alpha is dropped)
+inline void EncodeRaw(const EncodeImage& image, std::vector<uint8_t>& out) {
+    const int channels = image.channels == 1 ? 1 : 3;
+    const std::string header = (channels == 1 ? "P5\n" : "P6\n") + std::to_string(image.width) + " " +
+                               std::to_string(image.height) + "\n255\n";
+    out.assign(header.begin(), header.end());
+    out.reserve(out.size() + static_cast<size_t>(image.width) * image.height * channels);
+    for (int y = 0; y < image.height; ++y) {
+        const uint8_t* row = image.Row(y);
+        if (channels == image.channels) {
+            out.insert(out.end(), row, row + static_cast<size_t>(image.width) * channels);
+            continue;
+        }
+        for (int x = 0; x < image.width; ++x) {
+            out.insert(out.end(), row + x * image.channels, row + x * image.channels + 3);
+        }
+    }
+}
+
+// QOI: a single pass with a 64-entry color cache, runs and small deltas.
+// Lossless and several times faster than PNG at a somewhat larger size.
+// Grayscale is stored as RGB, QOI has no single-channel mode.
+inline void EncodeQoi(const EncodeImage& image, std::vector<uint8_t>& out) {
+    const int channels = image.channels == 4 ? 4 : 3;
+    out.clear();
+    out.reserve(14 + static_cast<size_t>(image.width) * image.height * (channels + 1) + 8);
+    const uint8_t header[14] = {'q', 'o', 'i', 'f',
+                                static_cast<uint8_t>(image.width >> 24), static_cast<uint8_t>(image.width >> 16),
+                                static_cast<uint8_t>(image.width >> 8), static_cast<uint8_t>(image.width),
+                                static_cast<uint8_t>(image.height >> 24), static_cast<uint8_t>(image.height >> 16),
+                                static_cast<uint8_t>(image.height >> 8), static_cast<uint8_t>(image.height),
+                                static_cast<uint8_t>(channels), 0};
+    out.insert(out.end(), header, header + sizeof(header));
+
+    struct Pixel {
+        uint8_t r, g, b, a;
+        bool operator==(const Pixel& other) const {
+            return r == other.r && g == other.g && b == other.b && a == other.a;
+        }
+    };
+    Pixel cache[64] = {};
+    Pixel previous = {0, 0, 0, 255};
+    int run = 0;
+    const size_t total = static_cast<size_t>(image.width) * image.height;
+    size_t index = 0;
+    for (int y = 0; y < image.height; ++y) {
+        const uint8_t* row = image.Row(y);
+        for (int x = 0; x < image.width; ++x, ++index) {
+            const uint8_t* p = row + x * image.channels;
+            const Pixel pixel = image.channels >= 3 ? Pixel{p[0], p[1], p[2], image.channels == 4 ? p[3] : uint8_t(255)}
+                                                    : Pixel{p[0], p[0], p[0], 255};
+            if (pixel == previous) {
+                ++run;
+                if (run == 62 || index + 1 == total) {
+                    out.push_back(static_cast<uint8_t>(0xc0 | (run - 1)));
+                    run = 0;
+                }
+                continue;
+            }
+            if (run > 0) {
+                out.push_back(static_cast<uint8_t>(0xc0 | (run - 1)));
+                run = 0;
+            }
+            const int slot = (pixel.r * 3 + pixel.g * 5 + pixel.b * 7 + pixel.a * 11) % 64;
+            if (cache[slot] == pixel) {
+                out.push_back(static_cast<uint8_t>(slot));
+            } else if (pixel.a == previous.a) {
+                cache[slot] = pixel;
+                const int8_t dr = static_cast<int8_t>(pixel.r - previous.r);
+                const int8_t dg = static_cast<int8_t>(pixel.g - previous.g);
+                const int8_t db = static_cast<int8_t>(pixel.b - previous.b);
+                const int8_t dr_dg = static_cast<int8_t>(dr - dg);
+                const int8_t db_dg = static_cast<int8_t>(db - dg);
+                if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1) {
+                    out.push_back(static_cast<uint8_t>(0x40 | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2)));
+                } else if (dg >= -32 && dg <= 31 && dr_dg >= -8 && dr_dg <= 7 && db_dg >= -8 && db_dg <= 7) {
+                    out.push_back(static_cast<uint8_t>(0x80 | (dg + 32)));
+                    out.push_back(static_cast<uint8_t>((dr_dg + 8) << 4 | (db_dg + 8)));
+                } else {
+                    out.insert(out.end(), {0xfe, pixel.r, pixel.g, pixel.b});
+                }
+            } else {
+                cache[slot] = pixel;
+                out.insert(out.end(), {0xff, pixel.r, pixel.g, pixel.b, pixel.a});
+            }
+            previous = pixel;
+        }
+    }
+    const uint8_t end[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+    out.insert(out.end(), end, end + sizeof(end));
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+#include "ImageStore.hpp"
+
+// Decoded images shared by everyone in the process, keyed by path and
+// modification time: a file that changed on disk is decoded again. Entries
+// are evicted least recently used first once their decoded bytes go over the
+// budget. `Image` is whatever handle the caller decodes into (cv::Mat,
+// vtkSmartPointer<vtkImageData>): it's copied out under the lock, so it
+// should be a cheap reference-counted handle. Decoding runs outside the lock;
+// two threads missing the same file at once may both decode it.
+template <class Image>
+class ImageCache {
+public:
+    // Decodes path into image, sets its size in bytes; false on failure
+    using Loader = std::function<bool(const std::string& path, Image& image, size_t& bytes)>;
+
+    explicit ImageCache(size_t budget_bytes) : budget(budget_bytes) {}
+
+    ImageCache(const ImageCache&) = delete;
+
+    bool Get(const std::string& path, const Loader& load, Image& image) {
+        const int64_t mtime = ImageMTime(path);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto found = entries.find(path);
+            if (found != entries.end() && found->second.mtime == mtime) {
+                order.splice(order.begin(), order, found->second.position);
+                image = found->second.image;
+                ++hits;
+                return true;
+            }
+        }
+        ++misses;
+        size_t size = 0;
+        if (!load(path, image, size)) {
+            return false;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        auto found = entries.find(path);
+        if (found != entries.end()) {
+            bytes -= found->second.bytes;
+            order.erase(found->second.position);
+            entries.erase(found);
+        }
+        // An image bigger than the whole budget is handed out but not kept
+        if (size > budget) {
+            return true;
+        }
+        while (bytes + size > budget && !order.empty()) {
+            auto last = entries.find(order.back());
+            bytes -= last->second.bytes;
+            entries.erase(last);
+            order.pop_back();
+        }
+        order.push_front(path);
+        entries.emplace(path, Entry{image, mtime, size, order.begin()});
+        bytes += size;
+        return true;
+    }
+
+    void Report(std::ostream& out) {
+        std::lock_guard<std::mutex> lock(mutex);
+        out << "Image cache: " << hits << " hits, " << misses << " decoded, " << entries.size() << " images, "
+            << static_cast<double>(bytes) / (1 << 20) << " of " << static_cast<double>(budget) / (1 << 20) << " MB\n";
+    }
+
+private:
+    struct Entry {
+        Image image;
+        int64_t mtime;
+        size_t bytes;
+        std::list<std::string>::iterator position;
+    };
+
+    size_t budget;
+    std::mutex mutex;
+    std::list<std::string> order; // most recently used first
+    std::unordered_map<std::string, Entry> entries;
+    size_t bytes = 0;
+    std::atomic<size_t> hits{0};
+    std::atomic<size_t> misses{0};
+};
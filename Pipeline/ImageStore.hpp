@@ -0,0 +1,202 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <unordered_map>
+#include <vector>
+
+#include "MappedFile.hpp"
+
+// Pre-decoded image store: one file with the raw 8-bit pixels of a whole
+// image library (backgrounds, say), decoded once. Readers map it read-only,
+// so every worker process on a node shares the same page-cached pixels and
+// nobody decodes or keeps a private copy. Layout: a 32-byte header, the
+// pixel data of every image starting at a page boundary, and at the end a
+// table of fixed 256-byte records (see ImageStoreRecord). Images are looked
+// up by the absolute normalized path of their source file, and a record only
+// counts while the source keeps the modification time it had at build time.
+
+struct ImageStoreHeader {
+    char magic[8];         // "IMGSTORE"
+    uint32_t version;      // 1
+    uint32_t record_size;  // sizeof(ImageStoreRecord)
+    uint64_t index_offset; // where the record table starts
+    uint64_t count;
+};
+
+struct ImageStoreRecord {
+    uint64_t offset;   // of the pixels, page aligned
+    int64_t mtime;     // of the source file, ns since the epoch
+    uint32_t width;
+    uint32_t height;
+    uint8_t channels;
+    uint8_t bottom_up; // rows are stored bottom to top (VTK order)
+    uint8_t reserved[6];
+    char path[224];    // absolute source path, NUL padded
+};
+
+static_assert(sizeof(ImageStoreHeader) == 32, "store header must stay 32 bytes");
+static_assert(sizeof(ImageStoreRecord) == 256, "store records must stay 256 bytes");
+
+// Key of an image in stores and caches
+inline std::string ImageKey(const std::string& path) {
+    std::error_code error;
+    std::filesystem::path absolute = std::filesystem::absolute(path, error);
+    return error ? path : absolute.lexically_normal().string();
+}
+
+// Modification time in ns since the epoch, -1 if the file isn't there
+inline int64_t ImageMTime(const std::string& path) {
+    std::error_code error;
+    auto time = std::filesystem::last_write_time(path, error);
+    if (error) {
+        return -1;
+    }
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+}
+
+// Pixels of one stored image; data points into the mapping
+struct StoredImage {
+    const uint8_t* data = nullptr;
+    int width = 0;
+    int height = 0;
+    int channels = 0;
+    bool bottom_up = false;
+};
+
+class ImageStoreWriter {
+public:
+    explicit ImageStoreWriter(const std::string& path) : path(path), out(path, std::ios::binary | std::ios::trunc) {
+        if (!out.is_open()) {
+            std::cerr << "Can't open image store : " << path << '\n';
+            return;
+        }
+        const ImageStoreHeader header = {};
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        offset = sizeof(header);
+    }
+
+    ImageStoreWriter(const ImageStoreWriter&) = delete;
+
+    ~ImageStoreWriter() {
+        Close();
+    }
+
+    // Tightly packed rows of `source`, decoded by the caller
+    bool Add(const std::string& source, const uint8_t* pixels, int width, int height, int channels, bool bottom_up) {
+        const std::string key = ImageKey(source);
+        if (!out.is_open()) {
+            return false;
+        }
+        if (key.size() >= sizeof(ImageStoreRecord::path)) {
+            std::cerr << "Image path is too long for the store: " << key << '\n';
+            return false;
+        }
+        Pad();
+        ImageStoreRecord record = {};
+        record.offset = offset;
+        record.mtime = ImageMTime(source);
+        record.width = static_cast<uint32_t>(width);
+        record.height = static_cast<uint32_t>(height);
+        record.channels = static_cast<uint8_t>(channels);
+        record.bottom_up = bottom_up ? 1 : 0;
+        std::memcpy(record.path, key.data(), key.size());
+        const size_t bytes = static_cast<size_t>(width) * height * channels;
+        out.write(reinterpret_cast<const char*>(pixels), static_cast<std::streamsize>(bytes));
+        offset += bytes;
+        records.push_back(record);
+        return static_cast<bool>(out);
+    }
+
+    // Writes the record table and the header; the store is usable after this
+    bool Close() {
+        if (!out.is_open()) {
+            return false;
+        }
+        Pad();
+        const ImageStoreHeader header = {{'I', 'M', 'G', 'S', 'T', 'O', 'R', 'E'}, 1, sizeof(ImageStoreRecord),
+                                         offset, records.size()};
+        out.write(reinterpret_cast<const char*>(records.data()),
+                  static_cast<std::streamsize>(records.size() * sizeof(ImageStoreRecord)));
+        out.seekp(0);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.close();
+        if (!out) {
+            std::cerr << "Can't write image store : " << path << '\n';
+            return false;
+        }
+        return true;
+    }
+
+    size_t Size() const { return records.size(); }
+
+private:
+    static constexpr uint64_t PAGE = 4096;
+
+    void Pad() {
+        static const char zeros[PAGE] = {};
+        const uint64_t padded = (offset + PAGE - 1) / PAGE * PAGE;
+        out.write(zeros, static_cast<std::streamsize>(padded - offset));
+        offset = padded;
+    }
+
+    std::string path;
+    std::ofstream out;
+    uint64_t offset = 0;
+    std::vector<ImageStoreRecord> records;
+};
+
+class ImageStore {
+public:
+    explicit ImageStore(const std::string& path) : file(path) {
+        if (!file.data || file.size < sizeof(ImageStoreHeader)) {
+            std::cerr << "Can't open image store : " << path << '\n';
+            return;
+        }
+        ImageStoreHeader header;
+        std::memcpy(&header, file.data, sizeof(header));
+        if (std::memcmp(header.magic, "IMGSTORE", 8) != 0 || header.version != 1 ||
+            header.record_size != sizeof(ImageStoreRecord) ||
+            header.index_offset + header.count * sizeof(ImageStoreRecord) > file.size) {
+            std::cerr << "Not an image store : " << path << '\n';
+            return;
+        }
+        const auto* table = reinterpret_cast<const ImageStoreRecord*>(file.data + header.index_offset);
+        for (uint64_t i = 0; i < header.count; ++i) {
+            const ImageStoreRecord& record = table[i];
+            const size_t bytes = static_cast<size_t>(record.width) * record.height * record.channels;
+            if (record.offset + bytes > file.size) {
+                continue;
+            }
+            records.emplace(std::string_view(record.path, strnlen(record.path, sizeof(record.path))), &record);
+        }
+    }
+
+    ImageStore(const ImageStore&) = delete;
+
+    // False when the image isn't stored or its source changed since
+    bool Find(const std::string& source, StoredImage& image) const {
+        auto found = records.find(ImageKey(source));
+        if (found == records.end() || found->second->mtime != ImageMTime(source)) {
+            return false;
+        }
+        const ImageStoreRecord& record = *found->second;
+        image = {file.data + record.offset, static_cast<int>(record.width), static_cast<int>(record.height),
+                 record.channels, record.bottom_up != 0};
+        return true;
+    }
+
+    size_t Size() const { return records.size(); }
+
+private:
+    MappedFile file;
+    std::unordered_map<std::string_view, const ImageStoreRecord*> records;
+};
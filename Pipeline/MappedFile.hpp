@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Read-only memory mapping of a whole file
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& path) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return;
+        }
+        struct stat info;
+        if (::fstat(fd, &info) == 0 && info.st_size > 0) {
+            void* mapped = ::mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped != MAP_FAILED) {
+                data = static_cast<const uint8_t*>(mapped);
+                size = static_cast<size_t>(info.st_size);
+            }
+        }
+        ::close(fd);
+    }
+
+    MappedFile(const MappedFile&) = delete;
+
+    ~MappedFile() {
+        if (data) {
+            ::munmap(const_cast<uint8_t*>(data), size);
+        }
+    }
+
+    // Tells the kernel to read ahead, for streaming through the whole file
+    void AdviseSequential() const {
+        if (data) {
+            ::madvise(const_cast<uint8_t*>(data), size, MADV_SEQUENTIAL);
+        }
+    }
+
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+};
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <exception>
+#include <string>
+
+// Seeds, names and the work split of a generation run. Everything here is a
+// pure function of its arguments and stable across platforms, so any node can
+// tell which samples are its own and what they are called without talking to
+// the others, and a failed shard can be re-run on its own.
+
+// splitmix64 finalizer: spreads seeds, layer indices and sample ids over all bits
+inline uint64_t MixSeed(uint64_t value) {
+    value += 0x9e3779b97f4a7c15ULL;
+    value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    value = (value ^ (value >> 27)) * 0x94d049bb133111ebULL;
+    return value ^ (value >> 31);
+}
+
+inline uint64_t CombineSeed(uint64_t seed, uint64_t value) {
+    return MixSeed(seed ^ MixSeed(value));
+}
+
+// FNV-1a, stable across platforms (unlike std::hash), for names and file stems
+inline uint64_t HashString(const std::string& text) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (unsigned char c : text) {
+        hash = (hash ^ c) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+// 16 hex digits, the name prefix of a sample keyed by a 64-bit id
+inline std::string SeedName(uint64_t id) {
+    char name[17];
+    std::snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(id));
+    return name;
+}
+
+// --shard i/N: node i of N takes the work items whose key falls into its
+// residue class. Keys are mixed first, so the split is even whatever the keys
+// look like, and it doesn't depend on the order the items are listed in.
+struct WorkShard {
+    uint64_t index = 0;
+    uint64_t count = 1;
+
+    bool Owns(uint64_t key) const {
+        return count <= 1 || MixSeed(key ^ 0x5348415244ULL) % count == index;
+    }
+};
+
+// "i/N" with 0 <= i < N
+inline bool ParseWorkShard(const std::string& text, WorkShard& shard) {
+    const size_t slash = text.find('/');
+    if (slash == std::string::npos || slash == 0 || slash + 1 == text.size()) {
+        return false;
+    }
+    try {
+        size_t used = 0;
+        const uint64_t index = std::stoull(text.substr(0, slash), &used);
+        if (used != slash) {
+            return false;
+        }
+        const uint64_t count = std::stoull(text.substr(slash + 1), &used);
+        if (used != text.size() - slash - 1 || count == 0 || index >= count) {
+            return false;
+        }
+        shard.index = index;
+        shard.count = count;
+        return true;
+    } catch (const std::exception&) {
+        return false;
+    }
+}
@@ -0,0 +1,381 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "MappedFile.hpp"
+
+// Sharded dataset container. Samples are appended to plain ustar archives
+// (`<prefix>-000000.tar`, `<prefix>-000001.tar`, ...): every file of a sample
+// is named `<key>.<extension>` and the files of one sample are consecutive,
+// which is exactly the WebDataset layout, so shards can be read by tar,
+// webdataset or the ShardReader below. Next to every tar there is a `.idx`
+// file: a 16-byte header and one fixed 128-byte record per file with the
+// offset of its data, so a reader maps it and gets O(1) random access without
+// touching the tar headers. A shard is rolled over once adding a sample would
+// take it past the size limit; a sample is never split across shards.
+
+const uint64_t DEFAULT_SHARD_BYTES = uint64_t(1) << 30;
+
+// One file of a sample: stored as <key>.<extension>
+struct ShardFile {
+    std::string extension; // without the dot: "png", "json"
+    const void* data;
+    size_t size;
+    const char* path = nullptr; // data is null: `size` bytes copied from this file
+};
+
+struct ShardIndexHeader {
+    char magic[8];        // "SHARDIDX"
+    uint32_t version;     // 1
+    uint32_t record_size; // sizeof(ShardIndexRecord)
+};
+
+struct ShardIndexRecord {
+    uint64_t offset; // of the file data inside the tar
+    uint64_t size;
+    char name[112];  // tar member name, NUL padded
+};
+
+static_assert(sizeof(ShardIndexHeader) == 16, "index header must stay 16 bytes");
+static_assert(sizeof(ShardIndexRecord) == 128, "index records must stay 128 bytes");
+
+inline std::string ShardPath(const std::string& prefix, size_t shard, const char* extension) {
+    char number[16];
+    std::snprintf(number, sizeof(number), "-%06zu", shard);
+    return prefix + number + extension;
+}
+
+// WebDataset key of a member: the name up to the first dot of its basename
+inline std::string_view ShardKey(std::string_view name) {
+    size_t base = name.rfind('/');
+    base = base == std::string_view::npos ? 0 : base + 1;
+    return name.substr(0, name.find('.', base));
+}
+
+// Appends samples to shards; Write may be called from several threads, each
+// sample goes in whole under the lock. A file already on disk is copied in
+// chunks, so a big one never has to be in memory.
+class ShardWriter {
+public:
+    explicit ShardWriter(const std::string& prefix, uint64_t max_bytes = DEFAULT_SHARD_BYTES) :
+            prefix(prefix), max_bytes(std::max<uint64_t>(max_bytes, BLOCK)) {}
+
+    ShardWriter(const ShardWriter&) = delete;
+
+    ~ShardWriter() {
+        Close();
+    }
+
+    bool Write(const std::string& key, const std::vector<ShardFile>& files) {
+        uint64_t sample_bytes = 0;
+        for (const auto& file : files) {
+            if (key.size() + 1 + file.extension.size() >= NAME_BYTES) {
+                std::cerr << "Shard member name is too long: " << key << '.' << file.extension << '\n';
+                return false;
+            }
+            sample_bytes += BLOCK + Padded(file.size);
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        // End-of-archive blocks are counted too, so a closed shard stays under the limit
+        if (tar.is_open() && bytes > 0 && bytes + sample_bytes + 2 * BLOCK > max_bytes) {
+            FinishShard();
+        }
+        if (!tar.is_open() && !OpenShard()) {
+            return false;
+        }
+        bool ok = true;
+        for (const auto& file : files) {
+            std::string name = key + "." + file.extension;
+            WriteHeader(name, file.size);
+            ShardIndexRecord record = {};
+            record.offset = bytes;
+            record.size = file.size;
+            std::memcpy(record.name, name.data(), name.size());
+            index.write(reinterpret_cast<const char*>(&record), sizeof(record));
+
+            static const char zeros[BLOCK] = {};
+            uint64_t copied = file.size;
+            if (file.data) {
+                tar.write(static_cast<const char*>(file.data), static_cast<std::streamsize>(file.size));
+            } else {
+                copied = CopyFile(file.path, file.size);
+            }
+            // A short source still takes its whole member, zero filled, so the tar stays readable
+            for (uint64_t left = Padded(file.size) - copied; left > 0; left -= std::min<uint64_t>(left, BLOCK)) {
+                tar.write(zeros, static_cast<std::streamsize>(std::min<uint64_t>(left, BLOCK)));
+            }
+            bytes += Padded(file.size);
+            ok = ok && copied == file.size;
+        }
+        ++samples;
+        return ok && static_cast<bool>(tar);
+    }
+
+    void Close() {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (tar.is_open()) {
+            FinishShard();
+        }
+    }
+
+    size_t Samples() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return samples;
+    }
+
+    // Shards opened so far
+    size_t Shards() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return shard;
+    }
+
+private:
+    static constexpr size_t BLOCK = 512;
+    static constexpr size_t NAME_BYTES = 100;
+
+    static uint64_t Padded(uint64_t size) { return (size + BLOCK - 1) / BLOCK * BLOCK; }
+
+    // Up to `size` bytes of the file into the tar a chunk at a time, returns how many
+    uint64_t CopyFile(const char* path, uint64_t size) {
+        std::ifstream in(path, std::ios::binary);
+        if (!in) {
+            std::cerr << "Can't read shard member source : " << path << '\n';
+            return 0;
+        }
+        char chunk[64 * 1024];
+        uint64_t copied = 0;
+        while (copied < size && in) {
+            in.read(chunk, static_cast<std::streamsize>(std::min<uint64_t>(sizeof(chunk), size - copied)));
+            tar.write(chunk, in.gcount());
+            copied += static_cast<uint64_t>(in.gcount());
+        }
+        return copied;
+    }
+
+    bool OpenShard() {
+        std::string tar_path = ShardPath(prefix, shard, ".tar");
+        tar.open(tar_path, std::ios::binary | std::ios::trunc);
+        index.open(ShardPath(prefix, shard, ".idx"), std::ios::binary | std::ios::trunc);
+        if (!tar.is_open() || !index.is_open()) {
+            std::cerr << "Can't open shard : " << tar_path << '\n';
+            tar.close();
+            index.close();
+            return false;
+        }
+        ShardIndexHeader header = {{'S', 'H', 'A', 'R', 'D', 'I', 'D', 'X'}, 1, sizeof(ShardIndexRecord)};
+        index.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        ++shard;
+        bytes = 0;
+        return true;
+    }
+
+    void FinishShard() {
+        static const char zeros[2 * BLOCK] = {};
+        tar.write(zeros, sizeof(zeros));
+        tar.close();
+        index.close();
+    }
+
+    // ustar header; mtime, uid and gid are 0 so the same samples give the same bytes
+    void WriteHeader(const std::string& name, uint64_t size) {
+        char header[BLOCK] = {};
+        std::memcpy(header, name.data(), name.size());
+        std::snprintf(header + 100, 8, "%07o", 0644);
+        std::snprintf(header + 108, 8, "%07o", 0);
+        std::snprintf(header + 116, 8, "%07o", 0);
+        std::snprintf(header + 124, 12, "%011llo", static_cast<unsigned long long>(size));
+        std::snprintf(header + 136, 12, "%011o", 0);
+        header[156] = '0';
+        std::memcpy(header + 257, "ustar", 6);
+        std::memcpy(header + 263, "00", 2);
+        // The checksum is taken with its own field filled with spaces
+        std::memset(header + 148, ' ', 8);
+        unsigned checksum = 0;
+        for (unsigned char c : header) {
+            checksum += c;
+        }
+        std::snprintf(header + 148, 8, "%06o", checksum);
+        tar.write(header, BLOCK);
+        bytes += BLOCK;
+    }
+
+    std::string prefix;
+    uint64_t max_bytes;
+
+    std::mutex mutex;
+    std::ofstream tar;
+    std::ofstream index;
+    uint64_t bytes = 0; // written to the current tar
+    size_t shard = 0;
+    size_t samples = 0;
+};
+
+// A file inside a shard; data points into the mapping and lives as long as the reader
+struct ShardEntry {
+    std::string_view name;
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+};
+
+// Random access to one shard. The .idx is mapped when it's there; a tar
+// without one (written by other tools) is indexed by walking its headers.
+class ShardReader {
+public:
+    explicit ShardReader(const std::string& tar_path) : tar(tar_path) {
+        if (!tar.data) {
+            std::cerr << "Can't open shard : " << tar_path << '\n';
+            return;
+        }
+        std::string index_path = tar_path;
+        if (index_path.size() > 4 && index_path.compare(index_path.size() - 4, 4, ".tar") == 0) {
+            index_path.replace(index_path.size() - 4, 4, ".idx");
+            index = std::make_unique<MappedFile>(index_path);
+        }
+        if (!MapIndex()) {
+            ScanTar();
+        }
+        for (size_t i = 0; i < count; ++i) {
+            by_name.emplace(Name(records[i]), i);
+        }
+    }
+
+    ShardReader(const ShardReader&) = delete;
+
+    bool IsOpen() const { return tar.data != nullptr; }
+
+    size_t Size() const { return count; }
+
+    ShardEntry Entry(size_t i) const {
+        const ShardIndexRecord& record = records[i];
+        return {Name(record), tar.data + record.offset, static_cast<size_t>(record.size)};
+    }
+
+    // Lookup by member name, e.g. "0_sin.jpg"
+    bool Find(std::string_view name, ShardEntry& entry) const {
+        auto found = by_name.find(name);
+        if (found == by_name.end()) {
+            return false;
+        }
+        entry = Entry(found->second);
+        return true;
+    }
+
+    // Streams the entries in file order
+    template <class Function>
+    void ForEach(Function&& function) const {
+        tar.AdviseSequential();
+        for (size_t i = 0; i < count; ++i) {
+            function(Entry(i));
+        }
+    }
+
+private:
+    static std::string_view Name(const ShardIndexRecord& record) {
+        return std::string_view(record.name, strnlen(record.name, sizeof(record.name)));
+    }
+
+    bool MapIndex() {
+        if (!index || index->size < sizeof(ShardIndexHeader)) {
+            return false;
+        }
+        ShardIndexHeader header;
+        std::memcpy(&header, index->data, sizeof(header));
+        if (std::memcmp(header.magic, "SHARDIDX", 8) != 0 || header.record_size != sizeof(ShardIndexRecord)) {
+            return false;
+        }
+        records = reinterpret_cast<const ShardIndexRecord*>(index->data + sizeof(header));
+        count = (index->size - sizeof(header)) / sizeof(ShardIndexRecord);
+        // A shard that is still being written has records for data that isn't flushed yet
+        while (count > 0 && records[count - 1].offset + records[count - 1].size > tar.size) {
+            --count;
+        }
+        return true;
+    }
+
+    void ScanTar() {
+        const size_t block = 512;
+        for (size_t offset = 0; offset + block <= tar.size;) {
+            const char* header = reinterpret_cast<const char*>(tar.data + offset);
+            if (header[0] == '\0') {
+                break; // end-of-archive
+            }
+            uint64_t size = std::strtoull(std::string(header + 124, 12).c_str(), nullptr, 8);
+            const char type = header[156];
+            if ((type == '0' || type == '\0') && offset + block + size <= tar.size) {
+                ShardIndexRecord record = {};
+                record.offset = offset + block;
+                record.size = size;
+                std::memcpy(record.name, header, strnlen(header, 100));
+                owned.push_back(record);
+            }
+            offset += block + (size + block - 1) / block * block;
+        }
+        records = owned.data();
+        count = owned.size();
+    }
+
+    MappedFile tar;
+    std::unique_ptr<MappedFile> index;
+    std::vector<ShardIndexRecord> owned;
+    const ShardIndexRecord* records = nullptr;
+    size_t count = 0;
+    std::unordered_map<std::string_view, size_t> by_name;
+};
+
+// All shards of a prefix as one sequence of entries
+class ShardDataset {
+public:
+    explicit ShardDataset(const std::string& prefix) {
+        for (size_t shard = 0;; ++shard) {
+            std::string path = ShardPath(prefix, shard, ".tar");
+            if (::access(path.c_str(), R_OK) != 0) {
+                break;
+            }
+            shards.push_back(std::make_unique<ShardReader>(path));
+            starts.push_back(total);
+            total += shards.back()->Size();
+        }
+    }
+
+    size_t Size() const { return total; }
+
+    size_t Shards() const { return shards.size(); }
+
+    ShardEntry Entry(size_t i) const {
+        size_t shard = std::upper_bound(starts.begin(), starts.end(), i) - starts.begin() - 1;
+        return shards[shard]->Entry(i - starts[shard]);
+    }
+
+    bool Find(std::string_view name, ShardEntry& entry) const {
+        for (const auto& shard : shards) {
+            if (shard->Find(name, entry)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    template <class Function>
+    void ForEach(Function&& function) const {
+        for (const auto& shard : shards) {
+            shard->ForEach(function);
+        }
+    }
+
+private:
+    std::vector<std::unique_ptr<ShardReader>> shards;
+    std::vector<size_t> starts;
+    size_t total = 0;
+};
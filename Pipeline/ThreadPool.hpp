@@ -0,0 +1,169 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work-stealing thread pool. Every worker owns a deque: it pops its own tasks
+// from the back (LIFO, cache friendly) and steals from the front of the others
+// when it runs dry. Submissions from outside the pool block once `capacity`
+// tasks are pending, so a fast producer can't run ahead of the workers;
+// submissions from inside a worker never block (that could deadlock).
+class ThreadPool {
+public:
+    explicit ThreadPool(size_t threads, size_t capacity = 0) :
+            queues(std::max<size_t>(threads, 1)),
+            capacity(capacity > 0 ? capacity : 4 * std::max<size_t>(threads, 1)) {
+        for (auto& queue : queues) {
+            queue = std::make_unique<Queue>();
+        }
+        for (size_t i = 0; i < queues.size(); ++i) {
+            workers.emplace_back([this, i] { WorkerLoop(i); });
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+
+    ~ThreadPool() {
+        Wait();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        wake.notify_all();
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+
+    void Submit(std::function<void()> task) {
+        size_t target;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            if (CurrentPool() == this) {
+                target = CurrentIndex();
+            } else {
+                space.wait(lock, [this] { return pending < capacity; });
+                target = next++ % queues.size();
+            }
+            ++pending;
+        }
+        {
+            std::lock_guard<std::mutex> lock(queues[target]->mutex);
+            queues[target]->tasks.push_back(std::move(task));
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            ++queued;
+        }
+        wake.notify_one();
+    }
+
+    // Blocks until every submitted task (including ones submitted by tasks) is done
+    void Wait() {
+        std::unique_lock<std::mutex> lock(mutex);
+        idle.wait(lock, [this] { return pending == 0; });
+    }
+
+    size_t Size() const { return workers.size(); }
+
+    // Pending tasks at which outside submissions start to block
+    size_t Capacity() const { return capacity; }
+
+    // Tasks queued or running right now
+    size_t Pending() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return pending;
+    }
+
+    // Index of the calling worker, or Size() when called from outside the pool
+    size_t WorkerIndex() const { return CurrentPool() == this ? CurrentIndex() : Size(); }
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    static ThreadPool*& CurrentPool() {
+        thread_local ThreadPool* pool = nullptr;
+        return pool;
+    }
+
+    static size_t& CurrentIndex() {
+        thread_local size_t index = 0;
+        return index;
+    }
+
+    void Dequeued() {
+        std::lock_guard<std::mutex> lock(mutex);
+        --queued;
+    }
+
+    bool TryPop(size_t self, std::function<void()>& task) {
+        {
+            Queue& own = *queues[self];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.tasks.empty()) {
+                task = std::move(own.tasks.back());
+                own.tasks.pop_back();
+                Dequeued();
+                return true;
+            }
+        }
+        for (size_t i = 1; i < queues.size(); ++i) {
+            Queue& victim = *queues[(self + i) % queues.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.tasks.empty()) {
+                task = std::move(victim.tasks.front());
+                victim.tasks.pop_front();
+                Dequeued();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void WorkerLoop(size_t self) {
+        CurrentPool() = this;
+        CurrentIndex() = self;
+        std::function<void()> task;
+        for (;;) {
+            if (TryPop(self, task)) {
+                task();
+                task = nullptr;
+                std::lock_guard<std::mutex> lock(mutex);
+                --pending;
+                space.notify_one();
+                if (pending == 0) {
+                    idle.notify_all();
+                }
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(mutex);
+            // `queued` is only touched under this mutex, so a push can't slip in unnoticed
+            wake.wait(lock, [this] { return stop || queued > 0; });
+            if (stop && queued == 0) {
+                return;
+            }
+        }
+    }
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> workers;
+    size_t capacity;
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable space;
+    std::condition_variable idle;
+    size_t pending = 0; // submitted and not finished yet
+    size_t queued = 0;  // sitting in some deque
+    size_t next = 0;
+    bool stop = false;
+};
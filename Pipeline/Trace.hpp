@@ -0,0 +1,387 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+
+#ifdef PIPELINE_TRACE
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <shared_mutex>
+#include <thread>
+#include <vector>
+#endif
+
+// Instrumentation of the generation pipeline.
+//
+// Log levels are always there and checked at run time: PIPELINE_LOG(level,
+// a << b) formats and prints a whole line to stderr only when the level is
+// enabled, so verbose output costs one comparison when it's off.
+//
+// Tracing is compiled in with PIPELINE_TRACE (the PIPELINE_TRACE CMake
+// option); without it every TRACE_* macro expands to nothing. With it:
+//   TRACE_SCOPE("render")            times the enclosing scope as a stage
+//   TRACE_SCOPE_DYNAMIC(name)        same with a run-time name (one lookup per call)
+//   TRACE_COUNT("bytes", n)          adds to a counter (samples, bytes, ...)
+//   TRACE_GAUGE("writer queue", n)   records the current value of a gauge
+// Stages keep count, total and maximum time; TraceStart can also keep every
+// scope and gauge change as an event and write them as Chrome trace JSON
+// (chrome://tracing, ui.perfetto.dev), and print a summary line periodically.
+
+enum class LogLevel { Error, Warning, Info, Debug };
+
+inline std::atomic<int>& LogThreshold() {
+    static std::atomic<int> threshold{static_cast<int>(LogLevel::Info)};
+    return threshold;
+}
+
+inline void SetLogLevel(LogLevel level) { LogThreshold() = static_cast<int>(level); }
+
+inline bool LogEnabled(LogLevel level) { return static_cast<int>(level) <= LogThreshold().load(std::memory_order_relaxed); }
+
+// "error", "warning", "info" or "debug"
+inline bool ParseLogLevel(const std::string& text, LogLevel& level) {
+    static const char* const names[] = {"error", "warning", "info", "debug"};
+    for (int i = 0; i < 4; ++i) {
+        if (text == names[i]) {
+            level = static_cast<LogLevel>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+inline void LogWrite(const std::string& line) {
+    static std::mutex mutex;
+    std::lock_guard<std::mutex> lock(mutex);
+    std::cerr << line << '\n';
+}
+
+#define PIPELINE_LOG(level, message)              \
+    do {                                          \
+        if (LogEnabled(level)) {                  \
+            std::ostringstream pipeline_log_line; \
+            pipeline_log_line << message;         \
+            LogWrite(pipeline_log_line.str());    \
+        }                                         \
+    } while (0)
+
+#ifdef PIPELINE_TRACE
+
+struct TraceStage {
+    std::string name;
+    std::atomic<uint64_t> count{0};
+    std::atomic<uint64_t> total_ns{0};
+    std::atomic<uint64_t> max_ns{0};
+};
+
+struct TraceCounter {
+    std::string name;
+    bool gauge = false;
+    std::atomic<int64_t> value{0}; // total for counters, last value for gauges
+    std::atomic<int64_t> max{0};
+    int64_t reported = 0;          // value at the previous summary line
+};
+
+class Tracer {
+public:
+    static Tracer& Get() {
+        static Tracer tracer;
+        return tracer;
+    }
+
+    Tracer(const Tracer&) = delete;
+
+    ~Tracer() {
+        Stop();
+    }
+
+    // Stages and counters live as long as the process; the pointers can be cached
+    TraceStage* GetStage(const std::string& name) {
+        return Find(stages, name, [&] {
+            auto stage = std::make_unique<TraceStage>();
+            stage->name = name;
+            return stage;
+        });
+    }
+
+    TraceCounter* GetCounter(const std::string& name, bool gauge) {
+        return Find(counters, name, [&] {
+            auto counter = std::make_unique<TraceCounter>();
+            counter->name = name;
+            counter->gauge = gauge;
+            return counter;
+        });
+    }
+
+    uint64_t Now() const {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - origin).count();
+    }
+
+    void Record(TraceStage* stage, uint64_t start_ns, uint64_t duration_ns) {
+        ++stage->count;
+        stage->total_ns += duration_ns;
+        StoreMax(stage->max_ns, duration_ns);
+        if (events_enabled.load(std::memory_order_relaxed)) {
+            Push({stage->name.c_str(), start_ns, static_cast<int64_t>(duration_ns), false});
+        }
+    }
+
+    void Add(TraceCounter* counter, int64_t value) {
+        counter->value += value;
+    }
+
+    void Set(TraceCounter* counter, int64_t value) {
+        counter->value = value;
+        StoreMax(counter->max, value);
+        if (events_enabled.load(std::memory_order_relaxed)) {
+            Push({counter->name.c_str(), Now(), value, true});
+        }
+    }
+
+    // trace_path: where Stop writes the Chrome trace, empty - no events are
+    // kept. summary_seconds > 0 prints a summary line to `out` that often.
+    void Start(const std::string& trace_path, double summary_seconds, std::ostream& out) {
+        Stop();
+        std::lock_guard<std::mutex> lock(control);
+        path = trace_path;
+        events_enabled = !path.empty();
+        if (summary_seconds > 0) {
+            stopping = false;
+            summary = std::thread([this, summary_seconds, &out] {
+                std::unique_lock<std::mutex> wait_lock(control);
+                const auto period = std::chrono::duration<double>(summary_seconds);
+                while (!summary_wake.wait_for(wait_lock, period, [this] { return stopping; })) {
+                    Summary(out);
+                }
+            });
+        }
+    }
+
+    // Stops the summary thread and writes the trace, if one was requested
+    void Stop() {
+        {
+            std::lock_guard<std::mutex> lock(control);
+            stopping = true;
+        }
+        summary_wake.notify_all();
+        if (summary.joinable()) {
+            summary.join();
+        }
+        std::lock_guard<std::mutex> lock(control);
+        if (!path.empty()) {
+            events_enabled = false;
+            WriteTrace(path);
+            path.clear();
+        }
+    }
+
+    // One line: rates of the counters since the previous line, then every stage
+    void Summary(std::ostream& out) {
+        const double now = Now() / 1e9;
+        const double interval = std::max(now - last_summary, 1e-9);
+        last_summary = now;
+        std::ostringstream line;
+        line << std::fixed << std::setprecision(2) << '[' << now << " s]";
+        std::shared_lock<std::shared_mutex> lock(registry);
+        for (const auto& [name, counter] : counters) {
+            const int64_t value = counter->value.load();
+            if (counter->gauge) {
+                line << ' ' << name << ' ' << value << " (max " << counter->max.load() << ')';
+            } else {
+                line << ' ' << name << ' ' << value << " (" << (value - counter->reported) / interval << "/s)";
+                counter->reported = value;
+            }
+        }
+        for (const auto& [name, stage] : stages) {
+            const uint64_t count = stage->count.load();
+            if (count > 0) {
+                line << " | " << name << ' ' << stage->total_ns.load() / 1e6 / count << " ms x " << count
+                     << " (max " << stage->max_ns.load() / 1e6 << ')';
+            }
+        }
+        out << line.str() << '\n' << std::flush;
+    }
+
+private:
+    struct Event {
+        const char* name;
+        uint64_t start_ns;
+        int64_t value; // duration of a scope, value of a gauge
+        bool gauge;
+    };
+
+    struct ThreadEvents {
+        uint64_t thread = 0;
+        std::vector<Event> events;
+        size_t dropped = 0;
+    };
+
+    // Events of one thread never take more than this
+    static constexpr size_t MAX_THREAD_EVENTS = size_t(1) << 20;
+
+    Tracer() : origin(std::chrono::steady_clock::now()) {}
+
+    template <class Map, class Make>
+    auto Find(Map& map, const std::string& name, Make&& make) -> decltype(map.begin()->second.get()) {
+        {
+            std::shared_lock<std::shared_mutex> lock(registry);
+            auto found = map.find(name);
+            if (found != map.end()) {
+                return found->second.get();
+            }
+        }
+        std::unique_lock<std::shared_mutex> lock(registry);
+        auto& entry = map[name];
+        if (!entry) {
+            entry = make();
+        }
+        return entry.get();
+    }
+
+    template <class T>
+    static void StoreMax(std::atomic<T>& max, T value) {
+        T seen = max.load();
+        while (value > seen && !max.compare_exchange_weak(seen, value)) {
+        }
+    }
+
+    void Push(const Event& event) {
+        thread_local std::shared_ptr<ThreadEvents> local;
+        if (!local) {
+            local = std::make_shared<ThreadEvents>();
+            std::lock_guard<std::mutex> lock(buffers_mutex);
+            local->thread = buffers.size() + 1;
+            buffers.push_back(local);
+        }
+        if (local->events.size() >= MAX_THREAD_EVENTS) {
+            ++local->dropped;
+            return;
+        }
+        local->events.push_back(event);
+    }
+
+    // Called from Stop once the pipeline has drained and recording is off
+    void WriteTrace(const std::string& trace_path) {
+        std::ofstream out(trace_path, std::ios::trunc);
+        if (!out) {
+            std::cerr << "Can't write trace : " << trace_path << '\n';
+            return;
+        }
+        out << "{\"traceEvents\": [\n";
+        bool first = true;
+        size_t dropped = 0;
+        std::lock_guard<std::mutex> lock(buffers_mutex);
+        for (const auto& buffer : buffers) {
+            for (const Event& event : buffer->events) {
+                out << (first ? "" : ",\n") << "{\"name\": \"" << event.name << "\", \"pid\": 1, \"tid\": "
+                    << buffer->thread << ", \"ts\": " << event.start_ns / 1000.0;
+                if (event.gauge) {
+                    out << ", \"ph\": \"C\", \"args\": {\"value\": " << event.value << "}}";
+                } else {
+                    out << ", \"ph\": \"X\", \"dur\": " << event.value / 1000.0 << "}";
+                }
+                first = false;
+            }
+            dropped += buffer->dropped;
+            buffer->events.clear();
+            buffer->dropped = 0;
+        }
+        out << "\n], \"displayTimeUnit\": \"ms\"}\n";
+        if (dropped > 0) {
+            std::cerr << "Trace buffers were full, " << dropped << " events dropped\n";
+        }
+    }
+
+    const std::chrono::steady_clock::time_point origin;
+
+    std::shared_mutex registry;
+    std::map<std::string, std::unique_ptr<TraceStage>> stages; // ordered, for stable summary lines
+    std::map<std::string, std::unique_ptr<TraceCounter>> counters;
+
+    std::atomic<bool> events_enabled{false};
+    std::mutex buffers_mutex;
+    std::deque<std::shared_ptr<ThreadEvents>> buffers;
+
+    std::mutex control;
+    std::condition_variable summary_wake;
+    std::thread summary;
+    bool stopping = false;
+    double last_summary = 0;
+    std::string path;
+};
+
+class TraceScope {
+public:
+    explicit TraceScope(TraceStage* stage) : stage(stage), start(Tracer::Get().Now()) {}
+
+    TraceScope(const TraceScope&) = delete;
+
+    ~TraceScope() {
+        Tracer::Get().Record(stage, start, Tracer::Get().Now() - start);
+    }
+
+private:
+    TraceStage* stage;
+    uint64_t start;
+};
+
+inline void TraceStart(const std::string& trace_path, double summary_seconds, std::ostream& out) {
+    Tracer::Get().Start(trace_path, summary_seconds, out);
+}
+
+inline void TraceStop(std::ostream& out) {
+    Tracer::Get().Stop();
+    Tracer::Get().Summary(out);
+}
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+#define TRACE_SCOPE(name)                                                                              \
+    static TraceStage* const TRACE_CONCAT(trace_stage_, __LINE__) = Tracer::Get().GetStage(name); \
+    TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(TRACE_CONCAT(trace_stage_, __LINE__))
+#define TRACE_SCOPE_DYNAMIC(name) TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(Tracer::Get().GetStage(name))
+#define TRACE_COUNT(name, value)                                                                \
+    do {                                                                                        \
+        static TraceCounter* const trace_counter = Tracer::Get().GetCounter(name, false); \
+        Tracer::Get().Add(trace_counter, static_cast<int64_t>(value));                          \
+    } while (0)
+#define TRACE_GAUGE(name, value)                                                               \
+    do {                                                                                       \
+        static TraceCounter* const trace_counter = Tracer::Get().GetCounter(name, true); \
+        Tracer::Get().Set(trace_counter, static_cast<int64_t>(value));                         \
+    } while (0)
+
+#else
+
+inline void TraceStart(const std::string& trace_path, double summary_seconds, std::ostream&) {
+    if (!trace_path.empty() || summary_seconds > 0) {
+        PIPELINE_LOG(LogLevel::Warning, "Built without PIPELINE_TRACE, no trace or stats are recorded");
+    }
+}
+
+inline void TraceStop(std::ostream&) {}
+
+#define TRACE_SCOPE(name) \
+    do {                  \
+    } while (0)
+#define TRACE_SCOPE_DYNAMIC(name) \
+    do {                          \
+    } while (0)
+#define TRACE_COUNT(name, value) \
+    do {                         \
+    } while (0)
+#define TRACE_GAUGE(name, value) \
+    do {                         \
+    } while (0)
+
+#endif
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "SoftRenderer.hpp"
+
+// Z-буфер кадра: строки снизу вверх с шагом stride, глубина в [0, 1] как в OpenGL
+struct DepthView {
+    const float* data = nullptr;
+    int width = 0;
+    int height = 0;
+    int stride = 0;
+};
+
+// Пакетная проекция точек меша в картинку. Матрица модель-вид-проекция (вместе с
+// трансформацией актора) собирается один раз на кадр, точки идут плоским массивом
+// xyz и проецируются по четыре за раз; на выходе — плоские массивы xy (y сверху
+// вниз, как в аннотациях) и глубины. Так аннотировать можно не только 4 угла, а
+// тысячи ключевых точек на кадр.
+class Projector {
+public:
+    // mvp переводит координаты модели в clip-координаты OpenGL
+    Projector(const SoftMatrix& mvp, int width, int height) : width(width), height(height) {
+        for (int i = 0; i < 16; ++i) {
+            m[i] = static_cast<float>(mvp[i]);
+        }
+    }
+
+    // Точки за камерой получают NaN в xy и depth
+    void Project(const float* xyz, size_t count, float* xy, float* depth) const {
+        const float nan = std::numeric_limits<float>::quiet_NaN();
+        size_t i = 0;
+#if defined(__SSE2__)
+        const __m128 halfWidth = _mm_set1_ps(0.5f * width);
+        const __m128 halfHeight = _mm_set1_ps(0.5f * height);
+        const __m128 one = _mm_set1_ps(1.0f);
+        const __m128 half = _mm_set1_ps(0.5f);
+        const __m128 h = _mm_set1_ps(static_cast<float>(height));
+        const __m128 nans = _mm_set1_ps(nan);
+        for (; i + 4 <= count; i += 4) {
+            const float* p = xyz + i * 3;
+            const __m128 x = _mm_setr_ps(p[0], p[3], p[6], p[9]);
+            const __m128 y = _mm_setr_ps(p[1], p[4], p[7], p[10]);
+            const __m128 z = _mm_setr_ps(p[2], p[5], p[8], p[11]);
+            const __m128 cx = row(0, x, y, z);
+            const __m128 cy = row(1, x, y, z);
+            const __m128 cz = row(2, x, y, z);
+            const __m128 cw = row(3, x, y, z);
+            const __m128 front = _mm_cmpgt_ps(cw, _mm_setzero_ps());
+            const __m128 inv = _mm_div_ps(one, cw);
+            __m128 dx = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(cx, inv), one), halfWidth);
+            __m128 dy = _mm_sub_ps(h, _mm_mul_ps(_mm_add_ps(_mm_mul_ps(cy, inv), one), halfHeight));
+            __m128 dz = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(cz, inv), one), half);
+            dx = _mm_or_ps(_mm_and_ps(front, dx), _mm_andnot_ps(front, nans));
+            dy = _mm_or_ps(_mm_and_ps(front, dy), _mm_andnot_ps(front, nans));
+            dz = _mm_or_ps(_mm_and_ps(front, dz), _mm_andnot_ps(front, nans));
+            _mm_storeu_ps(xy + i * 2, _mm_unpacklo_ps(dx, dy));
+            _mm_storeu_ps(xy + i * 2 + 4, _mm_unpackhi_ps(dx, dy));
+            _mm_storeu_ps(depth + i, dz);
+        }
+#endif
+        for (; i < count; ++i) {
+            const float* p = xyz + i * 3;
+            const float cx = m[0] * p[0] + m[1] * p[1] + m[2] * p[2] + m[3];
+            const float cy = m[4] * p[0] + m[5] * p[1] + m[6] * p[2] + m[7];
+            const float cz = m[8] * p[0] + m[9] * p[1] + m[10] * p[2] + m[11];
+            const float cw = m[12] * p[0] + m[13] * p[1] + m[14] * p[2] + m[15];
+            if (!(cw > 0)) {
+                xy[i * 2] = xy[i * 2 + 1] = depth[i] = nan;
+                continue;
+            }
+            const float inv = 1.0f / cw;
+            xy[i * 2] = (cx * inv + 1) * 0.5f * width;
+            xy[i * 2 + 1] = height - (cy * inv + 1) * 0.5f * height;
+            depth[i] = (cz * inv + 1) * 0.5f;
+        }
+    }
+
+    // Видимость: точка в кадре, перед камерой и, если дан z-буфер, не закрыта
+    // другой частью меша. Точка сравнивается с четырьмя ближайшими пикселями:
+    // на самой поверхности хотя бы один из них не ближе точки, а за складкой все
+    // четыре ближе больше чем на bias.
+    void Visibility(const float* xy, const float* depth, size_t count, const DepthView* zbuffer, float bias,
+                    uint8_t* visible) const {
+        for (size_t i = 0; i < count; ++i) {
+            const float x = xy[i * 2];
+            const float y = xy[i * 2 + 1];
+            // NaN не проходит ни одно из сравнений
+            if (!(x >= 0 && x < width && y >= 0 && y < height)) {
+                visible[i] = 0;
+                continue;
+            }
+            if (!zbuffer || !zbuffer->data) {
+                visible[i] = 1;
+                continue;
+            }
+            const float bottomUp = height - y;
+            const int x0 = std::clamp(static_cast<int>(std::floor(x - 0.5f)), 0, zbuffer->width - 1);
+            const int y0 = std::clamp(static_cast<int>(std::floor(bottomUp - 0.5f)), 0, zbuffer->height - 1);
+            const int x1 = std::min(x0 + 1, zbuffer->width - 1);
+            const int y1 = std::min(y0 + 1, zbuffer->height - 1);
+            const float* row0 = zbuffer->data + static_cast<size_t>(y0) * zbuffer->stride;
+            const float* row1 = zbuffer->data + static_cast<size_t>(y1) * zbuffer->stride;
+            const float farthest = std::max({row0[x0], row0[x1], row1[x0], row1[x1]});
+            visible[i] = depth[i] <= farthest + bias ? 1 : 0;
+        }
+    }
+
+private:
+#if defined(__SSE2__)
+    __m128 row(int r, __m128 x, __m128 y, __m128 z) const {
+        __m128 sum = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(m[r * 4]), x), _mm_mul_ps(_mm_set1_ps(m[r * 4 + 1]), y));
+        sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(m[r * 4 + 2]), z));
+        return _mm_add_ps(sum, _mm_set1_ps(m[r * 4 + 3]));
+    }
+#endif
+
+    float m[16];
+    int width;
+    int height;
+};
@@ -0,0 +1,156 @@
+#include <benchmark/benchmark.h>
+
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Distortions.hpp"
+#include "NoizeConfig.hpp"
+#include "Optics.hpp"
+
+// Throughput of the distortion kernels: every layer kind alone and every stack
+// of a noize config, at several image sizes. Each iteration distorts a fresh
+// copy of a synthetic barcode (imgen clones its source per operation the same
+// way), and reports pixels/s and samples/s. Layer coordinates in noize.config
+// are tuned for 227 px images, so the stacks are also run at that size.
+//
+//   ./build/bench [--noize-config path] [--benchmark_out=bench.json --benchmark_out_format=json]
+
+static const std::vector<int64_t> SIZES = {227, 512, 1024, 2048};
+
+// Black and white modules with a quiet zone, close enough to a symbol for the kernels
+static Mat MakeSource(int size) {
+    Mat image(size, size, CV_8UC1, Scalar(255));
+    const int module = std::max(1, size / 29);
+    for (int y = 4 * module; y + module <= size - 4 * module; y += module) {
+        for (int x = 4 * module; x + module <= size - 4 * module; x += module) {
+            if (MixSeed((static_cast<uint64_t>(y) << 32) | static_cast<uint32_t>(x)) & 1) {
+                image(Rect(x, y, module, module)).setTo(Scalar(0));
+            }
+        }
+    }
+    return image;
+}
+
+static void SetCounters(benchmark::State& state, const Mat& image) {
+    const double samples = static_cast<double>(state.iterations());
+    state.counters["pixels/s"] = benchmark::Counter(samples * image.total(), benchmark::Counter::kIsRate);
+    state.counters["samples/s"] = benchmark::Counter(samples, benchmark::Counter::kIsRate);
+}
+
+static void RunModifier(benchmark::State& state, Modifier& modifier) {
+    const Mat source = MakeSource(static_cast<int>(state.range(0)));
+    Mat image;
+    modifier.SetSeed(1, 0);
+    uint64_t sample = 0;
+    for (auto _ : state) {
+        source.copyTo(image);
+        modifier.ModifyImage(image, sample++);
+        benchmark::DoNotOptimize(image.data);
+    }
+    SetCounters(state, image);
+}
+
+// Parameters follow noize.config, with limits and shapes scaled to the image
+static void BM_LinesPrinter(benchmark::State& state) {
+    const int size = static_cast<int>(state.range(0));
+    LinesPrinter printer(10, 0, size / 2, size / 4, 10, false, 0.8f, 1, size / 100 + 2, true);
+    RunModifier(state, printer);
+}
+
+static void BM_LinesPrinterMemory(benchmark::State& state) {
+    const int size = static_cast<int>(state.range(0));
+    LinesPrinter printer(0, 25, 0, 0, 60, true, 1, size * 13 / 227, size * 14 / 227, false, true);
+    RunModifier(state, printer);
+}
+
+static void BM_BlobPrinter(benchmark::State& state) {
+    const int size = static_cast<int>(state.range(0));
+    BlobPrinter printer(0, 0, 0, 0, 100, false, 1, size / 2, size * 133 / 227, size * 40 / 227, size * 40 / 227);
+    RunModifier(state, printer);
+}
+
+static void BM_SinPrinter(benchmark::State& state) {
+    const int size = static_cast<int>(state.range(0));
+    SinPrinter printer(0, 0, 0, 0, 80, true, 0.9f, size / 3, 0, size / 10, size / 20.0f, true);
+    RunModifier(state, printer);
+}
+
+static void BM_BlurPrinter(benchmark::State& state) {
+    BlurPrinter printer(0.015f);
+    RunModifier(state, printer);
+}
+
+static void BM_GaussBlur(benchmark::State& state) {
+    GaussBlur blur(0.01f);
+    RunModifier(state, blur);
+}
+
+static void BM_MotionBlur(benchmark::State& state) {
+    MotionBlur blur(0.03f, 30);
+    RunModifier(state, blur);
+}
+
+static void BM_DefocusBlur(benchmark::State& state) {
+    DefocusBlur blur(0.01f);
+    RunModifier(state, blur);
+}
+
+// Defocus should cost the same per pixel at any radius: radius in thousandths of
+// the side, fixed image
+static void BM_DefocusBlurRadius(benchmark::State& state) {
+    DefocusBlur blur(static_cast<float>(state.range(1)) / 1000);
+    RunModifier(state, blur);
+}
+
+static void BM_SensorNoise(benchmark::State& state) {
+    SensorNoise noise(4, 0.5f);
+    RunModifier(state, noise);
+}
+
+BENCHMARK(BM_LinesPrinter)->ArgsProduct({SIZES});
+BENCHMARK(BM_LinesPrinterMemory)->ArgsProduct({SIZES});
+BENCHMARK(BM_BlobPrinter)->ArgsProduct({SIZES});
+BENCHMARK(BM_SinPrinter)->ArgsProduct({SIZES});
+BENCHMARK(BM_BlurPrinter)->ArgsProduct({SIZES});
+BENCHMARK(BM_GaussBlur)->ArgsProduct({SIZES});
+BENCHMARK(BM_MotionBlur)->ArgsProduct({SIZES});
+BENCHMARK(BM_DefocusBlur)->ArgsProduct({SIZES});
+BENCHMARK(BM_DefocusBlurRadius)->ArgsProduct({{1024}, {5, 10, 20, 40}});
+BENCHMARK(BM_SensorNoise)->ArgsProduct({SIZES});
+
+// PrinterStack::ProcessImage over every stack of the config, registered at run time
+static void BM_Stack(benchmark::State& state, std::shared_ptr<PrinterStack> stack) {
+    const Mat source = MakeSource(static_cast<int>(state.range(0)));
+    Mat image;
+    uint64_t sample = 0;
+    for (auto _ : state) {
+        source.copyTo(image);
+        stack->ProcessImage(image, sample++);
+        benchmark::DoNotOptimize(image.data);
+    }
+    SetCounters(state, image);
+}
+
+int main(int argc, char** argv) {
+    benchmark::Initialize(&argc, argv);
+    std::string noize_config = IMGEN_SOURCE_DIR "/noize.config";
+    for (int i = 1; i < argc; ++i) {
+        if (std::string(argv[i]) == "--noize-config" && i + 1 < argc) {
+            noize_config = argv[++i];
+        } else {
+            std::cerr << "Unknown argument : " << argv[i] << '\n';
+            return 1;
+        }
+    }
+    for (const auto& named : ParseNoizeConfig(noize_config)) {
+        benchmark::RegisterBenchmark(("BM_Stack/" + named.name).c_str(), BM_Stack, named.stack)
+                ->ArgsProduct({SIZES});
+    }
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
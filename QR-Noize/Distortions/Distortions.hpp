@@ -5,23 +5,98 @@
 #include <opencv2/opencv.hpp>
 #include <cstdlib>
 #include <cmath>
-#include <map>
+#include <cstring>
 #include <vector>
 #include <memory>
+#include <mutex>
+#include <cstdint>
+#include <algorithm>
+
+#include "Seeds.hpp"
+#include "Trace.hpp"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 using namespace cv;
 
 const int MAX_INTENSIVITY = 255;
 const int MIN_INTENSIVITY = 0;
 
+// Tallest period tile a printer keeps; see PrinterKernel::ModifyWindow
+const int MAX_TILE_ROWS = 4096;
+
+// Counter-based generator (Widynski's "Squares"): a draw is a pure function of
+// (key, counter), so the noise of any pixel can be recomputed on its own, on any
+// thread and in any order, and one sample can be regenerated without the rest.
+inline uint32_t Squares32(uint64_t counter, uint64_t key) {
+    uint64_t x = counter * key;
+    uint64_t y = x;
+    uint64_t z = y + key;
+    x = x * x + y;
+    x = (x >> 32) | (x << 32);
+    x = x * x + z;
+    x = (x >> 32) | (x << 32);
+    x = x * x + y;
+    x = (x >> 32) | (x << 32);
+    return static_cast<uint32_t>((x * x + z) >> 32);
+}
+
+// Random draw of one pixel of one layer on one image
+struct PixelNoise {
+    uint64_t key;
+    int x;
+    int y;
+
+    // Uniform in [0, 100): multiply-shift of a 32-bit draw instead of a biased % 100
+    int Percent() const {
+        uint64_t counter = (static_cast<uint64_t>(static_cast<uint32_t>(x)) << 32) | static_cast<uint32_t>(y);
+        return static_cast<int>((static_cast<uint64_t>(Squares32(counter, key)) * 100) >> 32);
+    }
+};
+
 class Modifier {
 public:
-    virtual void ModifyImage(Mat& image) = 0;
+    virtual ~Modifier() = default;
+
+    // Must be safe to call concurrently on different images. `sample` identifies
+    // the image, so the same (seed, sample) always produces the same distortion.
+    void ModifyImage(Mat& image, uint64_t sample) {
+        ModifyWindow(image, 0, image.size(), sample);
+    }
+
+    // ModifyImage on a part of an image of `size`: `window` holds its rows
+    // [first_row, first_row + window.rows), all columns. Positions, noise and
+    // relative sizes follow the whole image, so every row comes out as it would
+    // in ModifyImage, except the HaloRows rows next to a cut (a window edge that
+    // isn't an image edge), which miss the neighbours beyond it.
+    virtual void ModifyWindow(Mat& window, int first_row, Size size, uint64_t sample) = 0;
+
+    // How many rows above and below a pixel its result depends on. A layer that
+    // doesn't know claims the whole image.
+    virtual int HaloRows(Size size) const {
+        return IsPointwise() ? 0 : size.height;
+    }
+
+    // A pointwise layer changes each pixel only from that pixel and its position,
+    // so the stack may run it strip by strip, interleaved with other such layers
+    virtual bool IsPointwise() const { return false; }
+
+    // Called by the stack; `layer` is the position in it, so layers don't share noise
+    virtual void SetSeed(uint64_t seed, uint64_t layer) {}
+
+    // Keyword of the layer in noize.config, names its stage in traces
+    virtual const char* Name() const { return "Layer"; }
 };
 
 class Printer : public Modifier {
 public:
-    Printer() : radius_x(0), radius_y(0) {}
+    Printer() : radius_x(0), radius_y(0) {
+        SetSeed(0, 0);
+    }
 
     Printer(int radius_x, int radius_y, int x_lim_, int y_lim_, int density, bool black, float intensivity, bool use_memory) :
             radius_x(radius_x), radius_y(radius_y), x_lim(x_lim_), y_lim(y_lim_),
@@ -36,55 +111,34 @@ public:
             y_lim = std::numeric_limits<int>::max();
         }
         if (radius_x == 0 && radius_y == 0) {
-            use_memory = false;
+            this->use_memory = false;
         }
+        SetSeed(0, 0);
     }
 
-    void ModifyImage(Mat& image) {
-        int rows = 0, cols = 0;
-        rows = image.rows;
-        cols = image.cols;
-        for (int x = 0; x < rows; ++x) {
-            uchar* p = image.ptr<uchar>(x);
-            for (int y = 0; y < cols; ++y) {
-                if (x <= x_lim && y <= y_lim) {
-                    p[y] = normalize(p[y], getDistortion(x, y));
-                }
-            }
-        }
+    void SetSeed(uint64_t seed, uint64_t layer) override {
+        std::lock_guard<std::mutex> lock(tile_mutex);
+        key = CombineSeed(seed, layer) | 1;
+        tile.reset();
     }
 
 protected:
 
-    int getDistortion(int x, int y) {
-        if (radius_x >= 1) {
-            x = x % radius_x;
-        }
-        if (radius_y >= 1) {
-            y = y % radius_y;
-        }
-        return changePixelFromMemory(x, y);
+    // Rows and columns the printer may touch: the original x <= x_lim && y <= y_lim test
+    int RowLimit(int rows) const {
+        return x_lim >= rows ? rows : x_lim + 1;
     }
 
-    int changePixelFromMemory(int x, int y) {
-        if (!use_memory) {
-            return changePixel(x, y);
-        }
-        if (memory.find({x, y}) == memory.end()) {
-            memory[{x, y}] = changePixel(x, y);
-        }
-        return memory.at({x, y});
+    int ColLimit(int cols) const {
+        return y_lim >= cols ? cols : y_lim + 1;
     }
 
-    uchar normalize(uchar pixel, int distortion) {
-        if (distortion > 0) {
-            return static_cast<uchar>(std::min(static_cast<int>(pixel) + distortion, MAX_INTENSIVITY));
-        }
-        return static_cast<uchar>(std::max(static_cast<int>(pixel) + distortion, MIN_INTENSIVITY));
+    // A printer only ever produces 0 or new_intensivity, so a row of distortions
+    // is a row of 0 / magnitude bytes applied with one saturating add or subtract
+    uchar DistortionMagnitude() const {
+        return static_cast<uchar>(std::min(std::abs(new_intensivity), MAX_INTENSIVITY));
     }
 
-    virtual int changePixel(int x, int y) = 0; // x - vertical, y - horizontal
-
     int radius_x;
     int radius_y;
 
@@ -98,10 +152,206 @@ protected:
     int new_intensivity;
 
     bool use_memory;
-    std::map<std::pair<int, int>, int> memory;
+
+    // Squares key of this layer (odd, as the generator wants)
+    uint64_t key;
+
+    // With use_memory the pattern repeats every radius_x rows and radius_y
+    // columns, so one period is materialized as 0 / magnitude bytes and then
+    // reused by every image of the stack. `period` holds the tile itself (along
+    // an axis with radius 0 it grows to the largest image seen so far), `rows`
+    // holds the same tile repeated out to `width` columns, ready for SIMD.
+    struct PeriodTile {
+        Mat period;
+        Mat rows;
+    };
+    std::shared_ptr<const PeriodTile> tile;
+    std::mutex tile_mutex;
+};
+
+// pixels[i] = saturate(pixels[i] +/- distortion[i]), 32 or 16 lanes at a time.
+// Same result as clamping pixel + distortion to [MIN_INTENSIVITY, MAX_INTENSIVITY].
+inline void ApplyDistortionRow(uchar* pixels, const uchar* distortion, int count, bool darken) {
+    int i = 0;
+#if defined(__AVX2__)
+    for (; i + 32 <= count; i += 32) {
+        __m256i p = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pixels + i));
+        __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(distortion + i));
+        p = darken ? _mm256_subs_epu8(p, d) : _mm256_adds_epu8(p, d);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(pixels + i), p);
+    }
+#endif
+#if defined(__SSE2__)
+    for (; i + 16 <= count; i += 16) {
+        __m128i p = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pixels + i));
+        __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(distortion + i));
+        p = darken ? _mm_subs_epu8(p, d) : _mm_adds_epu8(p, d);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(pixels + i), p);
+    }
+#endif
+    for (; i < count; ++i) {
+        int value = darken ? pixels[i] - distortion[i] : pixels[i] + distortion[i];
+        pixels[i] = static_cast<uchar>(std::clamp(value, MIN_INTENSIVITY, MAX_INTENSIVITY));
+    }
+}
+
+// Row-batched printer loop, specialized at compile time for every printer type.
+// Shapes are rasterized analytically: Derived::Spans reports, for a row of the
+// period, the column ranges the shape covers, and random draws and writes are
+// only spent inside them, so the cost follows the covered area, not the image.
+// Only the x_lim/y_lim region is visited, and the distortions of a row are
+// applied at once with SIMD saturating math.
+template <class Derived>
+class PrinterKernel : public Printer {
+public:
+    using Printer::Printer;
+
+    bool IsPointwise() const override { return true; }
+
+    void ModifyWindow(Mat& window, int first_row, Size size, uint64_t sample) override {
+        const int rows = RowLimit(size.height);
+        const int cols = ColLimit(size.width);
+        const int last_row = std::min(first_row + window.rows, rows);
+        if (first_row >= last_row || cols <= 0) {
+            return;
+        }
+        const bool darken = new_intensivity < 0;
+        auto image_row = [&](int x) { return window.ptr<uchar>(x - first_row); };
+        if (use_memory && radius_x < 1 && rows > MAX_TILE_ROWS) {
+            // Repeating only across columns, the tile would be as big as the image:
+            // the period row of every image row is built as the tile would build it
+            decltype(auto) shape = static_cast<Derived&>(*this).RowShape(radius_y);
+            thread_local std::vector<uchar> distortion;
+            distortion.resize(std::max(cols, radius_y));
+            for (int x = first_row; x < last_row; ++x) {
+                std::memset(distortion.data(), 0, radius_y);
+                int lo, hi;
+                FillRow(shape, x, radius_y, key, distortion.data(), lo, hi);
+                int filled = radius_y;
+                while (filled < cols) {
+                    int count = std::min(filled, cols - filled);
+                    std::memcpy(distortion.data() + filled, distortion.data(), count);
+                    filled += count;
+                }
+                ApplyDistortionRow(image_row(x), distortion.data(), cols, darken);
+            }
+            return;
+        }
+        if (use_memory) {
+            // The tile is immutable once published, so only fetching it takes the lock
+            std::shared_ptr<const PeriodTile> current = Tile(rows, cols);
+            for (int x = first_row; x < last_row; ++x) {
+                const int px = radius_x >= 1 ? x % radius_x : x;
+                ApplyDistortionRow(image_row(x), current->rows.ptr<uchar>(px), cols, darken);
+            }
+            return;
+        }
+        // Without memory every image gets its own noise, and every pixel (not just
+        // every period cell) its own draw
+        const uint64_t image_key = CombineSeed(key, sample) | 1;
+        decltype(auto) shape = static_cast<Derived&>(*this).RowShape(radius_y >= 1 ? radius_y : cols);
+        thread_local std::vector<uchar> distortion;
+        distortion.resize(cols);
+        for (int x = first_row; x < last_row; ++x) {
+            int lo, hi;
+            if (FillRow(shape, x, cols, image_key, distortion.data(), lo, hi)) {
+                ApplyDistortionRow(image_row(x) + lo, distortion.data() + lo, hi - lo, darken);
+            }
+        }
+    }
+
+protected:
+    // Shape used for a batch of rows. By default the printer itself; a printer
+    // that wants per-column tables (Sin) returns an object holding them.
+    const Derived& RowShape(int period_cols) {
+        return static_cast<const Derived&>(*this);
+    }
+
+    // A pixel inside the shape is hit when its percent draw is below this
+    int PercentLimit() const {
+        return density;
+    }
+
+    // Distortion of image row x: the spans of period row px, repeated every radius_y
+    // columns, get `magnitude` with probability density. Only out[lo, hi) is
+    // written; returns false if the row has nothing to apply.
+    template <class Shape>
+    bool FillRow(const Shape& shape, int x, int cols, uint64_t noise_key, uchar* out, int& lo, int& hi) {
+        const int px = radius_x >= 1 ? x % radius_x : x;
+        const int period = radius_y >= 1 ? radius_y : cols;
+        thread_local std::vector<std::pair<int, int>> spans;
+        spans.clear();
+        shape.Spans(px, period, [&](int begin, int end) {
+            begin = std::max(begin, 0);
+            end = std::min(end, period);
+            for (int base = 0; begin < end && base + begin < cols; base += period) {
+                spans.emplace_back(base + begin, std::min(base + end, cols));
+            }
+        });
+        if (spans.empty()) {
+            return false;
+        }
+
+        lo = cols;
+        hi = 0;
+        for (const auto& span : spans) {
+            lo = std::min(lo, span.first);
+            hi = std::max(hi, span.second);
+        }
+        std::memset(out + lo, 0, hi - lo);
+        const uchar magnitude = DistortionMagnitude();
+        const int limit = static_cast<Derived&>(*this).PercentLimit();
+        for (const auto& span : spans) {
+            for (int y = span.first; y < span.second; ++y) {
+                if (PixelNoise{noise_key, x, y}.Percent() < limit) {
+                    out[y] = magnitude;
+                }
+            }
+        }
+        return true;
+    }
+
+    // Returns a tile covering a rows x cols image, building or growing it if needed.
+    // The tile only depends on the layer key, so it is the same for every image.
+    std::shared_ptr<const PeriodTile> Tile(int rows, int cols) {
+        std::lock_guard<std::mutex> lock(tile_mutex);
+        const int period_rows = radius_x >= 1 ? radius_x : rows;
+        const int period_cols = radius_y >= 1 ? radius_y : cols;
+        if (tile && tile->period.rows >= period_rows && tile->period.cols >= period_cols &&
+                tile->rows.cols >= cols) {
+            return tile;
+        }
+
+        auto next = std::make_shared<PeriodTile>();
+        next->period.create(std::max(period_rows, tile ? tile->period.rows : 0),
+                            std::max(period_cols, tile ? tile->period.cols : 0), CV_8U);
+        decltype(auto) shape = static_cast<Derived&>(*this).RowShape(next->period.cols);
+        for (int px = 0; px < next->period.rows; ++px) {
+            uchar* out = next->period.ptr<uchar>(px);
+            std::memset(out, 0, next->period.cols);
+            int lo, hi;
+            FillRow(shape, px, next->period.cols, key, out, lo, hi);
+        }
+
+        // Repeat every period row across the width by doubling copies
+        const int width = std::max(cols, tile ? tile->rows.cols : 0);
+        next->rows.create(next->period.rows, std::max(width, next->period.cols), CV_8U);
+        for (int px = 0; px < next->rows.rows; ++px) {
+            uchar* out = next->rows.ptr<uchar>(px);
+            int filled = next->period.cols;
+            std::memcpy(out, next->period.ptr<uchar>(px), filled);
+            while (filled < next->rows.cols) {
+                int count = std::min(filled, next->rows.cols - filled);
+                std::memcpy(out + filled, out, count);
+                filled += count;
+            }
+        }
+        tile = std::move(next);
+        return tile;
+    }
 };
 
-class LinesPrinter : public Printer {
+class LinesPrinter : public PrinterKernel<LinesPrinter> {
 public:
     LinesPrinter() = delete;
 
@@ -109,18 +359,23 @@ public:
                       int density, bool black, float intensivity, 
                       int start_, int end_, bool horizontal_,
                       bool use_memory = false) : 
-                        Printer(radius_x, radius_y, x_lim, y_lim, density, black, intensivity, use_memory) {
+                        PrinterKernel(radius_x, radius_y, x_lim, y_lim, density, black, intensivity, use_memory) {
         horizontal = horizontal_;
         start = start_;
         end = end_;
     }
+
+    const char* Name() const override { return "Line"; }
 private:
-    int changePixel(int x, int y) {
-        int coordinate = horizontal ? x : y;
-        if ((coordinate >= start && coordinate <= end) && (std::rand() % 100 < density)) {
-            return new_intensivity;
-        } else {
-            return 0; 
+    friend class PrinterKernel<LinesPrinter>;
+
+    // start <= coordinate <= end: the whole row or a band of columns
+    template <class Emit>
+    void Spans(int x, int cols, Emit&& emit) const {
+        if (!horizontal) {
+            emit(start, end + 1);
+        } else if (x >= start && x <= end) {
+            emit(0, cols);
         }
     }
 
@@ -129,7 +384,7 @@ private:
     int end;
 };
 
-class BlobPrinter : public Printer {
+class BlobPrinter : public PrinterKernel<BlobPrinter> {
 public:
     BlobPrinter() = delete;
 
@@ -137,22 +392,43 @@ public:
                       int density, bool black, float intensivity, 
                       int point_x_, int point_y_, int radius_a_, int radius_b_,
                       bool use_memory = false) : 
-                        Printer(radius_x, radius_y, x_lim, y_lim, density, black, intensivity, use_memory) {
+                        PrinterKernel(radius_x, radius_y, x_lim, y_lim, density, black, intensivity, use_memory) {
         point_x = point_x_;
         point_y = point_y_;
         radius_a = radius_a_;
         radius_b = radius_b_;
     }
 
+    const char* Name() const override { return "Blob"; }
+
 private:
-    int changePixel(int x, int y) {
-        int a_pow = radius_a * radius_a;
-        int b_pow = radius_b * radius_b;
-        int length = ((x - point_x) * (x - point_x)) * b_pow + ((y - point_y) * (y - point_y)) * a_pow;
-        if (length < a_pow * b_pow && (std::rand() % 100 <= density)) {
-            return new_intensivity;
-        } else {
-            return 0; 
+    friend class PrinterKernel<BlobPrinter>;
+
+    // Blobs have always been drawn with percent <= density
+    int PercentLimit() const {
+        return density + 1;
+    }
+
+    // Chord of the ellipse dx^2 * b^2 + dy^2 * a^2 < a^2 * b^2 at row x: the
+    // largest dy is estimated with sqrt and then fixed up with the exact test
+    template <class Emit>
+    void Spans(int x, int cols, Emit&& emit) const {
+        const int64_t a_pow = static_cast<int64_t>(radius_a) * radius_a;
+        const int64_t b_pow = static_cast<int64_t>(radius_b) * radius_b;
+        const int64_t dx = x - point_x;
+        const int64_t rest = a_pow * b_pow - dx * dx * b_pow;
+        if (a_pow == 0 || rest <= 0) {
+            return;
+        }
+        int64_t dy = static_cast<int64_t>(std::sqrt(static_cast<double>(rest) / a_pow));
+        while ((dy + 1) * (dy + 1) * a_pow < rest) {
+            ++dy;
+        }
+        while (dy >= 0 && dy * dy * a_pow >= rest) {
+            --dy;
+        }
+        if (dy >= 0) {
+            emit(static_cast<int>(point_y - dy), static_cast<int>(point_y + dy + 1));
         }
     }
 
@@ -162,7 +438,7 @@ private:
     int radius_b;
 };
 
-class SinPrinter : public Printer {
+class SinPrinter : public PrinterKernel<SinPrinter> {
 public:
     SinPrinter() = delete;
 
@@ -170,7 +446,7 @@ public:
                       int density, bool black, float intensivity,
                       int start_, int shift_, int amplitude_, float period_, bool horizontal_,
                       bool use_memory = false) : 
-                        Printer(radius_x, radius_y, x_lim, y_lim, density, black, intensivity, use_memory) {
+                        PrinterKernel(radius_x, radius_y, x_lim, y_lim, density, black, intensivity, use_memory) {
         start = start_;
         shift = shift_;
         amplitude = amplitude_;
@@ -178,16 +454,69 @@ public:
         horizontal = horizontal_;
     }
 
+    const char* Name() const override { return "Sin"; }
+
 private:
-    int changePixel(int x, int y) {
-        if (horizontal) {
-            std::swap(x, y);
+    friend class PrinterKernel<SinPrinter>;
+
+    // Same type as the expression below, so table lookups compare exactly like it
+    using EnvelopeValue = decltype(std::abs(sin(0.0f)) * 0);
+
+    // Height of the wave at position t along it; a pixel k > 0 pixels past start
+    // is covered while Envelope(t) > k
+    EnvelopeValue Envelope(int t) const {
+        return std::abs(sin(static_cast<float>(t - shift) / period)) * amplitude;
+    }
+
+    // Rows along the wave (horizontal = false): one Envelope per row, one span.
+    // Rows across it: Envelope of every column is computed once per batch into
+    // a table and the row takes the runs where it is above the row's height.
+    struct Shape {
+        const SinPrinter& printer;
+        std::vector<EnvelopeValue> columns;
+
+        template <class Emit>
+        void Spans(int x, int cols, Emit&& emit) const {
+            if (!printer.horizontal) {
+                auto envelope = printer.Envelope(x);
+                if (!(envelope > 1)) {
+                    return;
+                }
+                int height = static_cast<int>(std::ceil(envelope)) - 1;
+                while (height >= 1 && !(envelope > height)) {
+                    --height;
+                }
+                emit(printer.start + 1, printer.start + height + 1);
+                return;
+            }
+            const int height = x - printer.start;
+            if (height < 1 || height >= std::abs(printer.amplitude)) {
+                return;
+            }
+            for (int y = 0; y < cols;) {
+                while (y < cols && !(columns[y] > height)) {
+                    ++y;
+                }
+                int begin = y;
+                while (y < cols && columns[y] > height) {
+                    ++y;
+                }
+                if (begin < y) {
+                    emit(begin, y);
+                }
+            }
         }
-        if ((y > start) && (std::abs(sin(static_cast<float>(x - shift) / period)) * amplitude > y - start) && (std::rand() % 100 < density)) {
-            return new_intensivity;
-        } else {
-            return 0; 
+    };
+
+    Shape RowShape(int period_cols) {
+        Shape shape{*this, {}};
+        if (horizontal) {
+            shape.columns.resize(period_cols);
+            for (int y = 0; y < period_cols; ++y) {
+                shape.columns[y] = Envelope(y);
+            }
         }
+        return shape;
     }
 
     int start;
@@ -203,29 +532,94 @@ public:
 
     BlurPrinter(float intensivity) : intensivity(intensivity) {}
 
-    void ModifyImage(Mat& image) {
-        blur(image, image, Size(image.rows * intensivity, image.cols * intensivity));
+    const char* Name() const override { return "Blur"; }
+
+    // Output row y averages rows y - h / 2 .. y + (h - 1) / 2 of a kernel h tall
+    int HaloRows(Size size) const override {
+        return KernelSize(size).height / 2;
+    }
+
+    // Isolated, so a window reflects at its own edges (the image edges, or cuts
+    // inside the halo) and never reads past them
+    void ModifyWindow(Mat& window, int first_row, Size size, uint64_t sample) override {
+        blur(window, window, KernelSize(size), Point(-1, -1), BORDER_DEFAULT | BORDER_ISOLATED);
     }
 
 private:
+    Size KernelSize(Size size) const {
+        return Size(size.height * intensivity, size.width * intensivity);
+    }
+
     float intensivity;
 };
 
+// Strip of rows processed by all fused layers at once, sized to sit in L2
+const size_t FUSED_STRIP_BYTES = 128 * 1024;
+
 class PrinterStack {
 public:
-    PrinterStack() {}
+    explicit PrinterStack(uint64_t seed = 0) : seed(seed) {}
 
     PrinterStack(const PrinterStack&) = delete;
 
     void AddLayer(std::unique_ptr<Modifier> printer) {
+        printer->SetSeed(seed, layers.size());
         // Should move layers in here, to avoid copy and referance invalidation
         layers.push_back(std::move(printer));
     }
 
-    void ProcessImage(Mat& image) const {
-        for (auto&& i : layers) {
-            i->ModifyImage(image);
+    void SetSeed(uint64_t seed_) {
+        seed = seed_;
+        for (size_t i = 0; i < layers.size(); ++i) {
+            layers[i]->SetSeed(seed, i);
+        }
+    }
+
+    uint64_t GetSeed() const {
+        return seed;
+    }
+
+    // Same image, seed and sample always give the same result.
+    // Runs of pointwise layers are fused: the image is walked once in strips of
+    // rows small enough to stay in L2, and every layer of the run is applied to a
+    // strip before moving on. Other layers (blur) see the whole image and split runs.
+    void ProcessImage(Mat& image, uint64_t sample = 0) const {
+        ProcessWindow(image, 0, image.size(), sample);
+    }
+
+    // ProcessImage on a window of rows of an image of `size`, see
+    // Modifier::ModifyWindow. Every layer spreads the damage at a cut further
+    // in, so the HaloRows of the stack is the sum of its layers'.
+    void ProcessWindow(Mat& window, int first_row, Size size, uint64_t sample = 0) const {
+        for (size_t i = 0; i < layers.size();) {
+            size_t end = i + 1;
+            while (layers[i]->IsPointwise() && end < layers.size() && layers[end]->IsPointwise()) {
+                ++end;
+            }
+            if (end - i == 1) {
+                TRACE_SCOPE_DYNAMIC(layers[i]->Name());
+                layers[i]->ModifyWindow(window, first_row, size, sample);
+            } else {
+                // Every strip of every fused layer is its own scope, so layers keep their own totals
+                const int strip = std::max<int>(1, static_cast<int>(FUSED_STRIP_BYTES / std::max<size_t>(window.step, 1)));
+                for (int first = 0; first < window.rows; first += strip) {
+                    Mat rows = window.rowRange(first, std::min(window.rows, first + strip));
+                    for (size_t k = i; k < end; ++k) {
+                        TRACE_SCOPE_DYNAMIC(layers[k]->Name());
+                        layers[k]->ModifyWindow(rows, first_row + first, size, sample);
+                    }
+                }
+            }
+            i = end;
+        }
+    }
+
+    int HaloRows(Size size) const {
+        int halo = 0;
+        for (const auto& layer : layers) {
+            halo = std::min(halo + layer->HaloRows(size), size.height);
         }
+        return halo;
     }
 
     void Clear() {
@@ -233,5 +627,6 @@ public:
     }
 
 private:
+    uint64_t seed;
     std::vector<std::unique_ptr<Modifier>> layers;
 };
@@ -0,0 +1,195 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Distortions.hpp"
+#include "Optics.hpp"
+
+inline std::vector<std::string> split(std::string s, std::string delimiter) {
+    size_t pos_start = 0, pos_end, delim_len = delimiter.length();
+    std::string token;
+    std::vector<std::string> res;
+
+    while ((pos_end = s.find(delimiter, pos_start)) != std::string::npos) {
+        token = s.substr (pos_start, pos_end - pos_start);
+        pos_start = pos_end + delim_len;
+        res.push_back (token);
+    }
+
+    res.push_back (s.substr (pos_start));
+    return res;
+}
+
+struct NamedStack {
+    std::string name;
+    std::shared_ptr<PrinterStack> stack;
+};
+
+// Seed of a stack without its own `Seed` line: derived from the global seed and
+// the stack name, so adding or reordering stacks doesn't change the others
+inline uint64_t StackSeed(uint64_t global_seed, const std::string& name) {
+    return CombineSeed(global_seed, HashString(name));
+}
+
+// Builds one layer from a config line, nullptr if the line doesn't satisfy the format
+inline std::unique_ptr<Modifier> ParseLayer(const std::vector<std::string>& parsed) {
+    int r_x = 0, r_y = 0, x_lim = 0, y_lim = 0, density = 0;
+    bool black = false;
+    float intensivity = 0;
+    if (parsed.size() > 7) {
+        r_x = std::stoi(parsed[1]);
+        r_y = std::stoi(parsed[2]);
+        x_lim = std::stoi(parsed[3]);
+        y_lim = std::stoi(parsed[4]);
+        density = std::stoi(parsed[5]);
+        black = parsed[6] == "0" ? false : true;
+        intensivity = std::stof(parsed[7]);
+    }
+    if (parsed[0] == "Line") {
+        if (parsed.size() < 11) {
+            return nullptr;
+        }
+        int start = std::stoi(parsed[8]);
+        int end = std::stoi(parsed[9]);
+        int horizontal = parsed[10] ==  "0" ? false : true;
+        bool memory = false;
+        if (parsed.size() > 11) {
+            memory = parsed[11] ==  "0" ? false : true;
+        }
+        return std::make_unique<LinesPrinter>(r_x, r_y, x_lim, y_lim, density, black, intensivity, start, end, horizontal, memory);
+    }
+    else if (parsed[0] == "Blob") {
+        if (parsed.size() < 12) {
+            return nullptr;
+        }
+        int point_x = std::stoi(parsed[8]);
+        int point_y = std::stoi(parsed[9]);
+        int radius_a = std::stoi(parsed[10]);
+        int radius_b = std::stoi(parsed[11]);
+        bool memory = false;
+        if (parsed.size() > 12) {
+            memory = parsed[12] ==  "0" ? false : true;
+        }
+        return std::make_unique<BlobPrinter>(r_x, r_y, x_lim, y_lim, density, black, intensivity, point_x, point_y, radius_a, radius_b, memory);
+    }
+    else if (parsed[0] == "Sin") {
+        if (parsed.size() < 13) {
+            return nullptr;
+        }
+        int start = std::stoi(parsed[8]);
+        int shift = std::stoi(parsed[9]);
+        int amplitude = std::stoi(parsed[10]);
+        float period = std::stof(parsed[11]);
+        int horizontal = parsed[12] ==  "0" ? false : true;
+        bool memory = false;
+        if (parsed.size() > 13) {
+            memory = parsed[13] ==  "0" ? false : true;
+        }
+        return std::make_unique<SinPrinter>(r_x, r_y, x_lim, y_lim, density, black, intensivity, start, shift, amplitude, period, horizontal, memory);
+    }
+    else if (parsed[0] == "Blur") {
+        if (parsed.size() < 2) {
+            return nullptr;
+        }
+        intensivity = std::stof(parsed[1]);
+        return std::make_unique<BlurPrinter>(intensivity);
+    }
+    else if (parsed[0] == "Gauss") {
+        if (parsed.size() < 2) {
+            return nullptr;
+        }
+        return std::make_unique<GaussBlur>(std::stof(parsed[1]));
+    }
+    else if (parsed[0] == "Motion") {
+        if (parsed.size() < 3) {
+            return nullptr;
+        }
+        return std::make_unique<MotionBlur>(std::stof(parsed[1]), std::stof(parsed[2]));
+    }
+    else if (parsed[0] == "Defocus") {
+        if (parsed.size() < 2) {
+            return nullptr;
+        }
+        return std::make_unique<DefocusBlur>(std::stof(parsed[1]));
+    }
+    else if (parsed[0] == "Noise") {
+        if (parsed.size() < 3) {
+            return nullptr;
+        }
+        return std::make_unique<SensorNoise>(std::stof(parsed[1]), std::stof(parsed[2]));
+    }
+    return nullptr;
+}
+
+// Parses the whole noize config up front: a stack name line, its layers, then
+// an empty line. A stack still open at the end of the file is kept as well.
+// `Seed N` outside of a stack sets the global seed for the stacks after it,
+// inside of a stack it sets the seed of that stack only.
+inline std::vector<NamedStack> ParseNoizeConfig(const std::string& path) {
+    std::vector<NamedStack> stacks;
+    std::ifstream noize_config(path);
+    if (!noize_config.is_open()) {
+        std::cout << "Can't open noize config : " << path << '\n';
+        return stacks;
+    }
+
+    auto stack = std::make_shared<PrinterStack>();
+    std::string stack_name;
+    bool has_layers = false;
+    uint64_t global_seed = 0;
+    bool has_seed = false;
+    uint64_t stack_seed = 0;
+
+    auto finish_stack = [&]() {
+        if (!stack_name.empty() || has_layers) {
+            stack->SetSeed(has_seed ? stack_seed : StackSeed(global_seed, stack_name));
+            stacks.push_back({stack_name, std::move(stack)});
+        }
+        stack = std::make_shared<PrinterStack>();
+        stack_name.clear();
+        has_layers = false;
+        has_seed = false;
+    };
+
+    for (std::string line; std::getline(noize_config, line);) {
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        if (line.size() > 0 && line[0] == '/') {
+            continue;
+        }
+        if (line.empty()) {
+            finish_stack();
+            continue;
+        }
+        std::vector parsed = split(line, " ");
+        if (parsed.size() == 1) {
+            stack_name = parsed[0];
+            continue;
+        }
+        if (parsed[0] == "Seed" && parsed.size() == 2) {
+            uint64_t seed = std::stoull(parsed[1]);
+            if (stack_name.empty() && !has_layers) {
+                global_seed = seed;
+            } else {
+                stack_seed = seed;
+                has_seed = true;
+            }
+            continue;
+        }
+        auto layer = ParseLayer(parsed);
+        if (!layer) {
+            std::cout << "Warning : " << line << "  //Doesn't satisfy format\n";
+            continue;
+        }
+        stack->AddLayer(std::move(layer));
+        has_layers = true;
+    }
+    finish_stack();
+    return stacks;
+}
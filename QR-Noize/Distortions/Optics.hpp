@@ -0,0 +1,436 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "Distortions.hpp"
+
+// Camera degradations. Sizes are given as fractions of the smaller image side,
+// so a config means the same on any resolution. Blurs are built from running
+// sums: every pass costs O(1) per pixel whatever the radius, works in place and
+// only needs a row or a ring of rows of scratch, so they can run on a Mat or on
+// a ROI of one. Borders are replicated.
+// Sizes always come from the whole image, also when a layer is given a window
+// of its rows.
+
+inline int RelativeSize(Size size, float fraction) {
+    return static_cast<int>(std::lround(std::min(size.height, size.width) * fraction));
+}
+
+// Rounded division by a fixed window size as a multiply and a shift
+struct WindowMean {
+    explicit WindowMean(int count) : scale(((uint64_t(1) << 32) + count / 2) / count) {}
+
+    uchar operator()(int64_t sum) const {
+        return static_cast<uchar>((sum * scale + (int64_t(1) << 31)) >> 32);
+    }
+
+    int64_t scale;
+};
+
+// Mean over 2 * radius + 1 consecutive values of `count` values `stride` apart, in place
+inline void BoxLine(uchar* line, int count, size_t stride, int radius, std::vector<uchar>& scratch) {
+    if (radius <= 0 || count <= 0) {
+        return;
+    }
+    // Replicated borders go straight into the scratch copy, so the loop has no clamps
+    scratch.resize(static_cast<size_t>(count) + 2 * radius + 1);
+    std::fill(scratch.begin(), scratch.begin() + radius, line[0]);
+    for (int i = 0; i < count; ++i) {
+        scratch[radius + i] = line[i * stride];
+    }
+    std::fill(scratch.begin() + radius + count, scratch.end(), line[(count - 1) * stride]);
+    const WindowMean mean(2 * radius + 1);
+    int64_t sum = 0;
+    for (int i = 0; i < 2 * radius + 1; ++i) {
+        sum += scratch[i];
+    }
+    for (int i = 0; i < count; ++i) {
+        line[i * stride] = mean(sum);
+        sum += scratch[i + 2 * radius + 1] - scratch[i];
+    }
+}
+
+inline void BoxHorizontal(Mat& image, int radius) {
+    thread_local std::vector<uchar> scratch;
+    for (int y = 0; y < image.rows; ++y) {
+        BoxLine(image.ptr<uchar>(y), image.cols, 1, radius, scratch);
+    }
+}
+
+// Column sums of a whole row are updated at once, which vectorizes. Rows above
+// the current one are already overwritten, so their originals are kept in a
+// ring of radius + 1 rows.
+inline void BoxVertical(Mat& image, int radius) {
+    if (radius <= 0 || image.rows <= 0) {
+        return;
+    }
+    const int cols = image.cols;
+    thread_local std::vector<int> sums;
+    thread_local std::vector<uchar> ring;
+    sums.assign(cols, 0);
+    ring.resize(static_cast<size_t>(radius + 1) * cols);
+    auto slot = [&](int row) { return ring.data() + static_cast<size_t>(row % (radius + 1)) * cols; };
+
+    for (int i = -radius; i <= radius; ++i) {
+        const uchar* row = image.ptr<uchar>(std::clamp(i, 0, image.rows - 1));
+        for (int x = 0; x < cols; ++x) {
+            sums[x] += row[x];
+        }
+    }
+    const WindowMean mean(2 * radius + 1);
+    for (int y = 0; y < image.rows; ++y) {
+        uchar* row = image.ptr<uchar>(y);
+        std::memcpy(slot(y), row, cols);
+        for (int x = 0; x < cols; ++x) {
+            row[x] = mean(sums[x]);
+        }
+        if (y + 1 == image.rows) {
+            break;
+        }
+        // Rows below y are still original; y - radius and above come from the ring
+        const uchar* enter = image.ptr<uchar>(std::min(y + radius + 1, image.rows - 1));
+        const uchar* leave = slot(std::max(y - radius, 0));
+        for (int x = 0; x < cols; ++x) {
+            sums[x] += enter[x] - leave[x];
+        }
+    }
+}
+
+// Gaussian approximated by three box blurs with widths picked so the variances
+// add up to sigma^2 (W. Jarosz / P. Kovesi "fast almost-Gaussian filtering")
+class GaussBlur : public Modifier {
+public:
+    GaussBlur() = delete;
+
+    GaussBlur(float sigma) : sigma(sigma) {}
+
+    const char* Name() const override { return "Gauss"; }
+
+    // Each vertical pass reaches its radius further
+    int HaloRows(Size size) const override {
+        int halo = 0;
+        for (int radius : Radii(size)) {
+            halo += radius;
+        }
+        return halo;
+    }
+
+    void ModifyWindow(Mat& window, int first_row, Size size, uint64_t sample) override {
+        for (int radius : Radii(size)) {
+            BoxHorizontal(window, radius);
+            BoxVertical(window, radius);
+        }
+    }
+
+private:
+    // Box radius of every pass, none if there is nothing to blur
+    std::vector<int> Radii(Size size) const {
+        const double s = std::min(size.height, size.width) * static_cast<double>(sigma);
+        if (s <= 0) {
+            return {};
+        }
+        const int passes = 3;
+        int lower = static_cast<int>(std::sqrt(12 * s * s / passes + 1));
+        if (lower % 2 == 0) {
+            --lower;
+        }
+        const int upper = lower + 2;
+        const int lower_count = static_cast<int>(std::lround(
+                (12 * s * s - passes * lower * lower - 4 * passes * lower - 3 * passes) / (-4.0 * lower - 4)));
+        std::vector<int> radii;
+        for (int i = 0; i < passes; ++i) {
+            radii.push_back(((i < lower_count ? lower : upper) - 1) / 2);
+        }
+        return radii;
+    }
+
+    float sigma;
+};
+
+// Linear motion blur: mean over a segment of `length` at `angle` degrees. Pixels
+// are walked along digital lines in the motion direction (every pixel is on
+// exactly one), each line gets a running mean, so any angle is O(1) per pixel.
+class MotionBlur : public Modifier {
+public:
+    MotionBlur() = delete;
+
+    MotionBlur(float length, float angle) : length(length), angle(angle) {}
+
+    const char* Name() const override { return "Motion"; }
+
+    // Along rows a segment drifts by the slope times its steps across them;
+    // otherwise its steps are rows
+    int HaloRows(Size size) const override {
+        const Direction direction = Along(size);
+        if (direction.radius <= 0) {
+            return 0;
+        }
+        return direction.along_rows ? static_cast<int>(std::abs(direction.slope) * direction.radius) + 1 : direction.radius;
+    }
+
+    void ModifyWindow(Mat& window, int first_row, Size size, uint64_t sample) override {
+        const Direction direction = Along(size);
+        if (direction.radius <= 0) {
+            return;
+        }
+        // Lines going down the rows are laid out from the top row of the image,
+        // so a window is walked along the same lines as the whole image
+        if (direction.along_rows) {
+            Walk(window.ptr<uchar>(0), window.cols, window.rows, 1, window.step, direction.slope, direction.radius, 0);
+        } else {
+            Walk(window.ptr<uchar>(0), window.rows, window.cols, window.step, 1, direction.slope, direction.radius, first_row);
+        }
+    }
+
+private:
+    struct Direction {
+        bool along_rows;
+        double slope;  // minor axis step per major axis step
+        int radius;    // of the window, in major axis steps
+    };
+
+    Direction Along(Size size) const {
+        const double radians = angle * CV_PI / 180.0;
+        const double dx = std::cos(radians);
+        const double dy = std::sin(radians);
+        const bool along_rows = std::abs(dx) >= std::abs(dy);
+        // The window counts steps along the major axis, so shorten it by the slope
+        const double steps = RelativeSize(size, length) * (along_rows ? std::abs(dx) : std::abs(dy));
+        return {along_rows, along_rows ? dy / dx : dx / dy, static_cast<int>(std::lround(steps)) / 2};
+    }
+
+    // Lines run along the major axis (major_count long, major_stride apart);
+    // at major position i a line started at minor offset m sits at m + offset[i].
+    // `origin` is the major position of data in the whole image.
+    static void Walk(uchar* data, int major_count, int minor_count, size_t major_stride, size_t minor_stride,
+                     double slope, int radius, int origin) {
+        thread_local std::vector<int> offset;
+        thread_local std::vector<uchar> line;
+        thread_local std::vector<uchar> scratch;
+        offset.resize(major_count);
+        for (int i = 0; i < major_count; ++i) {
+            offset[i] = static_cast<int>(std::lround(static_cast<double>(origin + i) * slope));
+        }
+        const int low = *std::min_element(offset.begin(), offset.end());
+        const int high = *std::max_element(offset.begin(), offset.end());
+        line.resize(major_count);
+        for (int m = -high; m < minor_count - low; ++m) {
+            // Offsets are monotonic, so the part of the line inside the image is contiguous
+            int first = -1;
+            int count = 0;
+            for (int i = 0; i < major_count; ++i) {
+                const int minor = m + offset[i];
+                if (minor >= 0 && minor < minor_count) {
+                    if (first < 0) {
+                        first = i;
+                    }
+                    line[count++] = data[i * major_stride + minor * minor_stride];
+                }
+            }
+            if (count < 2) {
+                continue;
+            }
+            BoxLine(line.data(), count, 1, radius, scratch);
+            for (int k = 0; k < count; ++k) {
+                const int i = first + k;
+                data[i * major_stride + (m + offset[i]) * minor_stride] = line[k];
+            }
+        }
+    }
+
+    float length;
+    float angle;
+};
+
+// Defocus: mean over a disk. A disk isn't separable, so it is approximated by a
+// staircase of at most DEFOCUS_STEPS centered rectangles, each taller and
+// narrower than the previous one (up to DEFOCUS_STEPS - 1 pixels of radius that
+// is the exact disk, one step per chord). By inclusion-exclusion the sum over
+// the staircase is the sum over every step minus its overlap with the next,
+// which is a rectangle as well; a rectangle is a running column sum of its
+// height read through a prefix sum of the row, so a pixel costs
+// O(DEFOCUS_STEPS) whatever the radius.
+// The window is blurred in place: the last r + 1 source rows are kept in a
+// ring, next to a column sum and a prefix row per step, and all of it is freed
+// when the call returns.
+const int DEFOCUS_STEPS = 8;
+
+class DefocusBlur : public Modifier {
+public:
+    DefocusBlur() = delete;
+
+    DefocusBlur(float radius) : radius(radius) {}
+
+    const char* Name() const override { return "Defocus"; }
+
+    // Rows -height..height and columns -width..width around the pixel
+    struct Step {
+        int height;
+        int width;
+    };
+
+    // Staircase of a disk of radius r: heights split 0..r evenly, and every step
+    // is as wide as the disk's chord in the middle of the rows it adds
+    static std::vector<Step> Steps(int r) {
+        const int count = std::min(r + 1, DEFOCUS_STEPS);
+        std::vector<Step> steps;
+        int below = -1;
+        for (int k = 0; k < count; ++k) {
+            const int height = (k + 1) * (r + 1) / count - 1;
+            const double middle = (below + 1 + height) / 2;
+            steps.push_back({height, static_cast<int>(std::sqrt(static_cast<double>(r) * r - middle * middle))});
+            below = height;
+        }
+        return steps;
+    }
+
+    int HaloRows(Size size) const override {
+        return std::max(RelativeSize(size, radius), 0);
+    }
+
+    void ModifyWindow(Mat& image, int first_row, Size size, uint64_t sample) override {
+        const int r = RelativeSize(size, radius);
+        if (r <= 0 || image.rows <= 0 || image.cols <= 0) {
+            return;
+        }
+        const int rows = image.rows;
+        const int cols = image.cols;
+        const std::vector<Step> steps = Steps(r);
+        const size_t count = steps.size();
+
+        int64_t area = 0;
+        for (size_t k = 0; k < count; ++k) {
+            const int next = k + 1 < count ? 2 * steps[k + 1].width + 1 : 0;
+            area += static_cast<int64_t>(2 * steps[k].height + 1) * (2 * steps[k].width + 1 - next);
+        }
+        const WindowMean mean(static_cast<int>(area));
+
+        // Source rows above y are already blurred, the ring keeps their originals
+        const int ring_rows = r + 1;
+        std::vector<uchar> ring(static_cast<size_t>(ring_rows) * cols);
+        int y = 0;
+        auto source = [&](int v) {
+            const int c = std::clamp(v, 0, rows - 1);
+            return c < y ? ring.data() + static_cast<size_t>(c % ring_rows) * cols : image.ptr<uchar>(c);
+        };
+
+        // Column sums of every step's height at row 0, built outwards from the center row
+        std::vector<int> columns(count * cols);
+        std::vector<int> running(source(0), source(0) + cols);
+        for (int d = 0, k = 0; d <= r; ++d) {
+            if (d > 0) {
+                const uchar* up = source(-d);
+                const uchar* down = source(d);
+                for (int x = 0; x < cols; ++x) {
+                    running[x] += up[x] + down[x];
+                }
+            }
+            for (; k < static_cast<int>(count) && steps[k].height == d; ++k) {
+                std::copy(running.begin(), running.end(), columns.begin() + static_cast<size_t>(k) * cols);
+            }
+        }
+
+        std::vector<int64_t> prefix(count * (cols + 1));
+        std::vector<int64_t> sums(cols);
+        for (; y < rows; ++y) {
+            for (size_t k = 0; k < count; ++k) {
+                int* column = columns.data() + k * cols;
+                if (y > 0) {
+                    const uchar* add = source(y + steps[k].height);
+                    const uchar* remove = source(y - 1 - steps[k].height);
+                    for (int x = 0; x < cols; ++x) {
+                        column[x] += add[x] - remove[x];
+                    }
+                }
+                int64_t* row = prefix.data() + k * (cols + 1);
+                row[0] = 0;
+                for (int x = 0; x < cols; ++x) {
+                    row[x + 1] = row[x] + column[x];
+                }
+            }
+
+            // Columns x - w .. x + w of a step, the ones past an edge replicating it
+            auto rectangle = [&](size_t k, int x, int w) {
+                const int* column = columns.data() + k * cols;
+                const int64_t* row = prefix.data() + k * (cols + 1);
+                const int lo = x - w;
+                const int hi = x + w;
+                return row[std::min(hi, cols - 1) + 1] - row[std::max(lo, 0)] +
+                       static_cast<int64_t>(std::max(-lo, 0)) * column[0] +
+                       static_cast<int64_t>(std::max(hi - cols + 1, 0)) * column[cols - 1];
+            };
+            for (int x = 0; x < cols; ++x) {
+                int64_t sum = 0;
+                for (size_t k = 0; k < count; ++k) {
+                    sum += rectangle(k, x, steps[k].width);
+                    if (k + 1 < count) {
+                        sum -= rectangle(k, x, steps[k + 1].width);
+                    }
+                }
+                sums[x] = sum;
+            }
+
+            uchar* out = image.ptr<uchar>(y);
+            std::memcpy(ring.data() + static_cast<size_t>(y % ring_rows) * cols, out, cols);
+            for (int x = 0; x < cols; ++x) {
+                out[x] = mean(sums[x]);
+            }
+        }
+    }
+
+private:
+    float radius;
+};
+
+// Sensor noise: Gaussian with variance read_sigma^2 + shot_gain * value, the
+// usual read + photon shot noise model. Pointwise and keyed like the printers,
+// so it fuses with them and is reproducible per (seed, layer, sample, pixel).
+class SensorNoise : public Modifier {
+public:
+    SensorNoise() = delete;
+
+    SensorNoise(float read_sigma, float shot_gain) : read_sigma(read_sigma), shot_gain(shot_gain) {
+        SetSeed(0, 0);
+    }
+
+    const char* Name() const override { return "Noise"; }
+
+    void SetSeed(uint64_t seed, uint64_t layer) override {
+        key = CombineSeed(seed, layer) | 1;
+    }
+
+    bool IsPointwise() const override { return true; }
+
+    void ModifyWindow(Mat& window, int first_row, Size size, uint64_t sample) override {
+        const uint64_t image_key = CombineSeed(key, sample) | 1;
+        const uint64_t second_key = CombineSeed(image_key, 1) | 1;
+        // Standard deviation for every gray level
+        float sigma[256];
+        for (int v = 0; v < 256; ++v) {
+            sigma[v] = std::sqrt(std::max(0.0f, read_sigma * read_sigma + shot_gain * v));
+        }
+        for (int x = first_row; x < first_row + window.rows; ++x) {
+            uchar* row = window.ptr<uchar>(x - first_row);
+            for (int y = 0; y < window.cols; ++y) {
+                const uint64_t counter = (static_cast<uint64_t>(static_cast<uint32_t>(x)) << 32) | static_cast<uint32_t>(y);
+                // Sum of four 16-bit uniforms (Irwin-Hall) scaled to unit variance
+                const uint32_t a = Squares32(counter, image_key);
+                const uint32_t b = Squares32(counter, second_key);
+                const float sum = static_cast<float>((a & 0xffff) + (a >> 16) + (b & 0xffff) + (b >> 16)) / 65536.0f;
+                const float gauss = (sum - 2.0f) * 1.7320508f;
+                const int value = static_cast<int>(std::lround(row[y] + gauss * sigma[row[y]]));
+                row[y] = static_cast<uchar>(std::clamp(value, MIN_INTENSIVITY, MAX_INTENSIVITY));
+            }
+        }
+    }
+
+private:
+    float read_sigma;
+    float shot_gain;
+    uint64_t key;
+};
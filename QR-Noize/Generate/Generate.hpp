@@ -0,0 +1,191 @@
+#pragma once
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#ifdef IMGEN_HAS_ZXING_WRITERS
+#include <ZXing/BitMatrix.h>
+#include <ZXing/aztec/AZWriter.h>
+#include <ZXing/datamatrix/DMWriter.h>
+#include <ZXing/qrcode/QRErrorCorrectionLevel.h>
+#include <ZXing/qrcode/QRWriter.h>
+#endif
+
+// One barcode to generate: a line of generate.config under its block header
+struct BarcodeSpec {
+    std::string name;   // index in the config, same names generate.py gave the files
+    std::string type;   // treepoem name: qrcode, datamatrix, azteccode
+    std::string text;
+    std::string eclevel; // L/M/Q/H for qrcode, percent for azteccode
+    int version = 0;    // qrcode version 1..40, azteccode layers (negative - compact), 0 - smallest that fits
+    int margin = 4;     // quiet zone in modules
+    int scale = 0;      // pixels per module, 0 - as many as fit in size
+    // Side of the output image. 227 is what treepoem produced for generate.config,
+    // and the coordinates in noize.config are tuned for it
+    int size = 227;
+};
+
+// Reads generate.config: a header `type:amount:key=value:...` (or `None` for no
+// options) followed by `amount` lines of barcode text, repeated
+inline std::vector<BarcodeSpec> ParseGenerateConfig(const std::string& path) {
+    std::vector<BarcodeSpec> specs;
+    std::ifstream config(path);
+    if (!config.is_open()) {
+        std::cout << "Can't open generate config : " << path << '\n';
+        return specs;
+    }
+
+    BarcodeSpec block;
+    int amount = 0;
+    for (std::string line; std::getline(config, line);) {
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        if (amount > 0) {
+            BarcodeSpec spec = block;
+            spec.name = std::to_string(specs.size());
+            spec.text = line;
+            // The python generator stripped the data lines as well
+            spec.text.erase(0, spec.text.find_first_not_of(" \t"));
+            spec.text.erase(spec.text.find_last_not_of(" \t") + 1);
+            specs.push_back(std::move(spec));
+            --amount;
+            continue;
+        }
+        if (line.empty()) {
+            continue;
+        }
+
+        std::vector<std::string> parsed;
+        for (size_t start = 0;;) {
+            size_t end = line.find(':', start);
+            parsed.push_back(line.substr(start, end == std::string::npos ? std::string::npos : end - start));
+            if (end == std::string::npos) {
+                break;
+            }
+            start = end + 1;
+        }
+        if (parsed.size() < 2) {
+            std::cout << "Warning : " << line << "  //Doesn't satisfy format\n";
+            continue;
+        }
+        block = BarcodeSpec();
+        block.type = parsed[0];
+        amount = std::stoi(parsed[1]);
+        for (size_t i = 2; i < parsed.size(); ++i) {
+            size_t eq = parsed[i].find('=');
+            if (eq == std::string::npos) {
+                continue; // None
+            }
+            std::string key = parsed[i].substr(0, eq);
+            std::string value = parsed[i].substr(eq + 1);
+            key.erase(std::remove(key.begin(), key.end(), ' '), key.end());
+            value.erase(std::remove(value.begin(), value.end(), ' '), value.end());
+            if (key == "eclevel") {
+                block.eclevel = value;
+            } else if (key == "version" || key == "layers") {
+                block.version = std::stoi(value);
+            } else if (key == "scale") {
+                block.scale = std::max(0, std::stoi(value));
+            } else if (key == "size") {
+                block.size = std::max(1, std::stoi(value));
+            } else if (key == "margin") {
+                block.margin = std::max(0, std::stoi(value));
+            } else {
+                std::cout << "Warning : unknown generate option " << key << '\n';
+            }
+        }
+    }
+    return specs;
+}
+
+#ifdef IMGEN_HAS_ZXING_WRITERS
+
+// One pixel per module. The format writers are used directly, MultiFormatWriter
+// can't set a QR version or Aztec layers. A version that can't hold the text
+// throws, like any other encoding error.
+inline ZXing::BitMatrix EncodeModules(const BarcodeSpec& spec) {
+    if (spec.type == "qrcode") {
+        ZXing::QRCode::Writer writer;
+        writer.setMargin(spec.margin);
+        if (!spec.eclevel.empty()) {
+            const std::string levels = "LMQH";
+            const size_t level = levels.find(spec.eclevel[0]);
+            if (level == std::string::npos) {
+                throw std::invalid_argument("eclevel " + spec.eclevel + " is not one of L, M, Q, H");
+            }
+            const ZXing::QRCode::ErrorCorrectionLevel ec_levels[] = {
+                ZXing::QRCode::ErrorCorrectionLevel::Low, ZXing::QRCode::ErrorCorrectionLevel::Medium,
+                ZXing::QRCode::ErrorCorrectionLevel::Quality, ZXing::QRCode::ErrorCorrectionLevel::High};
+            writer.setErrorCorrectionLevel(ec_levels[level]);
+        }
+        if (spec.version != 0) {
+            if (spec.version < 1 || spec.version > 40) {
+                throw std::invalid_argument("qrcode version " + std::to_string(spec.version) + " is not in 1..40");
+            }
+            writer.setVersion(spec.version);
+        }
+        // Width and height 0: the smallest symbol, one pixel per module
+        return writer.encode(spec.text, 0, 0);
+    }
+    if (spec.type == "azteccode") {
+        ZXing::Aztec::Writer writer;
+        writer.setMargin(spec.margin);
+        if (!spec.eclevel.empty()) {
+            writer.setEccPercent(std::stoi(spec.eclevel));
+        }
+        writer.setLayers(spec.version);
+        return writer.encode(spec.text, 0, 0);
+    }
+    if (spec.type == "datamatrix") {
+        if (spec.version != 0) {
+            throw std::invalid_argument("version is not supported for datamatrix");
+        }
+        ZXing::DataMatrix::Writer writer;
+        writer.setMargin(spec.margin);
+        return writer.encode(spec.text, 0, 0);
+    }
+    throw std::invalid_argument("barcode type " + spec.type + " is not supported");
+}
+
+// Encodes the barcode straight into a grayscale Mat: one pixel per module from
+// the writer, then scaled up by a whole number with nearest neighbour so modules
+// stay crisp. Without an explicit scale the symbol is centered on a white
+// size x size canvas at the largest scale that fits.
+// Returns an empty Mat and prints why if the barcode can't be encoded as asked
+// (unsupported type or option, text too long for the version); callers count
+// that as a failure.
+inline cv::Mat RenderBarcode(const BarcodeSpec& spec) {
+    try {
+        ZXing::BitMatrix matrix = EncodeModules(spec);
+        cv::Mat modules(matrix.height(), matrix.width(), CV_8U);
+        for (int y = 0; y < matrix.height(); ++y) {
+            uchar* row = modules.ptr<uchar>(y);
+            for (int x = 0; x < matrix.width(); ++x) {
+                row[x] = matrix.get(x, y) ? 0 : 255;
+            }
+        }
+        const int side = std::max(modules.rows, modules.cols);
+        const int scale = spec.scale > 0 ? spec.scale : std::max(1, spec.size / std::max(side, 1));
+        cv::Mat symbol;
+        cv::resize(modules, symbol, cv::Size(), scale, scale, cv::INTER_NEAREST);
+        if (spec.scale > 0 || (symbol.rows >= spec.size && symbol.cols >= spec.size)) {
+            return symbol;
+        }
+        cv::Mat image(spec.size, spec.size, CV_8U, cv::Scalar(255));
+        cv::Mat center = image(cv::Rect((spec.size - symbol.cols) / 2, (spec.size - symbol.rows) / 2, symbol.cols, symbol.rows));
+        symbol.copyTo(center);
+        return image;
+    } catch (const std::exception& e) {
+        std::cout << "Error : can't encode " << spec.text << " as " << spec.type << " : " << e.what() << '\n';
+        return cv::Mat();
+    }
+}
+
+#endif
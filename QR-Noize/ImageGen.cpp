@@ -3,151 +3,446 @@
 #include <filesystem>
 #include <fstream>
 #include <vector> 
+#include <memory>
+#include <mutex>
+#include <atomic>
 
 namespace fs = std::filesystem;
 
 #include <Distortions.hpp>
+#include <NoizeConfig.hpp>
+#include <ThreadPool.hpp>
+#include <Shards.hpp>
+#include <AsyncWriter.hpp>
+#include <Trace.hpp>
+#include <Seeds.hpp>
+#include <Generate.hpp>
+#include <Validate.hpp>
+#ifdef IMGEN_HAS_JPEG
+#include <Strips.hpp>
+#endif
 
-std::vector<std::string> split(std::string s, std::string delimiter) {
-    size_t pos_start = 0, pos_end, delim_len = delimiter.length();
-    std::string token;
-    std::vector<std::string> res;
+// One JSON line per output image with everything needed to regenerate exactly it:
+// run the same config on the same source file and it comes out bit-identical
+class Metadata {
+public:
+    explicit Metadata(const std::string& path) : out(path) {}
 
-    while ((pos_end = s.find(delimiter, pos_start)) != std::string::npos) {
-        token = s.substr (pos_start, pos_end - pos_start);
-        pos_start = pos_end + delim_len;
-        res.push_back (token);
+    void Write(const std::string& file, const std::string& source, const std::string& stack, uint64_t seed, uint64_t sample) {
+        std::lock_guard<std::mutex> lock(mutex);
+        out << "{\"file\": \"" << file << "\", \"source\": \"" << source << "\", \"stack\": \"" << stack
+            << "\", \"seed\": " << seed << ", \"sample\": " << sample << "}\n";
     }
 
-    res.push_back (s.substr (pos_start));
-    return res;
+private:
+    std::ofstream out;
+    std::mutex mutex;
+};
+
+// Everything a source image needs on its way to the output directory
+struct Output {
+    std::string dir;
+    const std::vector<NamedStack>& stacks;
+    ThreadPool& pool;
+    Metadata& metadata;
+    Validator* validator = nullptr; // --validate
+    bool drop_unreadable = false;
+    AsyncWriter& writer;            // encodes and writes files or shard members off the workers
+    WorkShard shard;                // --shard i/N: which (source, stack) pairs are this node's
+    double strip_megapixels = -1;   // --strips: JPEGs this big or bigger are streamed, -1 - none
+    int quality = -1;               // JPEG quality of streamed images
+    std::atomic<size_t> failed{0};  // sources that lost their outputs; with the writer's failures, imgen exits 1
+};
+
+// A work item is a (source, stack) pair, keyed by the source name and the stack
+// name, so every node agrees on the split whatever order the files come in
+bool Owns(const Output& out, const std::string& filename, const NamedStack& named) {
+    return out.shard.Owns(CombineSeed(HashString(filename), HashString(named.name)));
+}
+
+bool OwnsAny(const Output& out, const std::string& filename) {
+    return std::any_of(out.stacks.begin(), out.stacks.end(),
+                       [&](const NamedStack& named) { return Owns(out, filename, named); });
+}
+
+// Encoder stage of imgen: JPEG through libjpeg when built with it (else OpenCV),
+// PNG through OpenCV, QOI and raw built in
+AsyncWriter::Encoder MakeEncoder(const CodecOptions& codec) {
+    return [codec](const EncodeImage& image, std::vector<uchar>& encoded) {
+        if (codec.codec == Codec::Qoi) {
+            EncodeQoi(image, encoded);
+            return true;
+        }
+        if (codec.codec == Codec::Raw) {
+            EncodeRaw(image, encoded);
+            return true;
+        }
+        Mat view(image.height, image.width, CV_8UC(image.channels), const_cast<uchar*>(image.pixels.data()));
+#ifdef IMGEN_HAS_JPEG
+        // The encoder of --strips, so streamed and whole images come out the same
+        if (codec.codec == Codec::Jpeg && image.channels == 1) {
+            return EncodeJpeg(view, codec.quality, encoded);
+        }
+#endif
+        std::vector<int> params;
+        if (codec.codec == Codec::Jpeg && codec.quality >= 0) {
+            params = {IMWRITE_JPEG_QUALITY, codec.quality};
+        } else if (codec.codec == Codec::Png && codec.level >= 0) {
+            params = {IMWRITE_PNG_COMPRESSION, codec.level};
+        }
+        return imencode(codec.codec == Codec::Jpeg ? ".jpg" : ".png", view, encoded, params);
+    };
+}
+
+// Packed copy of the pixels for the writer, the Mat itself is reused by the worker
+EncodeImage ToEncodeImage(const Mat& image) {
+    EncodeImage encode;
+    encode.width = image.cols;
+    encode.height = image.rows;
+    encode.channels = image.channels();
+    const size_t row_bytes = static_cast<size_t>(image.cols) * image.elemSize();
+    encode.pixels.resize(row_bytes * image.rows);
+    for (int y = 0; y < image.rows; ++y) {
+        std::memcpy(encode.pixels.data() + row_bytes * y, image.ptr<uchar>(y), row_bytes);
+    }
+    return encode;
+}
+
+// Fans a source image out to every stack of this shard: each stack works on a
+// copy in a per-thread buffer, so the source cost doesn't grow with the stack count
+void FanOut(std::shared_ptr<const Mat> source, const std::string& filename, const std::string& source_name, Output& out) {
+    // The noise of an image is keyed by its name, not by the order it was processed in
+    const uint64_t sample = HashString(filename);
+    for (const auto& named : out.stacks) {
+        if (!Owns(out, filename, named)) {
+            continue;
+        }
+        TRACE_GAUGE("worker queue", out.pool.Pending());
+        out.pool.Submit([source, &named, filename, sample, source_name, &out] {
+            // copyTo reuses the buffer's allocation when the size matches
+            TRACE_SCOPE("distort");
+            thread_local Mat image;
+            source->copyTo(image);
+            named.stack->ProcessImage(image, sample);
+            std::string key = filename + "_" + named.name;
+            std::string output = key + "." + out.writer.Extension();
+#ifdef IMGEN_HAS_ZXING
+            // Decoded before encoding, so unreadable samples never cost a write
+            if (out.validator) {
+                TRACE_SCOPE("validate");
+                if (!out.validator->Validate(output, named.name, image, out.drop_unreadable) && out.drop_unreadable) {
+                    return;
+                }
+            }
+#endif
+            // Shard members are named by the key, loose files go to the output directory
+            out.writer.Submit(out.writer.IsSharded() ? key : out.dir + "/" + key, ToEncodeImage(image));
+            out.metadata.Write(output, source_name, named.name, named.stack->GetSeed(), sample);
+            TRACE_COUNT("samples", 1);
+            TRACE_COUNT("pixels", image.total());
+        });
+    }
+}
+
+#ifdef IMGEN_HAS_JPEG
+// --strips: the file is never decoded whole, every stack of this shard runs
+// over it band by band in this task (see Strips.hpp) and compresses into a
+// .part file in the output directory, which the writer then moves into place.
+// False if it should take the whole-image path: too small, turned by EXIF,
+// progressive, not for libjpeg alone, or broken somewhere past the header
+// (imread gets as much out of a truncated file as it can).
+bool StreamFile(const std::string& image_path, const std::string& filename, Output& out) {
+    JpegStripReader reader;
+    if (!reader.Open(image_path)) {
+        PIPELINE_LOG(LogLevel::Debug, "Not streamed, " << reader.Error() << " : " << image_path);
+        return false;
+    }
+    if (static_cast<double>(reader.Rows()) * reader.Cols() < out.strip_megapixels * 1e6 || reader.Orientation() != 1 ||
+            reader.MultiScan()) {
+        return false;
+    }
+    PIPELINE_LOG(LogLevel::Debug, filename << "  " << reader.Rows() << 'x' << reader.Cols() << " in strips");
+    const uint64_t sample = HashString(filename);
+    std::vector<const NamedStack*> owned;
+    std::vector<const PrinterStack*> stacks;
+    std::vector<std::string> parts;
+    std::vector<std::FILE*> files;
+    bool ok = true;
+    for (const auto& named : out.stacks) {
+        if (!Owns(out, filename, named)) {
+            continue;
+        }
+        owned.push_back(&named);
+        stacks.push_back(named.stack.get());
+        parts.push_back(out.dir + "/" + filename + "_" + named.name + "." + out.writer.Extension() + ".part");
+        files.push_back(std::fopen(parts.back().c_str(), "wb"));
+        ok = ok && files.back();
+    }
+    std::string error = ok ? "" : "can't create " + out.dir + "/*.part";
+    ok = ok && DistortStrips(reader, stacks, sample, out.quality, files, error);
+    for (std::FILE* file : files) {
+        ok = file && std::fclose(file) == 0 && ok;
+    }
+    if (!ok) {
+        PIPELINE_LOG(LogLevel::Warning, "Can't stream " << image_path << " : " << error << ", decoding it whole");
+        for (const auto& part : parts) {
+            std::remove(part.c_str());
+        }
+        return false;
+    }
+    for (size_t k = 0; k < owned.size(); ++k) {
+        std::string key = filename + "_" + owned[k]->name;
+        out.writer.SubmitFile(out.writer.IsSharded() ? key : out.dir + "/" + key, parts[k]);
+        out.metadata.Write(key + "." + out.writer.Extension(), image_path, owned[k]->name, owned[k]->stack->GetSeed(), sample);
+        TRACE_COUNT("samples", 1);
+        TRACE_COUNT("pixels", static_cast<uint64_t>(reader.Rows()) * reader.Cols());
+    }
+    return true;
 }
+#endif
 
-void ProcessFile(const std::string& image_path, const std::string& dir_path, const PrinterStack& stack, const std::string& stack_name) {
+// Decodes the image once and fans it out to every stack
+void ProcessFile(const std::string& image_path, Output& out) {
     std::string filename = fs::path(image_path).stem();
     std::string extension = fs::path(image_path).extension();
     if (extension != ".jpg" && extension != ".jpeg") {
-        std::cout << "WARNING: NOT VALID FORMAT : " << extension << '\n';
+        PIPELINE_LOG(LogLevel::Warning, "Not a JPEG, skipped : " << image_path);
+        return;
+    }
+    // Files with no stack in this shard aren't even decoded
+    if (!OwnsAny(out, filename)) {
+        return;
+    }
+#ifdef IMGEN_HAS_JPEG
+    if (out.strip_megapixels >= 0 && StreamFile(image_path, filename, out)) {
+        return;
+    }
+#endif
+    std::shared_ptr<const Mat> source;
+    {
+        TRACE_SCOPE("decode");
+        Mat decoded;
+#ifdef IMGEN_HAS_JPEG
+        // The decoder of --strips, so a file gives the same pixels either way
+        if (!DecodeJpeg(image_path, decoded)) {
+            decoded = imread(image_path, IMREAD_GRAYSCALE);
+        }
+#else
+        decoded = imread(image_path, IMREAD_GRAYSCALE);
+#endif
+        source = std::make_shared<const Mat>(std::move(decoded));
+    }
+    if (source->empty()) {
+        PIPELINE_LOG(LogLevel::Error, "Can't decode " << image_path);
+        ++out.failed;
+        return;
+    }
+    PIPELINE_LOG(LogLevel::Debug, filename << "  " << source->rows << 'x' << source->cols);
+    FanOut(source, filename, image_path, out);
+}
+
+// Encodes the barcode in memory and fans it out: no subprocess and no lossy
+// intermediate file, outputs are named like the ones of generated files were
+void ProcessBarcode(const BarcodeSpec& spec, Output& out) {
+#ifdef IMGEN_HAS_ZXING_WRITERS
+    if (!OwnsAny(out, spec.name)) {
+        return;
+    }
+    Mat barcode;
+    {
+        TRACE_SCOPE("encode barcode");
+        barcode = RenderBarcode(spec);
+    }
+    if (barcode.empty()) {
+        ++out.failed;
         return;
     }
-    Mat image = imread(image_path, IMREAD_GRAYSCALE);
-    //std::cout << filename + "_" + stack_name << "  " << image.rows << 'x' << image.cols << std::endl;
-    stack.ProcessImage(image);
-    imwrite(dir_path + "/" + filename + "_" + stack_name + extension, image);
+    auto source = std::make_shared<const Mat>(std::move(barcode));
+    FanOut(source, spec.name, spec.type + ":" + spec.text, out);
+#endif
 }
 
 int main(int argc, char *argv[]) {
-    if (argc < 4) {
+    std::vector<std::string> args;
+    size_t threads = 1;
+    std::string generate_config_path;
+    bool validate = false;
+    bool drop_unreadable = false;
+    std::string shard_prefix;
+    uint64_t shard_bytes = DEFAULT_SHARD_BYTES;
+    CodecOptions codec;
+    codec.codec = Codec::Jpeg;
+    size_t encoders = 0;
+    size_t queue = 0;
+    std::string trace_path;
+    double stats_seconds = 0;
+    WorkShard shard;
+    uint64_t seed = 0;
+    bool has_seed = false;
+    double strip_megapixels = -1;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "-j" && i + 1 < argc) {
+            threads = std::max(1, std::stoi(argv[++i]));
+        } else if (arg == "--generate" && i + 1 < argc) {
+            generate_config_path = argv[++i];
+        } else if (arg == "--validate") {
+            validate = true;
+        } else if (arg == "--drop-unreadable") {
+            validate = true;
+            drop_unreadable = true;
+        } else if (arg == "--shards" && i + 1 < argc) {
+            shard_prefix = argv[++i];
+        } else if (arg == "--shard-size" && i + 1 < argc) {
+            shard_bytes = std::max<uint64_t>(1, std::stoull(argv[++i])) << 20;
+        } else if (arg == "--codec" && i + 1 < argc) {
+            if (!ParseCodec(argv[++i], codec)) {
+                std::cout << "Unknown codec " << argv[i] << ", expected jpg[:quality], png[:level], qoi or raw\n";
+                return 1;
+            }
+        } else if (arg == "--encoders" && i + 1 < argc) {
+            encoders = std::max(1, std::stoi(argv[++i]));
+        } else if (arg == "--queue" && i + 1 < argc) {
+            queue = std::max(1, std::stoi(argv[++i]));
+        } else if (arg == "--shard" && i + 1 < argc) {
+            if (!ParseWorkShard(argv[++i], shard)) {
+                std::cout << "Wrong shard " << argv[i] << ", expected i/N with 0 <= i < N\n";
+                return 1;
+            }
+        } else if (arg == "--seed" && i + 1 < argc) {
+            seed = std::stoull(argv[++i]);
+            has_seed = true;
+        } else if (arg == "--strips" && i + 1 < argc) {
+            strip_megapixels = std::max(0.0, std::stod(argv[++i]));
+        } else if (arg == "--trace" && i + 1 < argc) {
+            trace_path = argv[++i];
+        } else if (arg == "--stats" && i + 1 < argc) {
+            stats_seconds = std::max(0.0, std::stod(argv[++i]));
+        } else if (arg == "--log-level" && i + 1 < argc) {
+            LogLevel level;
+            if (!ParseLogLevel(argv[++i], level)) {
+                std::cout << "Unknown log level " << argv[i] << ", expected error, warning, info or debug\n";
+                return 1;
+            }
+            SetLogLevel(level);
+        } else {
+            args.push_back(arg);
+        }
+    }
+    // With --generate the barcodes come from the generate config instead of files
+    if (!generate_config_path.empty()) {
+        args.insert(args.begin(), std::string());
+    }
+    if (args.size() < 3) {
         std::cout << "Wrong argument amount\n";
+        std::cout << "Usage: imgen <image or dir> <output dir> <noize config> [-j threads] [--validate] [--drop-unreadable]\n"
+                  << "             [--shards <prefix> [--shard-size MB]] [--codec jpg[:q]|png[:level]|qoi|raw]\n"
+                  << "             [--encoders N] [--queue N] [--trace <file.json>] [--stats seconds]\n"
+                  << "             [--log-level error|warning|info|debug] [--shard i/N] [--seed S]\n"
+                  << "             [--strips megapixels]\n";
+        std::cout << "       imgen --generate <generate config> <output dir> <noize config> [...]\n";
+        return 1;
+    }
+#ifndef IMGEN_HAS_ZXING
+    if (!generate_config_path.empty() || validate) {
+        std::cout << "imgen is built without zxing-cpp, --generate and --validate are not available\n";
+        return 1;
+    }
+#endif
+#ifndef IMGEN_HAS_ZXING_WRITERS
+    if (!generate_config_path.empty()) {
+        std::cout << "imgen is built without the zxing-cpp format writers, --generate is not available\n";
+        return 1;
+    }
+#endif
+#ifndef IMGEN_HAS_JPEG
+    if (strip_megapixels >= 0) {
+        std::cout << "imgen is built without libjpeg, --strips is not available\n";
+        return 1;
+    }
+#endif
+    // Streamed images are never whole in memory, so there is nothing to validate,
+    // and they are encoded band by band, which only the JPEG encoder does
+    if (strip_megapixels >= 0 && (validate || codec.codec != Codec::Jpeg)) {
+        std::cout << "--strips writes JPEG and can't be combined with --validate\n";
         return 1;
     }
 
-    std::string image_path = argv[1];
-    std::string dir_path = argv[2];
+    std::string image_path = args[0];
+    std::string dir_path = args[1];
     fs::create_directory(dir_path);
-    std::string noize_config_path = argv[3];
+    std::string noize_config_path = args[2];
 
-    
+    std::vector<NamedStack> stacks = ParseNoizeConfig(noize_config_path);
+    // --seed moves every stack to a new noise stream; metadata.jsonl gets the
+    // resulting seeds, so each output can still be regenerated on its own
+    if (has_seed) {
+        for (auto& named : stacks) {
+            named.stack->SetSeed(CombineSeed(seed, named.stack->GetSeed()));
+        }
+    }
+    Metadata metadata(dir_path + "/metadata.jsonl");
+    std::unique_ptr<Validator> validator;
+    if (validate) {
+        validator = std::make_unique<Validator>(dir_path);
+    }
 
-    std::string buffer;
-    std::fstream noize_config(noize_config_path);
+    // Every file is a task that decodes it and submits one task per stack, so
+    // decode, distortion and encode of different files overlap; output names
+    // don't depend on the order
+    std::unique_ptr<ShardWriter> shards;
+    if (!shard_prefix.empty()) {
+        shards = std::make_unique<ShardWriter>(shard_prefix, shard_bytes);
+    }
 
-    PrinterStack stack;
-    std::string stack_name;
+    // Encoders run next to the distortion workers; their queue is what lets a
+    // worker move on to the next image before the previous one is compressed
+    AsyncWriter writer(MakeEncoder(codec), CodecExtension(codec.codec),
+                       encoders > 0 ? encoders : std::max<size_t>(1, threads / 2), queue, shards.get());
 
-    for (std::string line; std::getline(noize_config, line);) {
-        if (line.size() > 0 && line[0] == '/') {
-            continue;
-        }
-        if (line.size() > 0 && line != "\n") {
-            std::vector parsed = split(line, " ");
-            if (parsed.size() == 1) {
-                stack_name = parsed[0];
-                continue;
-            }
-            int r_x, r_y, x_lim, y_lim, density;
-            bool black;
-            float intensivity;
-            if (parsed.size() > 7) {
-                r_x = std::stoi(parsed[1]);
-                r_y = std::stoi(parsed[2]);
-                x_lim = std::stoi(parsed[3]);
-                x_lim = std::stoi(parsed[4]);
-                density = std::stoi(parsed[5]);
-                black = parsed[6] == "0" ? false : true;
-                intensivity = std::stof(parsed[7]);
-            }
-            if (parsed[0] == "Line") {
-                if (parsed.size() < 11) {
-                    std::cout << "Warning : " << line << "  //Doesn't satisfy format\n";
-                    continue;
-                }
-                int start = std::stoi(parsed[8]);
-                int end = std::stoi(parsed[9]);
-                int horizontal = parsed[10] ==  "0" ? false : true;
-                bool memory = false;
-                if (parsed.size() > 11) {
-                    memory = parsed[11] ==  "0" ? false : true;
-                }
-                auto p = std::make_unique<LinesPrinter>(r_x, r_y, x_lim, y_lim, density, black, intensivity, start, end, horizontal, memory);
-                stack.AddLayer(std::move(p));
-            }
-            else if (parsed[0] == "Blob") {
-                if (parsed.size() < 12) {
-                    std::cout << "Warning : " << line << "  //Doesn't satisfy format\n";
-                    continue;
-                }
-                int point_x = std::stoi(parsed[8]);
-                int point_y = std::stoi(parsed[9]);
-                int radius_a = std::stoi(parsed[10]);
-                int radius_b = std::stoi(parsed[11]);
-                bool memory = false;
-                if (parsed.size() > 12) {
-                    memory = parsed[12] ==  "0" ? false : true;
-                }
-                auto p = std::make_unique<BlobPrinter>(r_x, r_y, x_lim, y_lim, density, black, intensivity, point_x, point_y, radius_a, radius_b, memory);
-                stack.AddLayer(std::move(p));
-            }
-            else if (parsed[0] == "Sin") {
-                if (parsed.size() < 13) {
-                    std::cout << "Warning : " << line << "  //Doesn't satisfy format\n";
-                    continue;
-                }
-                int start = std::stoi(parsed[8]);
-                int shift = std::stoi(parsed[9]);
-                int amplitude = std::stoi(parsed[10]);
-                float period = std::stof(parsed[11]);
-                int horizontal = parsed[12] ==  "0" ? false : true;
-                bool memory = false;
-                if (parsed.size() > 13) {
-                    memory = parsed[13] ==  "0" ? false : true;
-                }
-                auto p = std::make_unique<SinPrinter>(r_x, r_y, x_lim, y_lim, density, black, intensivity, start, shift, amplitude, period, horizontal, memory);
-                stack.AddLayer(std::move(p));
-            }
-            else if (parsed[0] == "Blur") {
-                if (parsed.size() < 2) {
-                    std::cout << "Warning : " << line << "  //Doesn't satisfy format\n";
-                    continue;
-                }
-                intensivity = std::stof(parsed[1]);
-                auto p = std::make_unique<BlurPrinter>(intensivity);
-                stack.AddLayer(std::move(p));
+    TraceStart(trace_path, stats_seconds, std::cout);
+    ThreadPool pool(threads);
+    Output out{dir_path, stacks, pool, metadata, validator.get(), drop_unreadable, writer, shard,
+               strip_megapixels, codec.quality};
 
-            }        
-        } else {
-            if (fs::is_directory(image_path)) {
-                for (const auto& entry : fs::directory_iterator(image_path)) {
-                    ProcessFile(entry.path(), dir_path, stack, stack_name);
-                }
-            } else if (fs::is_regular_file(image_path)) {
-                ProcessFile(image_path, dir_path, stack, stack_name);
-            } else {
-                std::cout << "Wrong Input\n";
-                return 2;
-            }
-            stack.Clear();
+    if (!generate_config_path.empty()) {
+        std::vector<BarcodeSpec> specs = ParseGenerateConfig(generate_config_path);
+        for (const auto& spec : specs) {
+            pool.Submit([spec, &out] {
+                ProcessBarcode(spec, out);
+            });
+        }
+    } else if (fs::is_directory(image_path)) {
+        for (const auto& entry : fs::directory_iterator(image_path)) {
+            std::string path = entry.path();
+            pool.Submit([path, &out] {
+                ProcessFile(path, out);
+            });
         }
+    } else if (fs::is_regular_file(image_path)) {
+        pool.Submit([&] {
+            ProcessFile(image_path, out);
+        });
+    } else {
+        std::cout << "Wrong Input\n";
+        return 2;
     }
+    pool.Wait();
+    writer.Wait();
+    TraceStop(std::cout);
+    writer.Report(std::cout);
+    if (validator) {
+        validator->Finish();
+    }
+    if (shards) {
+        shards->Close();
+        std::cout << shards->Samples() << " images in " << shards->Shards() << " shards\n";
+    }
+    // Sources that couldn't be decoded or encoded and outputs the writer lost
+    const size_t failed = out.failed + writer.Failed();
+    if (failed > 0) {
+        std::cout << failed << " failed\n";
+        return 1;
+    }
+    return 0;
 }
-
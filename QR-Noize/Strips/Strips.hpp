@@ -0,0 +1,398 @@
+#pragma once
+
+#include <algorithm>
+#include <csetjmp>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+#include <jpeglib.h>
+
+#include <Distortions.hpp>
+#include <Trace.hpp>
+
+// Strip mode of imgen (--strips): a big scan is decoded, distorted and encoded
+// a band of rows at a time, so memory follows the width of the image, not its
+// height. libjpeg hands out the picture an MCU row at a time anyway; every
+// stack then distorts a window of the band widened by its halo (see
+// Modifier::ModifyWindow) and the band's rows go straight to the compressor,
+// which writes to a file as it goes.
+// The whole-image path of imgen reads and writes JPEGs with the same classes
+// (DecodeJpeg, EncodeJpeg), so both give the same bytes. They are set up the
+// way OpenCV sets up libjpeg for imread(IMREAD_GRAYSCALE) and imencode(".jpg").
+
+// Output rows per band; bands grow to 4 halos so windows don't redo too much
+const int MIN_STRIP_ROWS = 256;
+
+// OpenCV's JPEG quality when none is given
+const int DEFAULT_JPEG_QUALITY = 95;
+
+// libjpeg reports fatal errors through error_exit, which must not return:
+// it jumps back to the setjmp of the call that failed, with the message kept
+struct JpegError {
+    jpeg_error_mgr manager;
+    std::jmp_buf jump;
+    char message[JMSG_LENGTH_MAX] = "";
+};
+
+inline void JpegErrorExit(j_common_ptr info) {
+    auto* error = reinterpret_cast<JpegError*>(info->err);
+    info->err->format_message(info, error->message);
+    std::longjmp(error->jump, 1);
+}
+
+// Warnings (a truncated file, say) go to the log instead of stderr
+inline void JpegOutputMessage(j_common_ptr info) {
+    char message[JMSG_LENGTH_MAX];
+    info->err->format_message(info, message);
+    PIPELINE_LOG(LogLevel::Warning, "libjpeg: " << message);
+}
+
+inline jpeg_error_mgr* JpegErrorManager(JpegError& error) {
+    jpeg_error_mgr* manager = jpeg_std_error(&error.manager);
+    manager->error_exit = JpegErrorExit;
+    manager->output_message = JpegOutputMessage;
+    return manager;
+}
+
+// Orientation tag of the EXIF block in the saved APP1 markers, 1 (as stored)
+// if there is none. imread turns the picture by it, which can't be done a band
+// at a time, so such files take the whole-image path.
+inline int ExifOrientation(jpeg_saved_marker_ptr marker) {
+    for (; marker; marker = marker->next) {
+        if (marker->marker != JPEG_APP0 + 1 || marker->data_length < 14 ||
+                std::memcmp(marker->data, "Exif\0\0", 6) != 0) {
+            continue;
+        }
+        const JOCTET* tiff = marker->data + 6;
+        const size_t length = marker->data_length - 6;
+        const bool little = tiff[0] == 'I' && tiff[1] == 'I';
+        if (!little && !(tiff[0] == 'M' && tiff[1] == 'M')) {
+            continue;
+        }
+        auto read = [&](size_t at, int bytes) {
+            uint32_t value = 0;
+            for (int i = 0; i < bytes; ++i) {
+                value |= static_cast<uint32_t>(tiff[at + i]) << (8 * (little ? i : bytes - 1 - i));
+            }
+            return value;
+        };
+        const size_t ifd = read(4, 4);
+        if (ifd + 2 > length) {
+            continue;
+        }
+        const uint32_t entries = read(ifd, 2);
+        for (uint32_t i = 0; i < entries && ifd + 2 + 12 * (i + 1) <= length; ++i) {
+            const size_t entry = ifd + 2 + 12 * i;
+            if (read(entry, 2) == 0x0112) {
+                return static_cast<int>(read(entry + 8, 2));
+            }
+        }
+    }
+    return 1;
+}
+
+// Grayscale rows of a JPEG file, top to bottom
+class JpegStripReader {
+public:
+    JpegStripReader() = default;
+
+    JpegStripReader(const JpegStripReader&) = delete;
+
+    ~JpegStripReader() {
+        if (created) {
+            jpeg_destroy_decompress(&info);
+        }
+        if (file) {
+            std::fclose(file);
+        }
+    }
+
+    // Reads the header; false if libjpeg can't give the file as grayscale
+    // (CMYK, say), Error() tells why. Decoding starts with the first Read.
+    bool Open(const std::string& path) {
+        file = std::fopen(path.c_str(), "rb");
+        if (!file) {
+            std::snprintf(error.message, sizeof(error.message), "can't open the file");
+            return false;
+        }
+        info.err = JpegErrorManager(error);
+        if (setjmp(error.jump)) {
+            return false;
+        }
+        jpeg_create_decompress(&info);
+        created = true;
+        jpeg_stdio_src(&info, file);
+        jpeg_save_markers(&info, JPEG_APP0 + 1, 0xffff);
+        jpeg_read_header(&info, TRUE);
+        if (info.jpeg_color_space == JCS_CMYK || info.jpeg_color_space == JCS_YCCK) {
+            std::snprintf(error.message, sizeof(error.message), "CMYK can't be decoded as grayscale");
+            return false;
+        }
+        orientation = ExifOrientation(info.marker_list);
+        info.out_color_space = JCS_GRAYSCALE;
+        info.out_color_components = 1;
+        return true;
+    }
+
+    int Rows() const { return static_cast<int>(info.image_height); }
+
+    int Cols() const { return static_cast<int>(info.image_width); }
+
+    int Orientation() const { return orientation; }
+
+    // Progressive and other multi-scan files: libjpeg keeps the coefficients of
+    // the whole picture to decode them, so they gain nothing from strips
+    bool MultiScan() {
+        if (setjmp(error.jump)) {
+            return true;
+        }
+        return jpeg_has_multiple_scans(&info);
+    }
+
+    const char* Error() const { return error.message; }
+
+    // Decodes the next `count` rows into rows first, first + 1, ... of `buffer`
+    bool Read(Mat& buffer, int first, int count) {
+        if (setjmp(error.jump)) {
+            return false;
+        }
+        if (!started) {
+            jpeg_start_decompress(&info);
+            started = true;
+        }
+        for (int y = first; y < first + count;) {
+            JSAMPROW rows[16];
+            const int batch = std::min(first + count - y, 16);
+            for (int i = 0; i < batch; ++i) {
+                rows[i] = buffer.ptr<uchar>(y + i);
+            }
+            const JDIMENSION read = jpeg_read_scanlines(&info, rows, batch);
+            if (read == 0) {
+                std::snprintf(error.message, sizeof(error.message), "no more rows");
+                return false;
+            }
+            y += static_cast<int>(read);
+        }
+        return true;
+    }
+
+private:
+    jpeg_decompress_struct info{};
+    JpegError error;
+    std::FILE* file = nullptr;
+    bool created = false;
+    bool started = false;
+    int orientation = 1;
+};
+
+// libjpeg destination that compresses straight into a vector: it doubles when
+// full and is cut to the bytes written at the end, so the caller takes it over
+// as is instead of copying it out of a libjpeg buffer
+struct JpegVectorDestination {
+    jpeg_destination_mgr manager;
+    std::vector<uint8_t> bytes;
+
+    static JpegVectorDestination& Of(j_compress_ptr info) {
+        return *reinterpret_cast<JpegVectorDestination*>(info->dest);
+    }
+
+    static void Init(j_compress_ptr info) {
+        JpegVectorDestination& destination = Of(info);
+        destination.bytes.resize(64 * 1024);
+        destination.manager.next_output_byte = destination.bytes.data();
+        destination.manager.free_in_buffer = destination.bytes.size();
+    }
+
+    // Called when the whole vector is full
+    static boolean Grow(j_compress_ptr info) {
+        JpegVectorDestination& destination = Of(info);
+        const size_t used = destination.bytes.size();
+        destination.bytes.resize(used * 2);
+        destination.manager.next_output_byte = destination.bytes.data() + used;
+        destination.manager.free_in_buffer = destination.bytes.size() - used;
+        return TRUE;
+    }
+
+    static void Term(j_compress_ptr info) {
+        JpegVectorDestination& destination = Of(info);
+        destination.bytes.resize(destination.bytes.size() - destination.manager.free_in_buffer);
+    }
+};
+
+// Grayscale JPEG compressed as rows come in, into a file or into memory
+class JpegStripWriter {
+public:
+    JpegStripWriter() = default;
+
+    JpegStripWriter(const JpegStripWriter&) = delete;
+
+    ~JpegStripWriter() {
+        if (created) {
+            jpeg_destroy_compress(&info);
+        }
+    }
+
+    // quality -1 - OpenCV's default. With a `file` (the caller closes it) only
+    // libjpeg's buffer is kept, without one the whole JPEG goes to memory.
+    bool Start(int rows, int cols, int quality, std::FILE* file = nullptr) {
+        info.err = JpegErrorManager(error);
+        if (setjmp(error.jump)) {
+            return false;
+        }
+        jpeg_create_compress(&info);
+        created = true;
+        if (file) {
+            jpeg_stdio_dest(&info, file);
+        } else {
+            destination.manager.init_destination = JpegVectorDestination::Init;
+            destination.manager.empty_output_buffer = JpegVectorDestination::Grow;
+            destination.manager.term_destination = JpegVectorDestination::Term;
+            info.dest = &destination.manager;
+        }
+        info.image_width = static_cast<JDIMENSION>(cols);
+        info.image_height = static_cast<JDIMENSION>(rows);
+        info.input_components = 1;
+        info.in_color_space = JCS_GRAYSCALE;
+        jpeg_set_defaults(&info);
+        jpeg_set_quality(&info, quality >= 0 ? quality : DEFAULT_JPEG_QUALITY, TRUE);
+        jpeg_start_compress(&info, TRUE);
+        return true;
+    }
+
+    // Next rows of the picture, all columns
+    bool Write(const Mat& rows) {
+        if (setjmp(error.jump)) {
+            return false;
+        }
+        for (int y = 0; y < rows.rows; ++y) {
+            JSAMPROW row = const_cast<uchar*>(rows.ptr<uchar>(y));
+            jpeg_write_scanlines(&info, &row, 1);
+        }
+        return true;
+    }
+
+    // Once every row is written; flushes the file, false if it couldn't be written
+    bool Finish() {
+        if (setjmp(error.jump)) {
+            return false;
+        }
+        jpeg_finish_compress(&info);
+        return true;
+    }
+
+    // Same into memory: the compressed bytes are moved into `encoded`
+    bool Finish(std::vector<uint8_t>& encoded) {
+        if (!Finish()) {
+            return false;
+        }
+        encoded = std::move(destination.bytes);
+        return true;
+    }
+
+    const char* Error() const { return error.message; }
+
+private:
+    jpeg_compress_struct info{};
+    JpegError error;
+    JpegVectorDestination destination{};
+    bool created = false;
+};
+
+// Runs every stack over the file behind `reader` and writes the JPEG of
+// stacks[k] to outputs[k]. The source lives in a buffer of one band plus the
+// largest halo on both sides; every band, each stack copies out the rows its
+// own halo needs, distorts them and hands the band's rows, now final, to its
+// encoder, which writes them out. Memory is about two such buffers and
+// libjpeg's working state per stack, whatever the height of the image. The
+// reader must not be MultiScan.
+// On failure the outputs hold part of a JPEG.
+inline bool DistortStrips(JpegStripReader& reader, const std::vector<const PrinterStack*>& stacks, uint64_t sample,
+                          int quality, const std::vector<std::FILE*>& outputs, std::string& error) {
+    const Size size(reader.Cols(), reader.Rows());
+    std::vector<int> halo(stacks.size());
+    int max_halo = 0;
+    for (size_t k = 0; k < stacks.size(); ++k) {
+        halo[k] = stacks[k]->HaloRows(size);
+        max_halo = std::max(max_halo, halo[k]);
+    }
+    const int band = std::max(MIN_STRIP_ROWS, 4 * max_halo);
+
+    std::vector<std::unique_ptr<JpegStripWriter>> writers;
+    for (size_t k = 0; k < stacks.size(); ++k) {
+        writers.push_back(std::make_unique<JpegStripWriter>());
+        if (!writers.back()->Start(size.height, size.width, quality, outputs[k])) {
+            error = writers.back()->Error();
+            return false;
+        }
+    }
+
+    // Source rows [base, base + filled)
+    Mat source(std::min(band + 2 * max_halo, size.height), size.width, CV_8U);
+    int base = 0;
+    int filled = 0;
+    Mat window;
+    for (int first = 0; first < size.height; first += band) {
+        const int last = std::min(first + band, size.height);
+        // Rows above every window of this band are dropped, the ones below decoded
+        const int keep = std::max(first - max_halo, 0) - base;
+        if (keep > 0) {
+            std::memmove(source.ptr<uchar>(0), source.ptr<uchar>(keep), static_cast<size_t>(filled - keep) * source.step);
+            base += keep;
+            filled -= keep;
+        }
+        const int need = std::min(last + max_halo, size.height) - base;
+        if (filled < need) {
+            TRACE_SCOPE("decode");
+            if (!reader.Read(source, filled, need - filled)) {
+                error = reader.Error();
+                return false;
+            }
+            filled = need;
+        }
+
+        for (size_t k = 0; k < stacks.size(); ++k) {
+            const int from = std::max(first - halo[k], 0);
+            const int to = std::min(last + halo[k], size.height);
+            {
+                TRACE_SCOPE("distort");
+                source.rowRange(from - base, to - base).copyTo(window);
+                stacks[k]->ProcessWindow(window, from, size, sample);
+            }
+            TRACE_SCOPE("encode");
+            if (!writers[k]->Write(window.rowRange(first - from, last - from))) {
+                error = writers[k]->Error();
+                return false;
+            }
+        }
+    }
+
+    for (size_t k = 0; k < stacks.size(); ++k) {
+        if (!writers[k]->Finish()) {
+            error = writers[k]->Error();
+            return false;
+        }
+    }
+    return true;
+}
+
+// Whole-image decode through the same reader as DistortStrips; false if the
+// file is better left to imread (turned by EXIF, not for libjpeg alone)
+inline bool DecodeJpeg(const std::string& path, Mat& image) {
+    JpegStripReader reader;
+    if (!reader.Open(path) || reader.Orientation() != 1) {
+        return false;
+    }
+    image.create(reader.Rows(), reader.Cols(), CV_8U);
+    return reader.Read(image, 0, image.rows);
+}
+
+// Whole-image encode of a grayscale image, byte for byte what DistortStrips writes
+inline bool EncodeJpeg(const Mat& image, int quality, std::vector<uint8_t>& encoded) {
+    JpegStripWriter writer;
+    return writer.Start(image.rows, image.cols, quality) && writer.Write(image) && writer.Finish(encoded);
+}
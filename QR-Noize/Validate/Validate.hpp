@@ -0,0 +1,126 @@
+#pragma once
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+
+#include <opencv2/opencv.hpp>
+
+#ifdef IMGEN_HAS_ZXING
+#include <ZXing/ReadBarcode.h>
+#endif
+
+inline std::string JsonEscape(const std::string& text) {
+    std::string out;
+    out.reserve(text.size());
+    for (unsigned char c : text) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += static_cast<char>(c);
+        } else if (c < 0x20) {
+            char escaped[8];
+            std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            out += escaped;
+        } else {
+            out += static_cast<char>(c);
+        }
+    }
+    return out;
+}
+
+#ifdef IMGEN_HAS_ZXING
+
+// Text of the first barcode found in a grayscale image, "unknown" if there is none
+// (the same convention validate.py used)
+inline std::string DecodeBarcode(const cv::Mat& image) {
+    ZXing::ImageView view(image.data, image.cols, image.rows, ZXing::ImageFormat::Lum, static_cast<int>(image.step));
+    auto results = ZXing::ReadBarcodes(view);
+    return results.empty() ? "unknown" : results.front().text();
+}
+
+#endif
+
+// In-process replacement of validate.py: distorted images are decoded right
+// after their stack ran, on the worker that made them, and the results are
+// streamed into validation.json (same {"file": "text"} object as before).
+// Per-stack success rate and decode time go to validation_stats.json.
+class Validator {
+public:
+    explicit Validator(const std::string& dir_path) :
+            dir_path(dir_path), index(dir_path + "/validation.json") {
+        index << "{";
+    }
+
+    Validator(const Validator&) = delete;
+
+    ~Validator() {
+        Finish();
+    }
+
+#ifdef IMGEN_HAS_ZXING
+    // Returns whether the barcode could be read. Unreadable images that are
+    // dropped aren't written, so they only count in the statistics.
+    bool Validate(const std::string& file, const std::string& stack, const cv::Mat& image, bool drop_unreadable = false) {
+        auto start = std::chrono::steady_clock::now();
+        std::string text = DecodeBarcode(image);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        const bool readable = text != "unknown";
+        Record(file, stack, text, readable, seconds, readable || !drop_unreadable);
+        return readable;
+    }
+#endif
+
+    void Record(const std::string& file, const std::string& stack, const std::string& text, bool readable, double seconds, bool written) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (written) {
+            index << (first ? "" : ", ") << '"' << JsonEscape(file) << "\": \"" << JsonEscape(text) << '"';
+            first = false;
+        }
+        Stats& entry = stats[stack];
+        ++entry.images;
+        entry.readable += readable ? 1 : 0;
+        entry.seconds += seconds;
+    }
+
+    void Finish() {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (finished) {
+            return;
+        }
+        finished = true;
+        index << "}";
+        index.close();
+
+        std::ofstream out(dir_path + "/validation_stats.json");
+        out << "{";
+        bool first_stack = true;
+        for (const auto& [stack, entry] : stats) {
+            const double rate = entry.images > 0 ? static_cast<double>(entry.readable) / entry.images : 0;
+            const double ms = entry.images > 0 ? entry.seconds * 1000 / entry.images : 0;
+            out << (first_stack ? "" : ", ") << '"' << JsonEscape(stack) << "\": {\"images\": " << entry.images
+                << ", \"readable\": " << entry.readable << ", \"rate\": " << rate << ", \"decode_ms\": " << ms << "}";
+            first_stack = false;
+            std::cout << stack << " : " << entry.readable << "/" << entry.images << " readable, "
+                      << ms << " ms per decode\n";
+        }
+        out << "}\n";
+    }
+
+private:
+    struct Stats {
+        size_t images = 0;
+        size_t readable = 0;
+        double seconds = 0;
+    };
+
+    std::string dir_path;
+    std::ofstream index;
+    std::mutex mutex;
+    bool first = true;
+    bool finished = false;
+    std::map<std::string, Stats> stats;
+};
@@ -0,0 +1,420 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Distortions.hpp"
+#include "NoizeConfig.hpp"
+#include "Optics.hpp"
+#ifdef IMGEN_HAS_JPEG
+#include "Strips.hpp"
+#endif
+
+// Equivalence checks behind the fast paths, to re-run whenever they change:
+// - printer kernels (SIMD rows, period tiles, span rasterization) against a
+//   per-pixel reference of the shapes in Distortions/README.md;
+// - box and motion blurs against naive loops with the same rounding, defocus
+//   against a naive sum over its staircase disk;
+// - PrinterStack::ProcessWindow over bands of rows with their halos against
+//   ProcessImage on the whole image, for every stack of a noize config and a
+//   few optics stacks;
+// - with libjpeg, DistortStrips against the whole-image path of imgen (same
+//   decoder and encoder), byte for byte.
+// Prints every mismatch and exits with 1 if there was any.
+//
+//   ./build/verify [--noize-config path]
+
+static int failures = 0;
+
+static void Check(bool ok, const std::string& what) {
+    if (!ok) {
+        ++failures;
+        std::cout << "FAIL " << what << '\n';
+    }
+}
+
+static bool Same(const Mat& a, const Mat& b) {
+    if (a.rows != b.rows || a.cols != b.cols) {
+        return false;
+    }
+    for (int y = 0; y < a.rows; ++y) {
+        if (std::memcmp(a.ptr<uchar>(y), b.ptr<uchar>(y), a.cols) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Gradient with noise, so blurs and saturating printers both have something to do
+static Mat MakeSource(int rows, int cols) {
+    Mat image(rows, cols, CV_8UC1);
+    for (int y = 0; y < rows; ++y) {
+        uchar* row = image.ptr<uchar>(y);
+        for (int x = 0; x < cols; ++x) {
+            row[x] = static_cast<uchar>((x * 7 + y * 3 + MixSeed((static_cast<uint64_t>(y) << 32) | x) % 64) & 255);
+        }
+    }
+    return image;
+}
+
+static std::string SizeName(const Mat& image) {
+    return std::to_string(image.rows) + "x" + std::to_string(image.cols);
+}
+
+// Printers
+
+struct PrinterParams {
+    int radius_x, radius_y, x_lim, y_lim, density;
+    bool black;
+    float intensivity;
+    bool use_memory;
+};
+
+// Covered(px, py): whether the shape covers a pixel of the period
+using Shape = std::function<bool(int, int)>;
+
+// One draw per covered pixel: per image and pixel, or with use_memory per
+// period cell and the same on every image
+static void ReferencePrinter(Mat& image, const PrinterParams& p, int limit, const Shape& covered,
+                             uint64_t seed, uint64_t layer, uint64_t sample) {
+    const uint64_t key = CombineSeed(seed, layer) | 1;
+    const uint64_t image_key = CombineSeed(key, sample) | 1;
+    const bool memory = p.use_memory && (p.radius_x != 0 || p.radius_y != 0);
+    const int rows = p.x_lim <= 0 || p.x_lim >= image.rows ? image.rows : p.x_lim + 1;
+    const int cols = p.y_lim <= 0 || p.y_lim >= image.cols ? image.cols : p.y_lim + 1;
+    const int change = static_cast<int>(static_cast<float>(p.black ? -255 : 255) * p.intensivity);
+    const int magnitude = std::min(std::abs(change), MAX_INTENSIVITY);
+    for (int x = 0; x < rows; ++x) {
+        for (int y = 0; y < cols; ++y) {
+            const int px = p.radius_x >= 1 ? x % p.radius_x : x;
+            const int py = p.radius_y >= 1 ? y % p.radius_y : y;
+            const int draw = memory ? PixelNoise{key, px, py}.Percent() : PixelNoise{image_key, x, y}.Percent();
+            if (covered(px, py) && draw < limit) {
+                uchar& pixel = image.ptr<uchar>(x)[y];
+                pixel = static_cast<uchar>(std::clamp(change < 0 ? pixel - magnitude : pixel + magnitude,
+                                                      MIN_INTENSIVITY, MAX_INTENSIVITY));
+            }
+        }
+    }
+}
+
+static void CheckPrinter(const std::string& name, Modifier& printer, const PrinterParams& p, int limit,
+                         const Shape& covered, const Mat& source) {
+    for (uint64_t sample : {0, 7}) {
+        Mat fast = source.clone();
+        Mat reference = source.clone();
+        printer.SetSeed(3, 2);
+        printer.ModifyImage(fast, sample);
+        ReferencePrinter(reference, p, limit, covered, 3, 2, sample);
+        Check(Same(fast, reference), name + " " + SizeName(source) + " sample " + std::to_string(sample));
+    }
+}
+
+static void CheckPrinters(const Mat& source) {
+    const std::vector<PrinterParams> variants = {
+        {0, 0, 0, 0, 80, false, 0.8f, false},
+        {10, 0, 100, 50, 10, false, 0.8f, false},
+        {0, 25, 0, 0, 60, true, 1, true},
+        {13, 17, 0, 0, 70, true, 0.5f, true},
+        {9, 0, 150, 0, 90, false, 1, true},
+    };
+    for (const auto& p : variants) {
+        const std::string suffix = " r " + std::to_string(p.radius_x) + "," + std::to_string(p.radius_y) +
+                                   (p.use_memory ? " memory" : "");
+        for (bool horizontal : {false, true}) {
+            const int start = 3;
+            const int end = 11;
+            LinesPrinter line(p.radius_x, p.radius_y, p.x_lim, p.y_lim, p.density, p.black, p.intensivity,
+                              start, end, horizontal, p.use_memory);
+            CheckPrinter("Line" + suffix, line, p, p.density, [=](int px, int py) {
+                const int t = horizontal ? px : py;
+                return t >= start && t <= end;
+            }, source);
+
+            const int sin_start = 5;
+            const int shift = 3;
+            const float period = 5.5f;
+            for (int amplitude : {20, -20}) {
+                SinPrinter sin_printer(p.radius_x, p.radius_y, p.x_lim, p.y_lim, p.density, p.black, p.intensivity,
+                                       sin_start, shift, amplitude, period, horizontal, p.use_memory);
+                auto envelope = [=](int t) { return std::abs(sin(static_cast<float>(t - shift) / period)) * amplitude; };
+                CheckPrinter("Sin" + suffix, sin_printer, p, p.density, [=](int px, int py) {
+                    if (!horizontal) {
+                        const int k = py - sin_start;
+                        return k >= 1 && envelope(px) > k;
+                    }
+                    const int height = px - sin_start;
+                    return height >= 1 && height < std::abs(amplitude) && envelope(py) > height;
+                }, source);
+            }
+        }
+        for (int radius_b : {0, 9, 40}) {
+            const int point_x = 20;
+            const int point_y = 13;
+            const int radius_a = 11;
+            BlobPrinter blob(p.radius_x, p.radius_y, p.x_lim, p.y_lim, p.density, p.black, p.intensivity,
+                             point_x, point_y, radius_a, radius_b, p.use_memory);
+            CheckPrinter("Blob" + suffix, blob, p, p.density + 1, [=](int px, int py) {
+                const int64_t a_pow = static_cast<int64_t>(radius_a) * radius_a;
+                const int64_t b_pow = static_cast<int64_t>(radius_b) * radius_b;
+                const int64_t dx = px - point_x;
+                const int64_t dy = py - point_y;
+                return dx * dx * b_pow + dy * dy * a_pow < a_pow * b_pow;
+            }, source);
+        }
+    }
+}
+
+// Optics
+
+// Mean of 2 * radius + 1 values of a line with replicated ends
+static uchar ReferenceMean(const std::vector<uchar>& line, int i, int radius) {
+    int64_t sum = 0;
+    for (int d = -radius; d <= radius; ++d) {
+        sum += line[std::clamp(i + d, 0, static_cast<int>(line.size()) - 1)];
+    }
+    return WindowMean(2 * radius + 1)(sum);
+}
+
+static void CheckBoxes(const Mat& source) {
+    for (int radius : {1, 4, 15}) {
+        Mat fast = source.clone();
+        BoxHorizontal(fast, radius);
+        BoxVertical(fast, radius);
+
+        Mat reference = source.clone();
+        for (int y = 0; y < source.rows; ++y) {
+            std::vector<uchar> line(source.ptr<uchar>(y), source.ptr<uchar>(y) + source.cols);
+            for (int x = 0; x < source.cols; ++x) {
+                reference.ptr<uchar>(y)[x] = ReferenceMean(line, x, radius);
+            }
+        }
+        const Mat horizontal = reference.clone();
+        for (int x = 0; x < source.cols; ++x) {
+            std::vector<uchar> line(source.rows);
+            for (int y = 0; y < source.rows; ++y) {
+                line[y] = horizontal.ptr<uchar>(y)[x];
+            }
+            for (int y = 0; y < source.rows; ++y) {
+                reference.ptr<uchar>(y)[x] = ReferenceMean(line, y, radius);
+            }
+        }
+        Check(Same(fast, reference), "Box r " + std::to_string(radius) + " " + SizeName(source));
+    }
+}
+
+// Every digital line at the motion angle is collected pixel by pixel and averaged
+static void CheckMotion(const Mat& source) {
+    for (float angle : {0.0f, 20.0f, 45.0f, 75.0f, 90.0f, -110.0f}) {
+        const float length = 0.05f;
+        Mat fast = source.clone();
+        MotionBlur(length, angle).ModifyImage(fast, 0);
+
+        const double radians = angle * CV_PI / 180.0;
+        const double dx = std::cos(radians);
+        const double dy = std::sin(radians);
+        const bool along_rows = std::abs(dx) >= std::abs(dy);
+        const double steps = RelativeSize(source.size(), length) * (along_rows ? std::abs(dx) : std::abs(dy));
+        const int radius = static_cast<int>(std::lround(steps)) / 2;
+        const double slope = along_rows ? dy / dx : dx / dy;
+        const int major_count = along_rows ? source.cols : source.rows;
+        const int minor_count = along_rows ? source.rows : source.cols;
+        auto at = [&](Mat& image, int major, int minor) -> uchar& {
+            return along_rows ? image.ptr<uchar>(minor)[major] : image.ptr<uchar>(major)[minor];
+        };
+
+        Mat reference = source.clone();
+        Mat original = source.clone();
+        for (int m = -2 * major_count; radius > 0 && m < minor_count + 2 * major_count; ++m) {
+            std::vector<int> majors;
+            std::vector<uchar> line;
+            for (int i = 0; i < major_count; ++i) {
+                const int minor = m + static_cast<int>(std::lround(i * slope));
+                if (minor >= 0 && minor < minor_count) {
+                    majors.push_back(i);
+                    line.push_back(at(original, i, minor));
+                }
+            }
+            if (line.size() < 2) {
+                continue;
+            }
+            for (size_t k = 0; k < line.size(); ++k) {
+                const int i = majors[k];
+                at(reference, i, m + static_cast<int>(std::lround(i * slope))) = ReferenceMean(line, static_cast<int>(k), radius);
+            }
+        }
+        Check(Same(fast, reference), "Motion " + std::to_string(angle) + " " + SizeName(source));
+    }
+}
+
+static void CheckDefocus(const Mat& source) {
+    for (float fraction : {0.01f, 0.03f, 0.1f}) {
+        Mat fast = source.clone();
+        DefocusBlur(fraction).ModifyImage(fast, 0);
+
+        const int r = RelativeSize(source.size(), fraction);
+        const std::vector<DefocusBlur::Step> steps = DefocusBlur::Steps(r);
+        Mat reference = source.clone();
+        for (int y = 0; r > 0 && y < source.rows; ++y) {
+            for (int x = 0; x < source.cols; ++x) {
+                int64_t sum = 0;
+                int area = 0;
+                for (int d = -r; d <= r; ++d) {
+                    // Width of the staircase at row d: that of the first step reaching it
+                    int w = 0;
+                    for (const auto& step : steps) {
+                        if (step.height >= std::abs(d)) {
+                            w = step.width;
+                            break;
+                        }
+                    }
+                    const uchar* row = source.ptr<uchar>(std::clamp(y + d, 0, source.rows - 1));
+                    for (int c = x - w; c <= x + w; ++c) {
+                        sum += row[std::clamp(c, 0, source.cols - 1)];
+                    }
+                    area += 2 * w + 1;
+                }
+                reference.ptr<uchar>(y)[x] = WindowMean(area)(sum);
+            }
+        }
+        Check(Same(fast, reference), "Defocus " + std::to_string(fraction) + " " + SizeName(source));
+    }
+}
+
+// Windows and strips
+
+// The stack run band by band, every band from a window widened by the stack's
+// halo, the way DistortStrips cuts an image
+static void CheckWindows(const std::string& name, const PrinterStack& stack, const Mat& source) {
+    const uint64_t sample = 42;
+    Mat whole = source.clone();
+    stack.ProcessImage(whole, sample);
+    const int halo = stack.HaloRows(source.size());
+    for (int band : {1, 7, 64}) {
+        Mat banded = source.clone();
+        Mat window;
+        for (int first = 0; first < source.rows; first += band) {
+            const int last = std::min(first + band, source.rows);
+            const int from = std::max(first - halo, 0);
+            const int to = std::min(last + halo, source.rows);
+            source.rowRange(from, to).copyTo(window);
+            stack.ProcessWindow(window, from, source.size(), sample);
+            Mat rows = banded.rowRange(first, last);
+            window.rowRange(first - from, last - from).copyTo(rows);
+        }
+        Check(Same(whole, banded), "ProcessWindow " + name + " " + SizeName(source) + " band " + std::to_string(band));
+    }
+}
+
+#ifdef IMGEN_HAS_JPEG
+// Everything written to a file so far
+static std::vector<uint8_t> ReadBack(std::FILE* file) {
+    std::vector<uint8_t> bytes;
+    std::rewind(file);
+    uint8_t chunk[4096];
+    for (size_t read; (read = std::fread(chunk, 1, sizeof(chunk), file)) > 0;) {
+        bytes.insert(bytes.end(), chunk, chunk + read);
+    }
+    return bytes;
+}
+
+// DistortStrips against the whole-image path of imgen: DecodeJpeg, ProcessImage
+// and EncodeJpeg, the functions ProcessFile and the jpg encoder use
+static void CheckStrips(const std::vector<NamedStack>& stacks, const Mat& source) {
+    const std::string path = (std::filesystem::temp_directory_path() / "imgen_verify.jpg").string();
+    std::vector<uint8_t> encoded;
+    if (!EncodeJpeg(source, 90, encoded)) {
+        Check(false, "encode source");
+        return;
+    }
+    std::ofstream(path, std::ios::binary).write(reinterpret_cast<const char*>(encoded.data()), encoded.size());
+    Mat decoded;
+    if (!DecodeJpeg(path, decoded)) {
+        Check(false, "decode source");
+        return;
+    }
+
+    std::vector<const PrinterStack*> pointers;
+    std::vector<std::FILE*> outputs;
+    for (const auto& named : stacks) {
+        pointers.push_back(named.stack.get());
+        outputs.push_back(std::tmpfile());
+    }
+    const uint64_t sample = 42;
+    JpegStripReader reader;
+    std::string error;
+    if (!reader.Open(path) || !DistortStrips(reader, pointers, sample, -1, outputs, error)) {
+        Check(false, "DistortStrips : " + error + reader.Error());
+    } else {
+        for (size_t k = 0; k < stacks.size(); ++k) {
+            Mat image = decoded.clone();
+            stacks[k].stack->ProcessImage(image, sample);
+            std::vector<uint8_t> whole;
+            Check(EncodeJpeg(image, -1, whole) && whole == ReadBack(outputs[k]),
+                  "DistortStrips " + stacks[k].name + " " + SizeName(source));
+        }
+    }
+    for (std::FILE* output : outputs) {
+        std::fclose(output);
+    }
+    std::filesystem::remove(path);
+}
+#endif
+
+int main(int argc, char** argv) {
+    std::string noize_config = IMGEN_SOURCE_DIR "/noize.config";
+    for (int i = 1; i < argc; ++i) {
+        if (std::string(argv[i]) == "--noize-config" && i + 1 < argc) {
+            noize_config = argv[++i];
+        } else {
+            std::cerr << "Unknown argument : " << argv[i] << '\n';
+            return 1;
+        }
+    }
+
+    // Square at the size noize.config is tuned for, both elongations, and one
+    // taller than MAX_TILE_ROWS for printers that repeat only across columns
+    const std::vector<Mat> sources = {MakeSource(227, 227), MakeSource(300, 517), MakeSource(517, 300)};
+    for (const auto& source : sources) {
+        CheckPrinters(source);
+        CheckBoxes(source);
+        CheckMotion(source);
+        CheckDefocus(source);
+    }
+    CheckPrinters(MakeSource(MAX_TILE_ROWS + 100, 40));
+
+    std::vector<NamedStack> stacks = ParseNoizeConfig(noize_config);
+    const std::vector<std::vector<std::string>> optics = {
+        {"Noise 3 0.05", "Gauss 0.01", "Line 0 15 0 0 80 0 1 0 1 0 1"},
+        {"Motion 0.05 20", "Blur 0.02"},
+        {"Sin 0 0 0 0 60 1 1 100 3 20 5.5 0 0", "Motion 0.04 75", "Noise 1 0.2"},
+        {"Motion 0.03 -110", "Defocus 0.01"},
+        {"Defocus 0.012", "Gauss 0.006", "Blur 0.01", "Motion 0.02 33"},
+    };
+    for (size_t i = 0; i < optics.size(); ++i) {
+        auto stack = std::make_shared<PrinterStack>(StackSeed(0, "optics_" + std::to_string(i)));
+        for (const auto& line : optics[i]) {
+            stack->AddLayer(ParseLayer(split(line, " ")));
+        }
+        stacks.push_back({"optics_" + std::to_string(i), stack});
+    }
+    for (const auto& named : stacks) {
+        for (const auto& source : sources) {
+            CheckWindows(named.name, *named.stack, source);
+        }
+    }
+#ifdef IMGEN_HAS_JPEG
+    CheckStrips(stacks, MakeSource(900, 700));
+#endif
+
+    std::cout << (failures == 0 ? "All checks passed\n" : std::to_string(failures) + " checks failed\n");
+    return failures == 0 ? 0 : 1;
+}
@@ -6,9 +6,13 @@
 # 3) Путь к месту для зашумленных картинок
 # 4) Путь к кофигу зашумления
 # По пути из 3 аргумента будет создано множество картиинок + файл с запуском валидации на них (validation.json)
+# Остальные аргументы передаются imgen как есть (например, --shard 0/4 --seed 7)
 
-python3 Generate/generate.py $1 $2
-
-./build/imgen $2 $3 $4
-
-python3 Validate/validate.py $3
\ No newline at end of file
+# Штрих-коды кодируются прямо в imgen (нужен zxing-cpp), без treepoem и промежуточных jpg,
+# и там же, до записи, проверяются на читаемость (validation.json и validation_stats.json).
+# Если imgen собран без zxing-cpp - старый путь через generate.py, папку из 2 аргумента и validate.py
+if ! ./build/imgen --generate $1 $3 $4 --validate "${@:5}"; then
+    python3 Generate/generate.py $1 $2
+    ./build/imgen $2 $3 $4 "${@:5}"
+    python3 Validate/validate.py $3
+fi
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <vtkImageData.h>
+#include <vtkJPEGWriter.h>
+#include <vtkNew.h>
+#include <vtkPNGWriter.h>
+#include <vtkPointData.h>
+#include <vtkUnsignedCharArray.h>
+#include <cstdint>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "Annotation.hpp"
+#include "AsyncWriter.hpp"
+#include "Manifest.hpp"
+#include "Projector.hpp"
+#include "Scene.hpp"
+#include "Trace.hpp"
+
+// Кодировщик для AsyncWriter: PNG и JPEG пишут писатели VTK (у каждого потока свой),
+// QOI и raw кодируются без VTK
+inline AsyncWriter::Encoder makeEncoder(const CodecOptions& codec) {
+    return [codec](const EncodeImage& image, std::vector<uint8_t>& out) {
+        if (codec.codec == Codec::Qoi) {
+            EncodeQoi(image, out);
+            return true;
+        }
+        if (codec.codec == Codec::Raw) {
+            EncodeRaw(image, out);
+            return true;
+        }
+        // Кадр оборачивается в vtkImageData без копирования; строки в нем уже снизу вверх
+        thread_local vtkNew<vtkUnsignedCharArray> pixels;
+        thread_local vtkNew<vtkImageData> frame;
+        pixels->SetNumberOfComponents(image.channels);
+        pixels->SetArray(const_cast<uint8_t*>(image.pixels.data()), static_cast<vtkIdType>(image.pixels.size()), 1);
+        frame->SetDimensions(image.width, image.height, 1);
+        frame->GetPointData()->SetScalars(pixels);
+        pixels->Modified();
+        frame->Modified();
+
+        vtkUnsignedCharArray* result;
+        if (codec.codec == Codec::Jpeg) {
+            thread_local vtkNew<vtkJPEGWriter> jpegWriter;
+            jpegWriter->WriteToMemoryOn();
+            if (codec.quality >= 0) {
+                jpegWriter->SetQuality(codec.quality);
+            }
+            jpegWriter->SetInputData(frame);
+            jpegWriter->Write();
+            result = jpegWriter->GetResult();
+        } else {
+            thread_local vtkNew<vtkPNGWriter> pngWriter;
+            pngWriter->WriteToMemoryOn();
+            if (codec.level >= 0) {
+                pngWriter->SetCompressionLevel(codec.level);
+            }
+            pngWriter->SetInputData(frame);
+            pngWriter->Write();
+            result = pngWriter->GetResult();
+        }
+        if (!result) {
+            return false;
+        }
+        out.assign(result->GetPointer(0), result->GetPointer(0) + result->GetNumberOfValues());
+        return true;
+    };
+}
+
+inline std::vector<std::string> split(const std::string& s, char delimiter) {
+    std::vector<std::string> tokens;
+    std::string token;
+    std::istringstream tokenStream(s);
+
+    while (std::getline(tokenStream, token, delimiter)) {
+        tokens.push_back(token);
+    }
+
+    return tokens;
+}
+
+// Рендерит один сэмпл на уже собранной сцене и отдает кадр с аннотацией писателю:
+// <ключ>.<кодек> + <ключ>.json в data/ или в шард. Кодирование и запись идут в фоне.
+// barcodeImage — штрих-код из памяти вместо файла, см. Scene::Render
+inline bool renderSample(Scene& scene, AsyncWriter& writer, const Sample& sample, const AnnotationOptions& annotation,
+                         vtkImageData* barcodeImage = nullptr) {
+    if (!scene.Render(sample, barcodeImage)) {
+        return false;
+    }
+
+    // Get 3D points corresponding to the barcode corners (and the keypoint grid)
+    std::vector<float> points;
+    std::vector<uint8_t> found;
+    {
+        TRACE_SCOPE("uv lookup");
+        std::vector<float> uvs = get_barcode_uv_keypoints(scene.GetBarcodeBox(), annotation.grid);
+        get_uv_3d_points(scene.GetUVIndex(), uvs, points, found);
+    }
+
+    // Transform these points to 2D screen coordinates in one pass with the frame's MVP
+    const size_t count = found.size();
+    std::vector<float> xy(count * 2);
+    std::vector<float> depth(count);
+    std::vector<uint8_t> visible(count);
+    DepthView zbuffer;
+    if (annotation.occlusion) {
+        zbuffer = scene.CaptureDepth();
+    }
+    {
+        TRACE_SCOPE("project");
+        Projector projector(scene.GetModelViewProjection(), scene.GetWidth(), scene.GetHeight());
+        projector.Project(points.data(), count, xy.data(), depth.data());
+        projector.Visibility(xy.data(), depth.data(), count, annotation.occlusion ? &zbuffer : nullptr,
+                             annotation.depthBias, visible.data());
+        for (size_t i = 0; i < count; ++i) {
+            visible[i] &= found[i];
+        }
+    }
+
+    auto imageName = split(sample.background, '/').back();
+    auto imageNameWithoutExtension = split(imageName, '.').front();
+
+    // 2D coordinates of the corners, only with --log-level debug
+    for (size_t i = 0; i < 4; ++i) {
+        if (found[i]) {
+            PIPELINE_LOG(LogLevel::Debug, "Corner " << i << ": (" << xy[i * 2] << ", " << xy[i * 2 + 1] << ")"
+                                                    << (visible[i] ? "" : " hidden"));
+        }
+    }
+
+    // Кадр копируется: буфер Capture() перезапишет уже следующий сэмпл
+    vtkImageData* frame = scene.Capture();
+    EncodeImage image;
+    image.width = scene.GetWidth();
+    image.height = scene.GetHeight();
+    image.channels = frame->GetNumberOfScalarComponents();
+    image.bottom_up = true;
+    const auto* pixels = static_cast<const uint8_t*>(frame->GetScalarPointer());
+    image.pixels.assign(pixels, pixels + static_cast<size_t>(image.width) * image.height * image.channels);
+
+    // Имя — от зерна сэмпла, оно же уникально по всем узлам (см. selectSamples)
+    std::string key = SeedName(sample.seed) + "_" + imageNameWithoutExtension;
+    // надо добавить /.. перед data если запускать через IDE
+    writer.Submit(writer.IsSharded() ? key : "data/" + key, std::move(image),
+                  {{"json", AnnotationToJSON(xy, found, visible, annotation.grid)}});
+    TRACE_COUNT("samples", 1);
+    TRACE_COUNT("pixels", static_cast<int64_t>(scene.GetWidth()) * scene.GetHeight());
+    return true;
+}
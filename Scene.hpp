@@ -0,0 +1,538 @@
+#pragma once
+
+#include <vtkActor.h>
+#include <vtkCamera.h>
+#include <vtkDataArray.h>
+#include <vtkFloatArray.h>
+#include <vtkImageActor.h>
+#include <vtkImageData.h>
+#include <vtkImageReader2.h>
+#include <vtkImageReader2Factory.h>
+#include <vtkInteractorStyleTrackballCamera.h>
+#include <vtkJPEGReader.h>
+#include <vtkMatrix4x4.h>
+#include <vtkNew.h>
+#include <vtkOBJReader.h>
+#include <vtkPointData.h>
+#include <vtkPolyData.h>
+#include <vtkPolyDataMapper.h>
+#include <vtkProperty.h>
+#include <vtkRenderWindow.h>
+#include <vtkRenderWindowInteractor.h>
+#include <vtkRenderer.h>
+#include <vtkRenderingOpenGLConfigure.h>
+#include <vtkSmartPointer.h>
+#include <vtkTexture.h>
+#include <vtkTextureMapToPlane.h>
+#include <vtkTransform.h>
+#include <vtkUnsignedCharArray.h>
+#include <array>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "Canvas.hpp"
+#include "ImageCache.hpp"
+#include "ImageStore.hpp"
+#include "Manifest.hpp"
+#include "Projector.hpp"
+#include "SoftRenderer.hpp"
+#include "Surfaces.hpp"
+#include "Trace.hpp"
+#include "UVIndex.hpp"
+
+enum class RenderBackend {
+    Vtk, // VTK + OpenGL (окно или offscreen)
+    Cpu  // встроенный SoftRenderer, без OpenGL-контекста
+};
+
+struct SceneOptions {
+    int width = 800;
+    int height = 600;
+    bool offscreen = false;
+    RenderBackend backend = RenderBackend::Vtk;
+    unsigned threads = std::thread::hardware_concurrency(); // только для Cpu
+    std::string surface; // поверхность для сэмплов без своей; пусто — mesh.obj
+    size_t imageCacheBytes = size_t(512) << 20; // бюджет кэша декодированных картинок
+    const ImageStore* store = nullptr;          // заранее декодированные фоны, см. ImageStore
+    // Кэш, общий для нескольких сцен одного процесса (по сцене на поток рендера);
+    // nullptr — у сцены свой с бюджетом imageCacheBytes
+    ImageCache<vtkSmartPointer<vtkImageData>>* images = nullptr;
+};
+
+// Сцена рендера, которая живет весь процесс: меш, маппер, актор, окно и камера
+// создаются один раз, а на каждый сэмпл меняются только текстура, фон и камера.
+// Сэмплы с barcode не читают текстуру с диска: штрих-код вклеивается в холст
+// TextureCanvas прямо в памяти, и текстура берется из него.
+// Сэмплы с surface рендерятся не на mesh.obj, а на процедурной поверхности из
+// SurfaceGenerator; без заданного seed у каждого сэмпла своя деформация. OBJ
+// читается, только когда его просит хотя бы один сэмпл.
+// Фоны и штрих-коды декодируются один раз: они берутся из ImageCache (LRU по
+// байтам, ключ — путь и mtime) или прямо из отображенного в память ImageStore.
+// В offscreen-режиме нет ни интерактора, ни окна на экране: VTK рендерит в
+// внеэкранный framebuffer (OSMesa/EGL, если VTK собран с ними), кадр читается
+// оттуда напрямую в переиспользуемый буфер.
+// С бэкендом Cpu те же меш, текстура, трансформации и камера отдаются в
+// SoftRenderer, а окно VTK не создается вовсе.
+class Scene {
+public:
+    Scene(const std::string& meshPath, const SceneOptions& options) :
+            defaultWidth(options.width), defaultHeight(options.height),
+            width(options.width), height(options.height),
+            offscreen(options.offscreen || options.backend == RenderBackend::Cpu),
+            meshPath(meshPath), defaultSurface(options.surface),
+            ownImages(options.images ? 0 : options.imageCacheBytes),
+            images(options.images ? *options.images : ownImages), store(options.store) {
+        if (options.backend == RenderBackend::Cpu) {
+            soft = std::make_unique<SoftRenderer>(options.threads);
+        } else if (offscreen) {
+            // Не перетираем выбор пользователя, если переменная уже задана
+#if defined(VTK_OPENGL_HAS_OSMESA)
+            setenv("VTK_DEFAULT_OPENGL_WINDOW", "vtkOSOpenGLRenderWindow", 0);
+#elif defined(VTK_OPENGL_HAS_EGL)
+            setenv("VTK_DEFAULT_OPENGL_WINDOW", "vtkEGLRenderWindow", 0);
+#endif
+        }
+
+        texture->SetInputConnection(jpegReader->GetOutputPort());
+        texture->InterpolateOn();
+        texture->RepeatOff();  // Отключаем повторение текстуры
+
+        texturePlane->SetInputConnection(objReader->GetOutputPort());
+        texturePlane->AutomaticPlaneGenerationOn();
+
+        actor->SetMapper(mapper);
+        actor->SetTexture(texture);
+        actor->GetProperty()->BackfaceCullingOff();  // Отключаем отсечение задних граней
+        actor->GetProperty()->EdgeVisibilityOff();   // Отключаем отображение линий сетки
+        actor->GetProperty()->SetRepresentationToSurface(); // Отображаем только поверхность
+
+        transform->Translate(-5, 0, 0); // Adjust the translation values as necessary
+        actor->SetUserTransform(transform);
+
+        renderer->SetBackground(0.1, 0.1, 0.1); // Темный фон
+        renderer->SetActiveCamera(camera);
+
+        // Создаем трансформацию для фоновой плоскости
+        backgroundTransform->PostMultiply(); // Применять масштабирование после других трансформаций
+        backgroundTransform->RotateX(1); // Тот же угол поворота, что и у объекта
+        double shiftLeft = -280; // Смещение влево; отрицательное значение перемещает влево
+        double shiftUp = -180; // Смещение вверх; положительное значение перемещает вверх
+        backgroundTransform->Translate(shiftLeft, shiftUp, 330.0);
+        backgroundActor->SetUserTransform(backgroundTransform);
+
+        renderer->AddActor(actor);
+        renderer->AddActor(backgroundActor);
+
+        pixels->SetNumberOfComponents(3);
+        frame->GetPointData()->SetScalars(pixels);
+
+        if (soft) {
+            // Тот же темный фон, что и у renderer
+            soft->SetClearColor(26, 26, 26);
+            return;
+        }
+
+        renderWindow = vtkSmartPointer<vtkRenderWindow>::New();
+        renderWindow->AddRenderer(renderer);
+        renderWindow->SetSize(width, height);
+
+        if (offscreen) {
+            renderWindow->SetOffScreenRendering(1);
+        } else {
+            renderWindowInteractor = vtkSmartPointer<vtkRenderWindowInteractor>::New();
+            renderWindowInteractor->SetRenderWindow(renderWindow);
+            auto style = vtkSmartPointer<vtkInteractorStyleTrackballCamera>::New();
+            renderWindowInteractor->SetInteractorStyle(style);
+        }
+    }
+
+    Scene(const Scene&) = delete;
+
+    // Подменяет входы пайплайна под сэмпл и рендерит кадр. barcodeImage — уже
+    // декодированный штрих-код (снизу вверх, как у читалок VTK) вместо файла
+    // sample.barcode, который тогда служит только именем
+    bool Render(const Sample& sample, vtkImageData* barcodeImage = nullptr) {
+        // Случайность сэмпла зависит только от его зерна, а не от того, что рендерилось до него
+        rng.seed(sample.seed);
+        if (!sample.barcode.empty()) {
+            if (!composite(sample, barcodeImage)) {
+                return false;
+            }
+        } else {
+            if (composited) {
+                texture->SetInputConnection(jpegReader->GetOutputPort());
+                composited = false;
+            }
+            jpegReader->SetFileName(sample.texture.c_str());
+            box = sample.box;
+        }
+
+        vtkSmartPointer<vtkImageData> background = loadImage(sample.background);
+        if (!background) {
+            std::cerr << "Не удалось прочитать фон: " << sample.background << std::endl;
+            return false;
+        }
+        backgroundActor->SetInputData(background);
+
+        camera->SetPosition(sample.cameraPosition.data()); // Position the camera #changable
+        camera->SetFocalPoint(sample.cameraFocalPoint.data()); // Look at the center of the object #changable
+        camera->SetViewUp(sample.cameraViewUp.data()); // Set the view up vector #changable
+
+        int sampleWidth = sample.width > 0 ? sample.width : defaultWidth;
+        int sampleHeight = sample.height > 0 ? sample.height : defaultHeight;
+        if (sampleWidth != width || sampleHeight != height) {
+            width = sampleWidth;
+            height = sampleHeight;
+            if (renderWindow) {
+                renderWindow->SetSize(width, height);
+            }
+        }
+
+        // Густота сетки зависит от камеры и разрешения, поэтому поверхность выбирается последней
+        if (!selectMesh(sample.surface.empty() ? defaultSurface : sample.surface)) {
+            return false;
+        }
+
+        TRACE_SCOPE("render");
+        if (soft) {
+            return renderSoft();
+        }
+
+        renderWindow->Render();
+        return true;
+    }
+
+    // Читает отрендеренный кадр прямо из framebuffer'а в переиспользуемый буфер;
+    // результат живет до следующего вызова
+    vtkImageData* Capture() {
+        TRACE_SCOPE("readback");
+        if (soft) {
+            // Буфер SoftRenderer отдаем без копирования
+            pixels->SetArray(const_cast<uint8_t*>(soft->GetColor()), static_cast<vtkIdType>(width) * height * 3, 1);
+            frame->SetDimensions(width, height, 1);
+            frame->Modified();
+            return frame;
+        }
+        // В offscreen-режиме кадр лежит во внеэкранном буфере, на экране — в front после swap
+        renderWindow->GetPixelData(0, 0, width - 1, height - 1, offscreen ? 0 : 1, pixels);
+        frame->SetDimensions(width, height, 1);
+        pixels->Modified();
+        frame->Modified();
+        return frame;
+    }
+
+    // Меш последнего сэмпла с текстурными координатами, по которым ищутся точки аннотации
+    vtkPolyData* GetMesh() { return surface ? surface->mesh.Get() : objReader->GetOutput(); }
+
+    // UV-индекс меша последнего сэмпла; у процедурных поверхностей он хранится в кэше вместе с сеткой
+    // и вытесняется с ней, у mesh.obj — в самой сцене, пока меш не изменится
+    const UVIndex& GetUVIndex() {
+        if (surface) {
+            return surface->GetIndex();
+        }
+        vtkPolyData* mesh = objReader->GetOutput();
+        if (!objIndex || objIndexTime != mesh->GetMTime()) {
+            objIndexTime = mesh->GetMTime();
+            objIndex = std::make_unique<UVIndex>(mesh);
+        }
+        return *objIndex;
+    }
+
+    // UV-рамка штрих-кода последнего сэмпла: из манифеста или посчитанная при вклейке
+    const std::array<double, 4>& GetBarcodeBox() const { return box; }
+
+    vtkRenderer* GetRenderer() { return renderer; }
+
+    int GetWidth() const { return width; }
+
+    int GetHeight() const { return height; }
+
+    vtkRenderWindowInteractor* GetInteractor() { return renderWindowInteractor; }
+
+    void ReportImageCache(std::ostream& out) { images.Report(out); }
+
+    // Декодирует картинку читалкой VTK по расширению; nullptr, если формат не знаком
+    static vtkSmartPointer<vtkImageData> ReadImage(const std::string& path) {
+        vtkSmartPointer<vtkImageReader2> imageReader;
+        imageReader.TakeReference(vtkImageReader2Factory::CreateImageReader2(path.c_str()));
+        if (!imageReader) {
+            return nullptr;
+        }
+        imageReader->SetFileName(path.c_str());
+        imageReader->Update();
+        vtkImageData* image = imageReader->GetOutput();
+        if (!image || !image->GetScalarPointer() || image->GetScalarType() != VTK_UNSIGNED_CHAR) {
+            return nullptr;
+        }
+        return image;
+    }
+
+    bool IsSoftware() const { return soft != nullptr; }
+
+    // Модель-вид-проекция кадра вместе с трансформацией актора: переводит точки меша
+    // (как в GetMesh) в clip-координаты OpenGL. Считать после Render
+    SoftMatrix GetModelViewProjection() {
+        SoftMatrix model = toSoftMatrix(actor->GetMatrix());
+        if (soft) {
+            return softMultiply(soft->GetViewProjection(), model);
+        }
+        // Тот же аспект и диапазон глубины [-1, 1], с которыми VTK рендерил кадр
+        vtkMatrix4x4* viewProjection = camera->GetCompositeProjectionTransformMatrix(
+                static_cast<double>(width) / height, -1, 1);
+        return softMultiply(toSoftMatrix(viewProjection), model);
+    }
+
+    // Z-буфер последнего кадра (снизу вверх, [0, 1]); для VTK читается из framebuffer'а
+    // в переиспользуемый массив и живет до следующего вызова
+    DepthView CaptureDepth() {
+        TRACE_SCOPE("depth readback");
+        if (soft) {
+            return {soft->GetDepth(), width, height, soft->GetDepthStride()};
+        }
+        renderWindow->GetZbufferData(0, 0, width - 1, height - 1, depthValues);
+        return {depthValues->GetPointer(0), width, height, width};
+    }
+
+private:
+    // Вклеивает штрих-код сэмпла в холст и подключает холст как текстуру
+    bool composite(const Sample& sample, vtkImageData* decoded) {
+        TRACE_SCOPE("composite");
+        // Один штрих-код обычно идет подряд на много фонов, декодируется он один раз
+        vtkSmartPointer<vtkImageData> barcodeImage = decoded ? decoded : loadImage(sample.barcode);
+        if (!barcodeImage) {
+            std::cerr << "Не удалось прочитать штрих-код: " << sample.barcode << std::endl;
+            return false;
+        }
+
+        int dims[3];
+        barcodeImage->GetDimensions(dims);
+        std::uniform_real_distribution<double> scaleDistribution(std::min(sample.scale[0], sample.scale[1]),
+                                                                 std::max(sample.scale[0], sample.scale[1]));
+        double scale = scaleDistribution(rng);
+        // Позиция считается от итогового размера, который Paste может еще уменьшить
+        int w = std::min(static_cast<int>(std::lround(dims[0] * scale)), canvas.GetWidth());
+        int h = std::min(static_cast<int>(std::lround(dims[1] * scale)), canvas.GetHeight());
+        int x = sample.position[0] >= 0 ? static_cast<int>(std::lround(sample.position[0] * canvas.GetWidth()))
+                : std::uniform_int_distribution<int>(0, std::max(canvas.GetWidth() - w, 0))(rng);
+        int y = sample.position[1] >= 0 ? static_cast<int>(std::lround(sample.position[1] * canvas.GetHeight()))
+                : std::uniform_int_distribution<int>(0, std::max(canvas.GetHeight() - h, 0))(rng);
+        if (!canvas.Paste(barcodeImage, scale, x, y, box)) {
+            std::cerr << "Штрих-код должен быть 8-битным изображением: " << sample.barcode << std::endl;
+            return false;
+        }
+
+        if (!composited) {
+            texture->SetInputData(canvas.GetImage());
+            composited = true;
+        }
+        return true;
+    }
+
+    // Картинка из ImageStore без копирования, если она там есть и не менялась, иначе из кэша
+    vtkSmartPointer<vtkImageData> loadImage(const std::string& path) {
+        StoredImage stored;
+        if (store && store->Find(path, stored) && stored.bottom_up) {
+            auto scalars = vtkSmartPointer<vtkUnsignedCharArray>::New();
+            scalars->SetNumberOfComponents(stored.channels);
+            // save = 1: память принадлежит отображению, VTK ее только читает
+            scalars->SetArray(const_cast<uint8_t*>(stored.data),
+                              static_cast<vtkIdType>(stored.width) * stored.height * stored.channels, 1);
+            auto image = vtkSmartPointer<vtkImageData>::New();
+            image->SetDimensions(stored.width, stored.height, 1);
+            image->GetPointData()->SetScalars(scalars);
+            return image;
+        }
+        vtkSmartPointer<vtkImageData> image;
+        auto decode = [](const std::string& source, vtkSmartPointer<vtkImageData>& decoded, size_t& bytes) {
+            TRACE_SCOPE("decode");
+            decoded = ReadImage(source);
+            if (!decoded) {
+                return false;
+            }
+            bytes = static_cast<size_t>(decoded->GetNumberOfPoints()) * decoded->GetNumberOfScalarComponents();
+            return true;
+        };
+        if (!images.Get(path, decode, image)) {
+            return nullptr;
+        }
+        return image;
+    }
+
+    // Подключает к мапперу mesh.obj (spec пустой) или процедурную поверхность
+    bool selectMesh(const std::string& spec) {
+        vtkPolyData* mesh;
+        if (spec.empty()) {
+            if (!objLoaded) {
+                objReader->SetFileName(meshPath.c_str());
+                objReader->Update();
+                objLoaded = true;
+            }
+            texturePlane->Update();
+            mesh = texturePlane->GetOutput();
+            if (mesh != mapped) {
+                // Apply the texture coordinates from the plane to the mesh
+                mapper->SetInputConnection(texturePlane->GetOutputPort());
+            }
+            surface = nullptr;
+        } else {
+            SurfaceSpec surfaceSpec;
+            if (!parseSurfaceSpec(spec, surfaceSpec)) {
+                std::cerr << "Неизвестная поверхность: " << spec << std::endl;
+                return false;
+            }
+            if (surfaceSpec.UsesSeed() && !surfaceSpec.hasSeed) {
+                surfaceSpec.seed = rng();
+            }
+            surface = &surfaces.Get(surfaceSpec, pixelsPerUnit(surfaceSpec));
+            mesh = surface->mesh;
+            if (mesh != mapped) {
+                mapper->SetInputData(mesh);
+            }
+        }
+        mapped = mesh;
+        if (soft && mesh != softMeshSource) {
+            loadSoftMesh(mesh);
+        }
+        return true;
+    }
+
+    // Сколько пикселей кадра приходится на единицу длины у центра поверхности
+    double pixelsPerUnit(const SurfaceSpec& spec) {
+        double homogeneous[4] = {spec.center[0], spec.center[1], spec.center[2], 1};
+        double world[4];
+        actor->GetMatrix()->MultiplyPoint(homogeneous, world);
+        double position[3];
+        camera->GetPosition(position);
+        double distance = 0;
+        for (int c = 0; c < 3; ++c) {
+            distance += (world[c] - position[c]) * (world[c] - position[c]);
+        }
+        const double halfAngle = camera->GetViewAngle() * std::acos(-1.0) / 360;
+        return height / (2 * std::sqrt(distance) * std::tan(halfAngle));
+    }
+
+    static SoftMatrix toSoftMatrix(vtkMatrix4x4* matrix) {
+        SoftMatrix m;
+        for (int i = 0; i < 4; ++i) {
+            for (int j = 0; j < 4; ++j) {
+                m[i * 4 + j] = matrix->GetElement(i, j);
+            }
+        }
+        return m;
+    }
+
+    static SoftImageView toSoftImage(vtkImageData* image) {
+        SoftImageView view;
+        int dims[3];
+        image->GetDimensions(dims);
+        view.data = static_cast<const uint8_t*>(image->GetScalarPointer());
+        view.width = dims[0];
+        view.height = dims[1];
+        view.channels = image->GetNumberOfScalarComponents();
+        return view;
+    }
+
+    // Меш для SoftRenderer — ровно то, что видит маппер (для OBJ — после vtkTextureMapToPlane)
+    void loadSoftMesh(vtkPolyData* mesh) {
+        softMeshSource = mesh;
+        softMesh.indices.clear();
+        vtkDataArray* tcoords = mesh->GetPointData()->GetTCoords();
+        vtkIdType pointCount = mesh->GetNumberOfPoints();
+        softMesh.positions.resize(pointCount * 3);
+        softMesh.uvs.resize(pointCount * 2);
+        for (vtkIdType i = 0; i < pointCount; ++i) {
+            double p[3];
+            mesh->GetPoint(i, p);
+            for (int c = 0; c < 3; ++c) {
+                softMesh.positions[i * 3 + c] = static_cast<float>(p[c]);
+            }
+            softMesh.uvs[i * 2] = tcoords ? static_cast<float>(tcoords->GetComponent(i, 0)) : 0.0f;
+            softMesh.uvs[i * 2 + 1] = tcoords ? static_cast<float>(tcoords->GetComponent(i, 1)) : 0.0f;
+        }
+        for (vtkIdType i = 0; i < mesh->GetNumberOfCells(); ++i) {
+            vtkIdType npts;
+            const vtkIdType* pts;
+            mesh->GetCellPoints(i, npts, pts);
+            for (vtkIdType j = 2; j < npts; ++j) {
+                softMesh.indices.insert(softMesh.indices.end(), {static_cast<uint32_t>(pts[0]),
+                                                                 static_cast<uint32_t>(pts[j - 1]),
+                                                                 static_cast<uint32_t>(pts[j])});
+            }
+        }
+    }
+
+    bool renderSoft() {
+        vtkImageData* textureImage = canvas.GetImage();
+        if (!composited) {
+            jpegReader->Update();
+            textureImage = jpegReader->GetOutput();
+        }
+        vtkImageData* backgroundImage = vtkImageData::SafeDownCast(backgroundActor->GetInput());
+        if (!textureImage || !textureImage->GetScalarPointer() || !backgroundImage) {
+            std::cerr << "Не удалось подготовить текстуры для SoftRenderer" << std::endl;
+            return false;
+        }
+
+        SoftCamera softCamera;
+        camera->GetPosition(softCamera.position.data());
+        camera->GetFocalPoint(softCamera.focalPoint.data());
+        camera->GetViewUp(softCamera.viewUp.data());
+        softCamera.viewAngle = camera->GetViewAngle();
+
+        soft->Render(softMesh, toSoftMatrix(actor->GetMatrix()), toSoftImage(textureImage),
+                     toSoftImage(backgroundImage), toSoftMatrix(backgroundActor->GetMatrix()),
+                     softCamera, width, height);
+        return true;
+    }
+
+    int defaultWidth;
+    int defaultHeight;
+    int width;
+    int height;
+    bool offscreen;
+
+    std::string meshPath;
+    std::string defaultSurface;
+    vtkNew<vtkOBJReader> objReader;
+    bool objLoaded = false;
+    std::unique_ptr<UVIndex> objIndex; // UV-индекс mesh.obj, строится при первом запросе
+    vtkMTimeType objIndexTime = 0;
+    vtkSmartPointer<vtkPolyData> mapped; // что сейчас на входе маппера
+    SurfaceGenerator surfaces;
+    SurfaceGenerator::Surface* surface = nullptr; // nullptr — сейчас рендерится mesh.obj
+    vtkNew<vtkJPEGReader> jpegReader;
+    vtkNew<vtkTexture> texture;
+
+    TextureCanvas canvas;
+    bool composited = false; // текстура сейчас берется из canvas, а не из jpegReader
+    std::array<double, 4> box = {0, 0, 0, 0};
+    std::mt19937_64 rng;
+    vtkNew<vtkTextureMapToPlane> texturePlane;
+    vtkNew<vtkPolyDataMapper> mapper;
+    vtkNew<vtkActor> actor;
+    vtkNew<vtkTransform> transform;
+
+    vtkNew<vtkRenderer> renderer;
+    vtkNew<vtkCamera> camera;
+
+    ImageCache<vtkSmartPointer<vtkImageData>> ownImages;
+    ImageCache<vtkSmartPointer<vtkImageData>>& images;
+    const ImageStore* store;
+    vtkNew<vtkImageActor> backgroundActor;
+    vtkNew<vtkTransform> backgroundTransform;
+
+    vtkSmartPointer<vtkRenderWindow> renderWindow;
+    vtkSmartPointer<vtkRenderWindowInteractor> renderWindowInteractor;
+
+    std::unique_ptr<SoftRenderer> soft;
+    SoftMesh softMesh;
+    vtkSmartPointer<vtkPolyData> softMeshSource; // из чего собран softMesh
+
+    vtkNew<vtkUnsignedCharArray> pixels;
+    vtkNew<vtkImageData> frame;
+    vtkNew<vtkFloatArray> depthValues;
+};
@@ -0,0 +1,517 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Программный рендерер ровно для нашей сцены: один текстурированный меш с
+// модельной матрицей, фон-картинка на плоскости и перспективная камера.
+// Ничего не знает про VTK: меш, текстуры и камера приходят плоскими массивами,
+// адаптер из VTK-пайплайна живет в Scene. Кадр и z-буфер хранятся снизу вверх,
+// как у vtkImageData и glReadPixels, глубина — в [0, 1] как в OpenGL.
+
+// Картинка без владения памятью: строки снизу вверх, 1-4 канала по байту
+struct SoftImageView {
+    const uint8_t* data = nullptr;
+    int width = 0;
+    int height = 0;
+    int channels = 0;
+};
+
+struct SoftMesh {
+    std::vector<float> positions; // x, y, z на вершину
+    std::vector<float> uvs;       // u, v на вершину
+    std::vector<uint32_t> indices; // по три на треугольник
+};
+
+struct SoftCamera {
+    std::array<double, 3> position = {0, 0, 1};
+    std::array<double, 3> focalPoint = {0, 0, 0};
+    std::array<double, 3> viewUp = {0, 1, 0};
+    double viewAngle = 30.0; // вертикальный угол обзора в градусах, как у vtkCamera
+};
+
+// Матрицы 4x4 по строкам, как vtkMatrix4x4::Element
+using SoftMatrix = std::array<double, 16>;
+
+inline SoftMatrix softIdentity() {
+    return {1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1};
+}
+
+inline SoftMatrix softMultiply(const SoftMatrix& a, const SoftMatrix& b) {
+    SoftMatrix r;
+    for (int i = 0; i < 4; ++i) {
+        for (int j = 0; j < 4; ++j) {
+            r[i * 4 + j] = a[i * 4] * b[j] + a[i * 4 + 1] * b[4 + j] + a[i * 4 + 2] * b[8 + j] + a[i * 4 + 3] * b[12 + j];
+        }
+    }
+    return r;
+}
+
+inline std::array<double, 4> softTransform(const SoftMatrix& m, const double p[3]) {
+    std::array<double, 4> r;
+    for (int i = 0; i < 4; ++i) {
+        r[i] = m[i * 4] * p[0] + m[i * 4 + 1] * p[1] + m[i * 4 + 2] * p[2] + m[i * 4 + 3];
+    }
+    return r;
+}
+
+class SoftRenderer {
+public:
+    explicit SoftRenderer(unsigned threads = std::thread::hardware_concurrency()) {
+        threads = std::max(1u, threads);
+        // Главный поток рендерит первую полосу сам, остальным полосам — свои потоки
+        for (unsigned i = 1; i < threads; ++i) {
+            workers.emplace_back([this, i] { workerLoop(i); });
+        }
+    }
+
+    SoftRenderer(const SoftRenderer&) = delete;
+
+    ~SoftRenderer() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        start.notify_all();
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+
+    void SetClearColor(uint8_t r, uint8_t g, uint8_t b) { clearColor = {r, g, b}; }
+
+    // Рендерит меш с текстурой поверх фона. backgroundModel переводит плоскость
+    // картинки фона (пиксель (i, j) -> точка (i, j, 0)) в мировые координаты.
+    void Render(const SoftMesh& mesh, const SoftMatrix& model, SoftImageView texture,
+                SoftImageView background, const SoftMatrix& backgroundModel,
+                const SoftCamera& camera, int width_, int height_) {
+        width = width_;
+        height = height_;
+        depthStride = (width + 3) & ~3;
+        color.resize(static_cast<size_t>(width) * height * 3);
+        depth.resize(static_cast<size_t>(depthStride) * height);
+
+        view = lookAt(camera);
+        setupTriangles(mesh, model, texture, background, backgroundModel, camera);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            ++generation;
+            pending = static_cast<int>(workers.size());
+        }
+        start.notify_all();
+        renderBand(0);
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this] { return pending == 0; });
+    }
+
+    // Точная проекция мировой точки в координаты картинки (y сверху вниз, как в
+    // аннотациях) вместе с глубиной в [0, 1]; false — точка за камерой
+    bool Project(const double world[3], double display[2], double* pointDepth = nullptr) const {
+        auto clip = softTransform(viewProjection, world);
+        if (clip[3] <= 0) {
+            return false;
+        }
+        double ndcX = clip[0] / clip[3];
+        double ndcY = clip[1] / clip[3];
+        display[0] = (ndcX + 1) * 0.5 * width;
+        display[1] = height - (ndcY + 1) * 0.5 * height;
+        if (pointDepth) {
+            *pointDepth = (clip[2] / clip[3] + 1) * 0.5;
+        }
+        return true;
+    }
+
+    const uint8_t* GetColor() const { return color.data(); }
+
+    // Z-буфер с шагом строки GetDepthStride(), снизу вверх
+    const float* GetDepth() const { return depth.data(); }
+
+    int GetDepthStride() const { return depthStride; }
+
+    int GetWidth() const { return width; }
+
+    int GetHeight() const { return height; }
+
+    const SoftMatrix& GetViewProjection() const { return viewProjection; }
+
+private:
+    struct Vertex {
+        float x, y, z, w; // clip space
+        float u, v;
+    };
+
+    struct Triangle {
+        std::array<Vertex, 3> v;
+        const SoftImageView* texture;
+        float shade;
+    };
+
+    // Треугольник после деления на w: коэффициенты для построчного обхода
+    struct Setup {
+        float minX, maxX, minY, maxY;
+        float a[3], b[3], c[3];  // барицентрики l_k = a_k * x + b_k * y + c_k
+        float z[3], iw[3], uw[3], vw[3];
+        const SoftImageView* texture;
+        float shade;
+    };
+
+    static SoftMatrix lookAt(const SoftCamera& camera) {
+        std::array<double, 3> f, s, u;
+        for (int i = 0; i < 3; ++i) {
+            f[i] = camera.focalPoint[i] - camera.position[i];
+        }
+        normalize(f);
+        s = cross(f, camera.viewUp);
+        normalize(s);
+        u = cross(s, f);
+        SoftMatrix m = {s[0], s[1], s[2], 0,
+                        u[0], u[1], u[2], 0,
+                        -f[0], -f[1], -f[2], 0,
+                        0, 0, 0, 1};
+        for (int i = 0; i < 3; ++i) {
+            m[i * 4 + 3] = -(m[i * 4] * camera.position[0] + m[i * 4 + 1] * camera.position[1] + m[i * 4 + 2] * camera.position[2]);
+        }
+        return m;
+    }
+
+    static std::array<double, 3> cross(const std::array<double, 3>& a, const std::array<double, 3>& b) {
+        return {a[1] * b[2] - a[2] * b[1], a[2] * b[0] - a[0] * b[2], a[0] * b[1] - a[1] * b[0]};
+    }
+
+    static void normalize(std::array<double, 3>& v) {
+        double length = std::sqrt(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+        if (length > 0) {
+            for (double& c : v) {
+                c /= length;
+            }
+        }
+    }
+
+    void setupTriangles(const SoftMesh& mesh, const SoftMatrix& model, SoftImageView texture_,
+                        SoftImageView background_, const SoftMatrix& backgroundModel, const SoftCamera& camera) {
+        texture = texture_;
+        background = background_;
+        triangles.clear();
+
+        // Плоскости отсечения подбираем по глубине всей геометрии, как ResetCameraClippingRange
+        double nearest = std::numeric_limits<double>::max();
+        double farthest = 0;
+        auto extendRange = [&](const SoftMatrix& modelView, const double p[3]) {
+            double d = -softTransform(modelView, p)[2];
+            nearest = std::min(nearest, d);
+            farthest = std::max(farthest, d);
+        };
+        SoftMatrix meshView = softMultiply(view, model);
+        SoftMatrix backgroundView = softMultiply(view, backgroundModel);
+        for (size_t i = 0; i < mesh.positions.size(); i += 3) {
+            double p[3] = {mesh.positions[i], mesh.positions[i + 1], mesh.positions[i + 2]};
+            extendRange(meshView, p);
+        }
+        std::array<std::array<double, 3>, 4> quad = {{
+            {0, 0, 0},
+            {static_cast<double>(background.width - 1), 0, 0},
+            {static_cast<double>(background.width - 1), static_cast<double>(background.height - 1), 0},
+            {0, static_cast<double>(background.height - 1), 0}
+        }};
+        if (background.data) {
+            for (const auto& p : quad) {
+                extendRange(backgroundView, p.data());
+            }
+        }
+        farthest = std::max(farthest * 1.01, 1e-3);
+        double near = std::max(nearest * 0.99, farthest * 1e-3);
+
+        double aspect = static_cast<double>(width) / height;
+        double f = 1.0 / std::tan(camera.viewAngle * M_PI / 360.0);
+        SoftMatrix projection = {f / aspect, 0, 0, 0,
+                                 0, f, 0, 0,
+                                 0, 0, -(farthest + near) / (farthest - near), -2 * farthest * near / (farthest - near),
+                                 0, 0, -1, 0};
+        viewProjection = softMultiply(projection, view);
+
+        // Меш освещается фонарем камеры с двусторонним освещением и плоским
+        // затенением, как vtkPolyDataMapper без нормалей; фон не освещается
+        SoftMatrix meshClip = softMultiply(projection, meshView);
+        for (size_t t = 0; t + 2 < mesh.indices.size(); t += 3) {
+            std::array<Vertex, 3> v;
+            std::array<std::array<double, 4>, 3> eye;
+            for (int k = 0; k < 3; ++k) {
+                uint32_t id = mesh.indices[t + k];
+                double p[3] = {mesh.positions[id * 3], mesh.positions[id * 3 + 1], mesh.positions[id * 3 + 2]};
+                auto c = softTransform(meshClip, p);
+                eye[k] = softTransform(meshView, p);
+                v[k] = {static_cast<float>(c[0]), static_cast<float>(c[1]), static_cast<float>(c[2]), static_cast<float>(c[3]),
+                        mesh.uvs[id * 2], mesh.uvs[id * 2 + 1]};
+            }
+            std::array<double, 3> e1 = {eye[1][0] - eye[0][0], eye[1][1] - eye[0][1], eye[1][2] - eye[0][2]};
+            std::array<double, 3> e2 = {eye[2][0] - eye[0][0], eye[2][1] - eye[0][1], eye[2][2] - eye[0][2]};
+            auto normal = cross(e1, e2);
+            normalize(normal);
+            addClipped(v, &texture, static_cast<float>(std::abs(normal[2])));
+        }
+
+        if (background.data) {
+            // Как у vtkImageActor: квад проходит через центры крайних пикселей
+            SoftMatrix backgroundClip = softMultiply(projection, backgroundView);
+            float du = 0.5f / background.width;
+            float dv = 0.5f / background.height;
+            std::array<std::array<float, 2>, 4> quadUV = {{{du, dv}, {1 - du, dv}, {1 - du, 1 - dv}, {du, 1 - dv}}};
+            std::array<Vertex, 4> corners;
+            for (int k = 0; k < 4; ++k) {
+                auto c = softTransform(backgroundClip, quad[k].data());
+                corners[k] = {static_cast<float>(c[0]), static_cast<float>(c[1]), static_cast<float>(c[2]), static_cast<float>(c[3]),
+                              quadUV[k][0], quadUV[k][1]};
+            }
+            addClipped({corners[0], corners[1], corners[2]}, &background, 1.0f);
+            addClipped({corners[0], corners[2], corners[3]}, &background, 1.0f);
+        }
+
+        setups.clear();
+        setups.reserve(triangles.size());
+        for (const auto& triangle : triangles) {
+            Setup s;
+            if (makeSetup(triangle, s)) {
+                setups.push_back(s);
+            }
+        }
+    }
+
+    // Отсечение по ближней плоскости (z > -w), остальное отрежет обход по пикселям
+    void addClipped(const std::array<Vertex, 3>& v, const SoftImageView* image, float shade) {
+        auto distance = [](const Vertex& p) { return p.z + p.w; };
+        std::array<Vertex, 4> out;
+        int count = 0;
+        for (int i = 0; i < 3; ++i) {
+            const Vertex& a = v[i];
+            const Vertex& b = v[(i + 1) % 3];
+            float da = distance(a);
+            float db = distance(b);
+            if (da >= 0) {
+                out[count++] = a;
+            }
+            if ((da >= 0) != (db >= 0)) {
+                float t = da / (da - db);
+                out[count++] = {a.x + (b.x - a.x) * t, a.y + (b.y - a.y) * t, a.z + (b.z - a.z) * t,
+                                a.w + (b.w - a.w) * t, a.u + (b.u - a.u) * t, a.v + (b.v - a.v) * t};
+            }
+        }
+        for (int i = 2; i < count; ++i) {
+            triangles.push_back({{out[0], out[i - 1], out[i]}, image, shade});
+        }
+    }
+
+    bool makeSetup(const Triangle& triangle, Setup& s) const {
+        float sx[3], sy[3];
+        for (int k = 0; k < 3; ++k) {
+            const Vertex& p = triangle.v[k];
+            float iw = 1.0f / p.w;
+            sx[k] = (p.x * iw + 1) * 0.5f * width;
+            sy[k] = (p.y * iw + 1) * 0.5f * height;
+            s.z[k] = (p.z * iw + 1) * 0.5f;
+            s.iw[k] = iw;
+            s.uw[k] = p.u * iw;
+            s.vw[k] = p.v * iw;
+        }
+        float area = (sx[1] - sx[0]) * (sy[2] - sy[0]) - (sx[2] - sx[0]) * (sy[1] - sy[0]);
+        if (std::abs(area) < 1e-12f) {
+            return false;
+        }
+        // Отсечения задних граней нет, поэтому ориентация любая
+        float inv = 1.0f / area;
+        for (int k = 0; k < 3; ++k) {
+            int i = (k + 1) % 3;
+            int j = (k + 2) % 3;
+            s.a[k] = (sy[i] - sy[j]) * inv;
+            s.b[k] = (sx[j] - sx[i]) * inv;
+            s.c[k] = (sx[i] * sy[j] - sx[j] * sy[i]) * inv;
+        }
+        s.minX = std::max(0.0f, std::min({sx[0], sx[1], sx[2]}));
+        s.maxX = std::min(static_cast<float>(width), std::max({sx[0], sx[1], sx[2]}));
+        s.minY = std::max(0.0f, std::min({sy[0], sy[1], sy[2]}));
+        s.maxY = std::min(static_cast<float>(height), std::max({sy[0], sy[1], sy[2]}));
+        s.texture = triangle.texture;
+        s.shade = triangle.shade;
+        return s.minX < s.maxX && s.minY < s.maxY;
+    }
+
+    void workerLoop(unsigned band) {
+        size_t seen = 0;
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                start.wait(lock, [&] { return stop || generation != seen; });
+                if (stop) {
+                    return;
+                }
+                seen = generation;
+            }
+            renderBand(band);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                --pending;
+            }
+            done.notify_one();
+        }
+    }
+
+    void renderBand(unsigned band) {
+        unsigned bands = static_cast<unsigned>(workers.size()) + 1;
+        int y0 = static_cast<int>(static_cast<long long>(height) * band / bands);
+        int y1 = static_cast<int>(static_cast<long long>(height) * (band + 1) / bands);
+
+        for (int y = y0; y < y1; ++y) {
+            uint8_t* row = &color[static_cast<size_t>(y) * width * 3];
+            for (int x = 0; x < width; ++x) {
+                std::memcpy(row + x * 3, clearColor.data(), 3);
+            }
+            std::fill_n(&depth[static_cast<size_t>(y) * depthStride], depthStride, 1.0f);
+        }
+
+        for (const auto& s : setups) {
+            int ys = std::max(y0, static_cast<int>(s.minY));
+            int ye = std::min(y1, static_cast<int>(std::ceil(s.maxY)));
+            int xs = static_cast<int>(s.minX);
+            int xe = std::min(width, static_cast<int>(std::ceil(s.maxX)));
+            for (int y = ys; y < ye; ++y) {
+                rasterizeRow(s, y, xs, xe);
+            }
+        }
+    }
+
+    void rasterizeRow(const Setup& s, int y, int xs, int xe) {
+        float py = y + 0.5f;
+        float* depthRow = &depth[static_cast<size_t>(y) * depthStride];
+        uint8_t* colorRow = &color[static_cast<size_t>(y) * width * 3];
+        float e[3];
+        for (int k = 0; k < 3; ++k) {
+            e[k] = s.b[k] * py + s.c[k];
+        }
+
+#if defined(__SSE2__)
+        // Начинаем с кратного четырем x, чтобы загрузка z-буфера не вышла за строку
+        int x = xs & ~3;
+        // По четыре пикселя за раз: барицентрики, тест покрытия и z-тест в SSE
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 lane = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+        for (; x < xe; x += 4) {
+            __m128 px = _mm_add_ps(_mm_set1_ps(static_cast<float>(x)), lane);
+            __m128 b0 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(s.a[0]), px), _mm_set1_ps(e[0]));
+            __m128 b1 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(s.a[1]), px), _mm_set1_ps(e[1]));
+            __m128 b2 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(s.a[2]), px), _mm_set1_ps(e[2]));
+            __m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(b0, zero), _mm_cmpge_ps(b1, zero)), _mm_cmpge_ps(b2, zero));
+            inside = _mm_and_ps(inside, _mm_cmplt_ps(px, _mm_set1_ps(static_cast<float>(xe))));
+            if (_mm_movemask_ps(inside) == 0) {
+                continue;
+            }
+            __m128 z = _mm_add_ps(_mm_add_ps(_mm_mul_ps(b0, _mm_set1_ps(s.z[0])), _mm_mul_ps(b1, _mm_set1_ps(s.z[1]))),
+                                  _mm_mul_ps(b2, _mm_set1_ps(s.z[2])));
+            __m128 stored = _mm_loadu_ps(depthRow + x);
+            __m128 pass = _mm_and_ps(inside, _mm_and_ps(_mm_cmplt_ps(z, stored), _mm_cmpge_ps(z, zero)));
+            int mask = _mm_movemask_ps(pass);
+            if (mask == 0) {
+                continue;
+            }
+            _mm_storeu_ps(depthRow + x, _mm_or_ps(_mm_and_ps(pass, z), _mm_andnot_ps(pass, stored)));
+
+            __m128 iw = _mm_add_ps(_mm_add_ps(_mm_mul_ps(b0, _mm_set1_ps(s.iw[0])), _mm_mul_ps(b1, _mm_set1_ps(s.iw[1]))),
+                                   _mm_mul_ps(b2, _mm_set1_ps(s.iw[2])));
+            __m128 w = _mm_div_ps(_mm_set1_ps(1.0f), iw);
+            __m128 u = _mm_mul_ps(w, _mm_add_ps(_mm_add_ps(_mm_mul_ps(b0, _mm_set1_ps(s.uw[0])), _mm_mul_ps(b1, _mm_set1_ps(s.uw[1]))),
+                                                _mm_mul_ps(b2, _mm_set1_ps(s.uw[2]))));
+            __m128 v = _mm_mul_ps(w, _mm_add_ps(_mm_add_ps(_mm_mul_ps(b0, _mm_set1_ps(s.vw[0])), _mm_mul_ps(b1, _mm_set1_ps(s.vw[1]))),
+                                                _mm_mul_ps(b2, _mm_set1_ps(s.vw[2]))));
+            alignas(16) float us[4], vs[4];
+            _mm_store_ps(us, u);
+            _mm_store_ps(vs, v);
+            for (int l = 0; l < 4; ++l) {
+                if (mask & (1 << l)) {
+                    shadePixel(s, us[l], vs[l], colorRow + (x + l) * 3);
+                }
+            }
+        }
+#else
+        for (int x = xs; x < xe; ++x) {
+            float px = x + 0.5f;
+            float b[3];
+            for (int k = 0; k < 3; ++k) {
+                b[k] = s.a[k] * px + e[k];
+            }
+            if (b[0] < 0 || b[1] < 0 || b[2] < 0) {
+                continue;
+            }
+            float z = b[0] * s.z[0] + b[1] * s.z[1] + b[2] * s.z[2];
+            if (!(z < depthRow[x]) || z < 0) {
+                continue;
+            }
+            depthRow[x] = z;
+            float w = 1.0f / (b[0] * s.iw[0] + b[1] * s.iw[1] + b[2] * s.iw[2]);
+            float u = w * (b[0] * s.uw[0] + b[1] * s.uw[1] + b[2] * s.uw[2]);
+            float v = w * (b[0] * s.vw[0] + b[1] * s.vw[1] + b[2] * s.vw[2]);
+            shadePixel(s, u, v, colorRow + x * 3);
+        }
+#endif
+    }
+
+    // Билинейная выборка с прижатием к краю (RepeatOff + InterpolateOn у vtkTexture)
+    static void shadePixel(const Setup& s, float u, float v, uint8_t* out) {
+        const SoftImageView& image = *s.texture;
+        float fx = std::clamp(u * image.width - 0.5f, 0.0f, static_cast<float>(image.width - 1));
+        float fy = std::clamp(v * image.height - 0.5f, 0.0f, static_cast<float>(image.height - 1));
+        int x0 = static_cast<int>(fx);
+        int y0 = static_cast<int>(fy);
+        int x1 = std::min(x0 + 1, image.width - 1);
+        int y1 = std::min(y0 + 1, image.height - 1);
+        float tx = fx - x0;
+        float ty = fy - y0;
+
+        const int ch = image.channels;
+        const size_t stride = static_cast<size_t>(image.width) * ch;
+        const uint8_t* p00 = image.data + y0 * stride + x0 * ch;
+        const uint8_t* p01 = image.data + y0 * stride + x1 * ch;
+        const uint8_t* p10 = image.data + y1 * stride + x0 * ch;
+        const uint8_t* p11 = image.data + y1 * stride + x1 * ch;
+        for (int c = 0; c < 3; ++c) {
+            // Одноканальная текстура — яркость, у RGBA альфу игнорируем
+            int k = ch >= 3 ? c : 0;
+            float top = p00[k] + (p01[k] - p00[k]) * tx;
+            float bottom = p10[k] + (p11[k] - p10[k]) * tx;
+            float value = (top + (bottom - top) * ty) * s.shade;
+            out[c] = static_cast<uint8_t>(std::min(255.0f, value + 0.5f));
+        }
+    }
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable start;
+    std::condition_variable done;
+    size_t generation = 0;
+    int pending = 0;
+    bool stop = false;
+
+    std::array<uint8_t, 3> clearColor = {0, 0, 0};
+    int width = 0;
+    int height = 0;
+    int depthStride = 0;
+    std::vector<uint8_t> color;
+    std::vector<float> depth;
+
+    SoftMatrix view = softIdentity();
+    SoftMatrix viewProjection = softIdentity();
+    SoftImageView texture;
+    SoftImageView background;
+    std::vector<Triangle> triangles;
+    std::vector<Setup> setups;
+};
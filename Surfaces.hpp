@@ -0,0 +1,384 @@
+#pragma once
+
+#include <vtkCellArray.h>
+#include <vtkFloatArray.h>
+#include <vtkPointData.h>
+#include <vtkPoints.h>
+#include <vtkPolyData.h>
+#include <vtkSmartPointer.h>
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <exception>
+#include <list>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "Seeds.hpp"
+#include "UVIndex.hpp"
+
+// Параметры процедурной поверхности — листа с текстурой, деформированного одним
+// из способов:
+//   plane    — плоский лист;
+//   cylinder — лист, обернутый вокруг вертикальной оси (бутылка); taper сужает
+//              радиус к одному краю, как у горлышка;
+//   folds    — count сгибов в случайных местах, каждый на угол до angle градусов;
+//   crumple  — мятая бумага: плоский лист со смещением по нормали из шума.
+// noise добавляет тот же шум к любому виду. Записывается как в generate.config:
+// "folds:count=3:angle=40:noise=0.2:seed=7".
+struct SurfaceSpec {
+    std::string kind = "plane";
+    double width = 8.0;   // размеры листа в единицах мира; пропорции как у холста
+    double height = 14.6; // текстуры 484x884
+    // Центр рамки mesh.obj, чтобы камера по умолчанию смотрела туда же
+    std::array<double, 3> center = {11.5, 4.0, 3.5};
+    double radius = 6.0;    // cylinder
+    double taper = 0.0;     // cylinder: относительное изменение радиуса от низа к верху
+    int count = 3;          // folds
+    double angle = 35.0;    // folds, градусы
+    double noise = 0.0;     // амплитуда шума
+    double frequency = 0.3; // волн шума на единицу длины
+    int octaves = 3;
+    uint64_t seed = 0;
+    bool hasSeed = false;
+    int cells = 0; // ячеек сетки на сторону; 0 — сколько нужно для разрешения кадра
+
+    bool UsesSeed() const { return kind == "folds" || noise > 0; }
+};
+
+// "kind[:key=value...]"; false, если вид или ключ неизвестны
+inline bool parseSurfaceSpec(const std::string& text, SurfaceSpec& spec) {
+    spec = SurfaceSpec();
+    std::vector<std::string> parts;
+    std::istringstream stream(text);
+    for (std::string part; std::getline(stream, part, ':');) {
+        parts.push_back(part);
+    }
+    if (parts.empty()) {
+        return false;
+    }
+    spec.kind = parts[0];
+    if (spec.kind == "crumple") {
+        spec.noise = 0.4;
+    } else if (spec.kind != "plane" && spec.kind != "cylinder" && spec.kind != "folds") {
+        return false;
+    }
+    for (size_t i = 1; i < parts.size(); ++i) {
+        size_t eq = parts[i].find('=');
+        if (eq == std::string::npos) {
+            return false;
+        }
+        std::string key = parts[i].substr(0, eq);
+        double value;
+        try {
+            value = std::stod(parts[i].substr(eq + 1));
+        } catch (const std::exception&) {
+            return false;
+        }
+        if (key == "width") {
+            spec.width = value;
+        } else if (key == "height") {
+            spec.height = value;
+        } else if (key == "radius") {
+            spec.radius = std::max(value, 1e-3);
+        } else if (key == "taper") {
+            spec.taper = std::clamp(value, -0.9, 0.9);
+        } else if (key == "count") {
+            spec.count = std::max(0, static_cast<int>(value));
+        } else if (key == "angle") {
+            spec.angle = value;
+        } else if (key == "noise") {
+            spec.noise = std::max(0.0, value);
+        } else if (key == "frequency") {
+            spec.frequency = std::max(1e-3, value);
+        } else if (key == "octaves") {
+            spec.octaves = std::clamp(static_cast<int>(value), 1, 8);
+        } else if (key == "seed") {
+            spec.seed = static_cast<uint64_t>(value);
+            spec.hasSeed = true;
+        } else if (key == "cells") {
+            spec.cells = std::max(1, static_cast<int>(value));
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Генератор процедурных поверхностей: сетка строится сразу в vtkPolyData с
+// текстурными координатами (u вдоль ширины, v вдоль высоты, как у mesh.obj),
+// без OBJ и vtkTextureMapToPlane. Готовые сетки кэшируются по хэшу параметров
+// (LRU), вместе с UVIndex для аннотаций.
+class SurfaceGenerator {
+public:
+    struct Surface {
+        vtkSmartPointer<vtkPolyData> mesh;
+        std::unique_ptr<UVIndex> index;
+
+        const UVIndex& GetIndex() {
+            if (!index) {
+                index = std::make_unique<UVIndex>(mesh);
+            }
+            return *index;
+        }
+    };
+
+    explicit SurfaceGenerator(size_t capacity = 32) : capacity(std::max<size_t>(capacity, 1)) {}
+
+    // pixelsPerUnit — сколько пикселей кадра приходится на единицу длины у листа;
+    // по нему выбирается густота сетки, если cells не задан
+    Surface& Get(const SurfaceSpec& spec, double pixelsPerUnit) {
+        auto [columns, rows] = tessellation(spec, pixelsPerUnit);
+        const uint64_t key = hash(spec, columns, rows);
+        auto found = entries.find(key);
+        if (found != entries.end()) {
+            order.splice(order.begin(), order, found->second.second);
+            return found->second.first;
+        }
+        if (entries.size() >= capacity) {
+            entries.erase(order.back());
+            order.pop_back();
+        }
+        order.push_front(key);
+        Surface& surface = entries[key].first;
+        entries[key].second = order.begin();
+        surface.mesh = build(spec, columns, rows);
+        return surface;
+    }
+
+    size_t Size() const { return entries.size(); }
+
+private:
+    // Профиль листа поперек оси v: точки и нормали в плоскости xz на узлах s
+    struct Profile {
+        std::vector<double> s;
+        std::vector<std::array<double, 2>> point;
+        std::vector<std::array<double, 2>> normal;
+    };
+
+    std::pair<int, int> tessellation(const SurfaceSpec& spec, double pixelsPerUnit) const {
+        const int limit = 512;
+        if (spec.cells > 0) {
+            return {std::min(spec.cells, limit), std::min(spec.cells, limit)};
+        }
+        pixelsPerUnit = std::max(pixelsPerUnit, 1e-3);
+        // Не мельче 4 пикселей на ячейку: мельче на кадре уже не видно
+        const int finestColumns = std::max(1, static_cast<int>(std::ceil(spec.width * pixelsPerUnit / 4)));
+        const int finestRows = std::max(1, static_cast<int>(std::ceil(spec.height * pixelsPerUnit / 4)));
+        int columns = 1;
+        int rows = 1;
+        if (spec.kind == "cylinder") {
+            // Стрелка хорды сегмента не больше полупикселя
+            const double radius = spec.radius * (1 - std::abs(spec.taper) / 2);
+            const double step = 2 * std::acos(std::max(0.0, 1 - 0.5 / (pixelsPerUnit * radius)));
+            columns = static_cast<int>(std::ceil(spec.width / radius / std::max(step, 1e-6)));
+            if (spec.taper != 0) {
+                rows = std::max(1, static_cast<int>(columns * spec.height / spec.width / 2));
+            }
+        }
+        if (spec.noise > 0) {
+            // Шесть узлов на период самой мелкой октавы
+            const double wavelength = 1 / (spec.frequency * std::pow(2.0, spec.octaves - 1));
+            columns = std::max(columns, static_cast<int>(std::ceil(spec.width / wavelength * 6)));
+            rows = std::max(rows, static_cast<int>(std::ceil(spec.height / wavelength * 6)));
+        }
+        // Сгибы ложатся точно на узлы (см. foldProfile), дополнительная сетка им не нужна
+        columns = std::clamp(std::min(columns, finestColumns), 1, limit);
+        rows = std::clamp(std::min(rows, finestRows), 1, limit);
+        return {columns, rows};
+    }
+
+    static uint64_t hash(const SurfaceSpec& spec, int columns, int rows) {
+        std::ostringstream key;
+        key.precision(17);
+        key << spec.kind << ' ' << spec.width << ' ' << spec.height << ' ' << spec.center[0] << ' '
+            << spec.center[1] << ' ' << spec.center[2] << ' ' << columns << ' ' << rows << ' ' << spec.noise;
+        if (spec.kind == "cylinder") {
+            key << ' ' << spec.radius << ' ' << spec.taper;
+        }
+        if (spec.kind == "folds") {
+            key << ' ' << spec.count << ' ' << spec.angle;
+        }
+        if (spec.noise > 0) {
+            key << ' ' << spec.frequency << ' ' << spec.octaves;
+        }
+        if (spec.UsesSeed()) {
+            key << ' ' << spec.seed;
+        }
+        return HashString(key.str());
+    }
+
+    static double uniform(uint64_t seed, uint64_t index) {
+        return (CombineSeed(seed, index) >> 11) * (1.0 / 9007199254740992.0);
+    }
+
+    // Значение шума решетки со сглаживанием, сумма октав; в [-1, 1]
+    static double noiseAt(const SurfaceSpec& spec, double x, double y) {
+        double sum = 0;
+        double amplitude = 1;
+        double norm = 0;
+        double frequency = spec.frequency;
+        for (int octave = 0; octave < spec.octaves; ++octave) {
+            const double fx = x * frequency;
+            const double fy = y * frequency;
+            const double x0 = std::floor(fx);
+            const double y0 = std::floor(fy);
+            const double tx = fx - x0;
+            const double ty = fy - y0;
+            const double sx = tx * tx * (3 - 2 * tx);
+            const double sy = ty * ty * (3 - 2 * ty);
+            auto lattice = [&](double lx, double ly) {
+                uint64_t cell = (static_cast<uint64_t>(static_cast<int64_t>(lx)) << 32) ^
+                                static_cast<uint32_t>(static_cast<int64_t>(ly));
+                return uniform(spec.seed + octave, cell) * 2 - 1;
+            };
+            const double top = lattice(x0, y0) + (lattice(x0 + 1, y0) - lattice(x0, y0)) * sx;
+            const double bottom = lattice(x0, y0 + 1) + (lattice(x0 + 1, y0 + 1) - lattice(x0, y0 + 1)) * sx;
+            sum += amplitude * (top + (bottom - top) * sy);
+            norm += amplitude;
+            amplitude *= 0.5;
+            frequency *= 2;
+        }
+        return sum / norm;
+    }
+
+    // Профиль для сгибов: ломаная с сохранением длины, вершины точно на сгибах
+    static Profile foldProfile(const SurfaceSpec& spec, int columns) {
+        std::vector<double> creases;
+        for (int i = 0; i < spec.count; ++i) {
+            creases.push_back(0.1 + 0.8 * uniform(spec.seed, i));
+        }
+        std::sort(creases.begin(), creases.end());
+
+        Profile profile;
+        for (int i = 0; i <= columns; ++i) {
+            profile.s.push_back(static_cast<double>(i) / columns);
+        }
+        profile.s.insert(profile.s.end(), creases.begin(), creases.end());
+        std::sort(profile.s.begin(), profile.s.end());
+        profile.s.erase(std::unique(profile.s.begin(), profile.s.end()), profile.s.end());
+
+        // Направление сегмента меняется на каждом сгибе на случайный угол со случайным знаком
+        const double pi = std::acos(-1.0);
+        std::vector<double> heading = {0};
+        for (int i = 0; i < spec.count; ++i) {
+            const double turn = spec.angle * (0.5 + 0.5 * uniform(spec.seed, 1000 + i)) * pi / 180;
+            heading.push_back(heading.back() + (uniform(spec.seed, 2000 + i) < 0.5 ? -turn : turn));
+        }
+        std::array<double, 2> position = {0, 0};
+        size_t segment = 0;
+        double previous = 0;
+        for (double s : profile.s) {
+            while (segment < creases.size() && creases[segment] < s) {
+                const double length = (creases[segment] - previous) * spec.width;
+                position[0] += std::cos(heading[segment]) * length;
+                position[1] += std::sin(heading[segment]) * length;
+                previous = creases[segment];
+                ++segment;
+            }
+            const double length = (s - previous) * spec.width;
+            profile.point.push_back({position[0] + std::cos(heading[segment]) * length,
+                                     position[1] + std::sin(heading[segment]) * length});
+            position = profile.point.back();
+            previous = s;
+            // На самом сгибе нормаль — среднее двух сегментов
+            double angle = heading[segment];
+            if (segment < creases.size() && creases[segment] == s) {
+                angle = (heading[segment] + heading[segment + 1]) / 2;
+            }
+            profile.normal.push_back({-std::sin(angle), std::cos(angle)});
+        }
+        return profile;
+    }
+
+    static vtkSmartPointer<vtkPolyData> build(const SurfaceSpec& spec, int columns, int rows) {
+        Profile flat;
+        if (spec.kind == "folds") {
+            flat = foldProfile(spec, columns);
+        } else {
+            for (int i = 0; i <= columns; ++i) {
+                const double s = static_cast<double>(i) / columns;
+                flat.s.push_back(s);
+                flat.point.push_back({s * spec.width, 0});
+                flat.normal.push_back({0, 1});
+            }
+        }
+        // Габариты профиля центрируются в center
+        std::array<double, 2> low = flat.point[0];
+        std::array<double, 2> high = flat.point[0];
+        for (const auto& p : flat.point) {
+            for (int c = 0; c < 2; ++c) {
+                low[c] = std::min(low[c], p[c]);
+                high[c] = std::max(high[c], p[c]);
+            }
+        }
+        const std::array<double, 2> middle = {(low[0] + high[0]) / 2, (low[1] + high[1]) / 2};
+
+        const vtkIdType columnCount = static_cast<vtkIdType>(flat.s.size());
+        auto points = vtkSmartPointer<vtkPoints>::New();
+        points->SetDataTypeToFloat();
+        points->SetNumberOfPoints(columnCount * (rows + 1));
+        auto tcoords = vtkSmartPointer<vtkFloatArray>::New();
+        tcoords->SetName("TCoords");
+        tcoords->SetNumberOfComponents(2);
+        tcoords->SetNumberOfTuples(columnCount * (rows + 1));
+
+        for (int j = 0; j <= rows; ++j) {
+            const double t = static_cast<double>(j) / rows;
+            const double y = (t - 0.5) * spec.height;
+            for (vtkIdType i = 0; i < columnCount; ++i) {
+                const double s = flat.s[i];
+                double x = flat.point[i][0] - middle[0];
+                double z = flat.point[i][1] - middle[1];
+                double nx = flat.normal[i][0];
+                double nz = flat.normal[i][1];
+                if (spec.kind == "cylinder") {
+                    // Дуга с сохранением длины; ось за листом, края уходят от камеры
+                    const double radius = spec.radius * (1 + spec.taper * (t - 0.5));
+                    const double theta = (s - 0.5) * spec.width / radius;
+                    x = radius * std::sin(theta);
+                    z = radius * (1 - std::cos(theta));
+                    nx = -std::sin(theta);
+                    nz = std::cos(theta);
+                }
+                if (spec.noise > 0) {
+                    const double offset = spec.noise * noiseAt(spec, s * spec.width, t * spec.height);
+                    x += nx * offset;
+                    z += nz * offset;
+                }
+                const vtkIdType id = j * columnCount + i;
+                points->SetPoint(id, spec.center[0] + x, spec.center[1] + y, spec.center[2] + z);
+                tcoords->SetTuple2(id, s, t);
+            }
+        }
+
+        auto polys = vtkSmartPointer<vtkCellArray>::New();
+        for (int j = 0; j < rows; ++j) {
+            for (vtkIdType i = 0; i + 1 < columnCount; ++i) {
+                const vtkIdType a = j * columnCount + i;
+                const vtkIdType b = a + 1;
+                const vtkIdType c = a + columnCount + 1;
+                const vtkIdType d = a + columnCount;
+                const vtkIdType first[3] = {a, b, c};
+                const vtkIdType second[3] = {a, c, d};
+                polys->InsertNextCell(3, first);
+                polys->InsertNextCell(3, second);
+            }
+        }
+
+        auto mesh = vtkSmartPointer<vtkPolyData>::New();
+        mesh->SetPoints(points);
+        mesh->SetPolys(polys);
+        mesh->GetPointData()->SetTCoords(tcoords);
+        return mesh;
+    }
+
+    size_t capacity;
+    std::list<uint64_t> order; // от недавних к давним
+    std::unordered_map<uint64_t, std::pair<Surface, std::list<uint64_t>::iterator>> entries;
+};
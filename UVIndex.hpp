@@ -0,0 +1,148 @@
+#pragma once
+
+#include <vtkDataArray.h>
+#include <vtkPointData.h>
+#include <vtkPoints.h>
+#include <vtkPolyData.h>
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <memory>
+#include <vector>
+
+// Барицентрические координаты точки (x, y) в треугольнике без выделения памяти
+inline std::array<double, 3> computeBarycentricCoordinates(double x, double y,
+                                                           double x1, double y1,
+                                                           double x2, double y2,
+                                                           double x3, double y3) {
+    double detT = (y2 - y3)*(x1 - x3) + (x3 - x2)*(y1 - y3);
+    double lambda1 = ((y2 - y3)*(x - x3) + (x3 - x2)*(y - y3)) / detT;
+    double lambda2 = ((y3 - y1)*(x - x3) + (x1 - x3)*(y - y3)) / detT;
+    double lambda3 = 1.0 - lambda1 - lambda2;
+    return {lambda1, lambda2, lambda3};
+}
+
+// Индекс треугольников меша в текстурном пространстве: равномерная сетка над
+// UV-габаритами треугольников. Строится один раз на меш, после чего поиск
+// треугольника под UV-точкой стоит O(1) в среднем и не выделяет память.
+class UVIndex {
+public:
+    explicit UVIndex(vtkPolyData* mesh) {
+        vtkPoints* points = mesh->GetPoints();
+        vtkDataArray* tcoords = mesh->GetPointData()->GetTCoords();
+        if (!points || !tcoords) {
+            return;
+        }
+
+        vtkIdType pointCount = points->GetNumberOfPoints();
+        positions.resize(pointCount * 3);
+        uvs.resize(pointCount * 2);
+        for (vtkIdType i = 0; i < pointCount; ++i) {
+            points->GetPoint(i, &positions[i * 3]);
+            uvs[i * 2] = tcoords->GetComponent(i, 0);
+            uvs[i * 2 + 1] = tcoords->GetComponent(i, 1);
+        }
+
+        // Многоугольники режем веером, чтобы в индексе были только треугольники
+        for (vtkIdType i = 0; i < mesh->GetNumberOfCells(); ++i) {
+            vtkIdType npts;
+            const vtkIdType* pts;
+            mesh->GetCellPoints(i, npts, pts);
+            for (vtkIdType j = 2; j < npts; ++j) {
+                triangles.push_back({pts[0], pts[j - 1], pts[j]});
+            }
+        }
+        if (triangles.empty()) {
+            return;
+        }
+
+        minU = maxU = uvs[0];
+        minV = maxV = uvs[1];
+        for (size_t i = 0; i < uvs.size(); i += 2) {
+            minU = std::min(minU, uvs[i]);
+            maxU = std::max(maxU, uvs[i]);
+            minV = std::min(minV, uvs[i + 1]);
+            maxV = std::max(maxV, uvs[i + 1]);
+        }
+
+        // Около одного треугольника на ячейку
+        gridSize = std::max(1, static_cast<int>(std::sqrt(static_cast<double>(triangles.size()))));
+        scaleU = gridSize / std::max(maxU - minU, 1e-12);
+        scaleV = gridSize / std::max(maxV - minV, 1e-12);
+
+        // Раскладываем треугольники по ячейкам в формате CSR: сначала считаем, потом заполняем
+        cellStart.assign(gridSize * gridSize + 1, 0);
+        forEachCell([&](int cell, size_t) { ++cellStart[cell + 1]; });
+        for (size_t i = 1; i < cellStart.size(); ++i) {
+            cellStart[i] += cellStart[i - 1];
+        }
+        cellTriangles.resize(cellStart.back());
+        std::vector<int> fill(cellStart.begin(), cellStart.end() - 1);
+        forEachCell([&](int cell, size_t triangle) { cellTriangles[fill[cell]++] = static_cast<int>(triangle); });
+    }
+
+    UVIndex(const UVIndex&) = delete;
+
+    // Находит 3D точку меша под текстурной координатой (u, v)
+    bool Lookup(double u, double v, double out[3]) const {
+        if (triangles.empty() || u < minU || u > maxU || v < minV || v > maxV) {
+            return false;
+        }
+        int cell = cellOf(v, scaleV, minV) * gridSize + cellOf(u, scaleU, minU);
+        for (int k = cellStart[cell]; k < cellStart[cell + 1]; ++k) {
+            const auto& tri = triangles[cellTriangles[k]];
+            const double* t1 = &uvs[tri[0] * 2];
+            const double* t2 = &uvs[tri[1] * 2];
+            const double* t3 = &uvs[tri[2] * 2];
+            auto bary = computeBarycentricCoordinates(u, v, t1[0], t1[1], t2[0], t2[1], t3[0], t3[1]);
+
+            // Проверка валидности барицентрических координат (вырожденные треугольники дают NaN)
+            if (!(bary[0] >= 0 && bary[1] >= 0 && bary[2] >= 0)) {
+                continue;
+            }
+
+            // Интерполируем координаты в 3D пространстве
+            const double* p1 = &positions[tri[0] * 3];
+            const double* p2 = &positions[tri[1] * 3];
+            const double* p3 = &positions[tri[2] * 3];
+            for (int c = 0; c < 3; ++c) {
+                out[c] = bary[0] * p1[c] + bary[1] * p2[c] + bary[2] * p3[c];
+            }
+            return true;
+        }
+        return false;
+    }
+
+    size_t GetNumberOfTriangles() const { return triangles.size(); }
+
+private:
+    int cellOf(double value, double scale, double min) const {
+        return std::clamp(static_cast<int>((value - min) * scale), 0, gridSize - 1);
+    }
+
+    template <class F>
+    void forEachCell(F&& f) const {
+        for (size_t i = 0; i < triangles.size(); ++i) {
+            const auto& tri = triangles[i];
+            double u0 = std::min({uvs[tri[0] * 2], uvs[tri[1] * 2], uvs[tri[2] * 2]});
+            double u1 = std::max({uvs[tri[0] * 2], uvs[tri[1] * 2], uvs[tri[2] * 2]});
+            double v0 = std::min({uvs[tri[0] * 2 + 1], uvs[tri[1] * 2 + 1], uvs[tri[2] * 2 + 1]});
+            double v1 = std::max({uvs[tri[0] * 2 + 1], uvs[tri[1] * 2 + 1], uvs[tri[2] * 2 + 1]});
+            for (int cv = cellOf(v0, scaleV, minV); cv <= cellOf(v1, scaleV, minV); ++cv) {
+                for (int cu = cellOf(u0, scaleU, minU); cu <= cellOf(u1, scaleU, minU); ++cu) {
+                    f(cv * gridSize + cu, i);
+                }
+            }
+        }
+    }
+
+    std::vector<double> positions;
+    std::vector<double> uvs;
+    std::vector<std::array<vtkIdType, 3>> triangles;
+
+    double minU = 0, maxU = 0, minV = 0, maxV = 0;
+    double scaleU = 1, scaleV = 1;
+    int gridSize = 0;
+    std::vector<int> cellStart;
+    std::vector<int> cellTriangles;
+};
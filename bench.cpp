@@ -0,0 +1,133 @@
+#include <benchmark/benchmark.h>
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Annotation.hpp"
+#include "AsyncWriter.hpp"
+#include "Projector.hpp"
+#include "Render.hpp"
+#include "Scene.hpp"
+
+// Макробенчмарки рендера и аннотации: поиск 3D-точек штрих-кода по UV (раньше
+// get_barcode_3d_corners), их проекция в кадр (раньше display_compute) и полный
+// кадр — рендер, аннотация, кодирование и запись. Рендер идет на бэкенде cpu,
+// чтобы бенчмарк не зависел от OpenGL-контекста. Счетчики — пиксели и сэмплы в
+// секунду; JSON для сравнения прогонов:
+//   ./build/bench --benchmark_out=bench.json --benchmark_out_format=json
+
+static const std::string SOURCE_DIR = BENCH_SOURCE_DIR;
+
+// Поверхности: пусто — mesh.obj, дальше процедурные поверхности с постоянным seed
+static const std::vector<std::string> SURFACES = {"", "cylinder", "crumple:seed=1"};
+
+static Sample benchSample(int64_t surface, int height) {
+    Sample sample;
+    sample.barcode = SOURCE_DIR + "/QR-Noize/test/0.jpg";
+    sample.background = SOURCE_DIR + "/photos/Screenshot.jpg";
+    sample.position = {0.2, 0.3};
+    sample.surface = SURFACES[surface];
+    sample.width = height * 4 / 3;
+    sample.height = height;
+    return sample;
+}
+
+static SceneOptions benchOptions() {
+    SceneOptions options;
+    options.backend = RenderBackend::Cpu;
+    return options;
+}
+
+// pixels — пикселей кадра на итерацию, points — точек аннотации
+static void setCounters(benchmark::State& state, double pixels, double points) {
+    const double samples = static_cast<double>(state.iterations());
+    state.counters["samples/s"] = benchmark::Counter(samples, benchmark::Counter::kIsRate);
+    if (pixels > 0) {
+        state.counters["pixels/s"] = benchmark::Counter(samples * pixels, benchmark::Counter::kIsRate);
+    }
+    if (points > 0) {
+        state.counters["points/s"] = benchmark::Counter(samples * points, benchmark::Counter::kIsRate);
+    }
+}
+
+// Аргументы: поверхность, сетка ключевых точек
+static void BM_UVPoints(benchmark::State& state) {
+    Scene scene(SOURCE_DIR + "/mesh.obj", benchOptions());
+    if (!scene.Render(benchSample(state.range(0), 480))) {
+        state.SkipWithError("Can't render the sample");
+        return;
+    }
+    const std::vector<float> uvs = get_barcode_uv_keypoints(scene.GetBarcodeBox(), static_cast<int>(state.range(1)));
+    const UVIndex& index = scene.GetUVIndex();
+    std::vector<float> points;
+    std::vector<uint8_t> found;
+    for (auto _ : state) {
+        get_uv_3d_points(index, uvs, points, found);
+        benchmark::DoNotOptimize(points.data());
+    }
+    setCounters(state, 0, static_cast<double>(found.size()));
+}
+
+// Аргументы: сетка ключевых точек, проверка по z-буферу
+static void BM_Project(benchmark::State& state) {
+    Scene scene(SOURCE_DIR + "/mesh.obj", benchOptions());
+    if (!scene.Render(benchSample(0, 480))) {
+        state.SkipWithError("Can't render the sample");
+        return;
+    }
+    const std::vector<float> uvs = get_barcode_uv_keypoints(scene.GetBarcodeBox(), static_cast<int>(state.range(0)));
+    std::vector<float> points;
+    std::vector<uint8_t> found;
+    get_uv_3d_points(scene.GetUVIndex(), uvs, points, found);
+    const size_t count = found.size();
+    std::vector<float> xy(count * 2);
+    std::vector<float> depth(count);
+    std::vector<uint8_t> visible(count);
+    const DepthView zbuffer = scene.CaptureDepth();
+    for (auto _ : state) {
+        Projector projector(scene.GetModelViewProjection(), scene.GetWidth(), scene.GetHeight());
+        projector.Project(points.data(), count, xy.data(), depth.data());
+        projector.Visibility(xy.data(), depth.data(), count, state.range(1) ? &zbuffer : nullptr, 1e-4f,
+                             visible.data());
+        benchmark::DoNotOptimize(visible.data());
+    }
+    setCounters(state, 0, static_cast<double>(count));
+}
+
+// Полный кадр, как в пакетном режиме. Аргументы: поверхность, кодек (0 — raw,
+// 1 — png), высота кадра. Кадры пишутся в шарды во временной папке; время
+// включает ожидание, пока кодировщики допишут последний кадр
+static void BM_RenderFrame(benchmark::State& state) {
+    const std::filesystem::path directory = std::filesystem::temp_directory_path() / "Tutorial_Step6_bench";
+    std::filesystem::create_directories(directory);
+    const Sample sample = benchSample(state.range(0), static_cast<int>(state.range(2)));
+    CodecOptions codec;
+    codec.codec = state.range(1) ? Codec::Png : Codec::Raw;
+    AnnotationOptions annotation;
+    annotation.grid = 16;
+
+    Scene scene(SOURCE_DIR + "/mesh.obj", benchOptions());
+    ShardWriter shards((directory / "frames").string(), uint64_t(1) << 40);
+    AsyncWriter writer(makeEncoder(codec), CodecExtension(codec.codec), 2, 0, &shards);
+    bool ok = true;
+    for (auto _ : state) {
+        ok = renderSample(scene, writer, sample, annotation) && ok;
+    }
+    writer.Wait();
+    shards.Close();
+    std::filesystem::remove_all(directory);
+    if (!ok || writer.Failed() > 0) {
+        state.SkipWithError("Can't render or write a frame");
+        return;
+    }
+    setCounters(state, static_cast<double>(sample.width) * sample.height, 0);
+}
+
+BENCHMARK(BM_UVPoints)->ArgsProduct({{0, 1, 2}, {0, 16, 64, 256}});
+BENCHMARK(BM_Project)->ArgsProduct({{0, 16, 64, 256}, {0, 1}});
+BENCHMARK(BM_RenderFrame)->ArgsProduct({{0, 1, 2}, {0, 1}, {480, 960}})->Unit(benchmark::kMillisecond)->UseRealTime();
+
+BENCHMARK_MAIN();
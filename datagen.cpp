@@ -0,0 +1,388 @@
+#include <vtkImageData.h>
+#include <vtkSmartPointer.h>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "AsyncWriter.hpp"
+#include "Channel.hpp"
+#include "ImageCache.hpp"
+#include "ImageStore.hpp"
+#include "Manifest.hpp"
+#include "Render.hpp"
+#include "Scene.hpp"
+#include "Seeds.hpp"
+#include "Trace.hpp"
+
+#include <Distortions.hpp>
+#include <Generate.hpp>
+#include <NoizeConfig.hpp>
+#include <Validate.hpp>
+
+// Весь датасет одним процессом, вместо run.sh с imgen, Python-скриптами и
+// процессом рендерера на каждый шаг. Стадии идут одновременно и связаны
+// ограниченными очередями (Channel), промежуточные картинки не попадают на диск:
+//   symbol  — штрих-код из generate.config кодируется в памяти (zxing-cpp)
+//   noise   — каждый стек из noize.config зашумляет свою копию, по желанию с валидацией
+//   render  — зашумленный штрих-код вклеивается в текстуру и рендерится на каждом фоне,
+//             с аннотацией; у каждого потока своя Scene
+//   write   — кодирование и запись в фоне (AsyncWriter)
+// Работа — тройки (штрих-код, стек, фон). Имена, зерна и раздел между машинами
+// (--shard, --seed) считаются от тройки, так что результат не зависит ни от
+// числа потоков, ни от порядка, в котором стадии успели обработать данные.
+
+namespace fs = std::filesystem;
+
+// Штрих-код после кодирования
+struct Symbol {
+    size_t spec;
+    cv::Mat image;
+};
+
+// Штрих-код после стека: уже снизу вверх, как его ждет Scene
+struct Noised {
+    std::string name; // <номер штрих-кода>_<стек>, как у файлов imgen
+    vtkSmartPointer<vtkImageData> image;
+};
+
+// Один кадр: зашумленный штрих-код на одном фоне
+struct RenderJob {
+    std::shared_ptr<const Noised> barcode;
+    size_t background;
+};
+
+// OpenCV хранит строки сверху вниз, VTK — снизу вверх
+vtkSmartPointer<vtkImageData> toVtkImage(const cv::Mat& image) {
+    auto converted = vtkSmartPointer<vtkImageData>::New();
+    converted->SetDimensions(image.cols, image.rows, 1);
+    converted->AllocateScalars(VTK_UNSIGNED_CHAR, image.channels());
+    auto* target = static_cast<uint8_t*>(converted->GetScalarPointer());
+    const size_t rowBytes = static_cast<size_t>(image.cols) * image.elemSize();
+    for (int y = 0; y < image.rows; ++y) {
+        std::memcpy(target + rowBytes * (image.rows - 1 - y), image.ptr<uint8_t>(y), rowBytes);
+    }
+    return converted;
+}
+
+// Фоны: файлы как есть, из папок — все .jpg/.jpeg/.png по алфавиту
+std::vector<std::string> listBackgrounds(const std::vector<std::string>& paths) {
+    std::vector<std::string> backgrounds;
+    for (const auto& path : paths) {
+        if (!fs::is_directory(path)) {
+            backgrounds.push_back(path);
+            continue;
+        }
+        std::vector<std::string> found;
+        for (const auto& entry : fs::directory_iterator(path)) {
+            const std::string extension = entry.path().extension().string();
+            if (extension == ".jpg" || extension == ".jpeg" || extension == ".png") {
+                found.push_back(entry.path().string());
+            }
+        }
+        std::sort(found.begin(), found.end());
+        backgrounds.insert(backgrounds.end(), found.begin(), found.end());
+    }
+    return backgrounds;
+}
+
+void printUsage(const char* program) {
+    std::cerr << "Usage:\n"
+              << "  " << program << " [options] <generate config> <noize config> <background or dir>...\n"
+              << "Stages:\n"
+              << "  --symbol-threads N  threads encoding barcodes (1)\n"
+              << "  --noise-threads N   threads running the noize stacks (half of the cores)\n"
+              << "  --render-threads N  threads rendering and annotating, one scene each (1; more than\n"
+              << "                      one needs --backend cpu or an EGL/OSMesa build of VTK)\n"
+              << "  --encoders N        background encoder threads (2)\n"
+              << "  --queue N           capacity of every queue between the stages (4 per consumer thread)\n"
+              << "Options:\n"
+              << "  --size WxH, --backend vtk|cpu, --threads N, --surface S, --keypoints N, --occlusion,\n"
+              << "  --codec C, --shards P, --shard-size MB, --store S, --image-cache MB, --trace F,\n"
+              << "  --stats S, --log-level L, --shard i/N, --seed S   as in Tutorial_Step6\n"
+              << "  --scale MIN:MAX     random scale of the barcode on the texture (0.8:1.2)\n"
+              << "  --validate          decode every noised barcode, validation.json in the output directory\n"
+              << "  --drop-unreadable   don't render barcodes that can't be decoded\n";
+}
+
+int main(int argc, char* argv[]) {
+    std::vector<std::string> positional;
+    SceneOptions options;
+    options.offscreen = true;
+    std::string shardPrefix;
+    uint64_t shardBytes = DEFAULT_SHARD_BYTES;
+    CodecOptions codec;
+    size_t encoders = 2;
+    size_t queue = 0;
+    AnnotationOptions annotation;
+    std::string storePath;
+    std::string tracePath;
+    double statsSeconds = 0;
+    WorkShard shard;
+    uint64_t seed = 0;
+    std::array<double, 2> scale = {0.8, 1.2};
+    bool validate = false;
+    bool dropUnreadable = false;
+    const size_t cores = std::max(1u, std::thread::hardware_concurrency());
+    size_t symbolThreads = 1;
+    size_t noiseThreads = std::max<size_t>(1, cores / 2);
+    size_t renderThreads = 1;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--size" && i + 1 < argc) {
+            auto size = split(argv[++i], 'x');
+            if (size.size() != 2) {
+                printUsage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            options.width = std::stoi(size[0]);
+            options.height = std::stoi(size[1]);
+        } else if (arg == "--backend" && i + 1 < argc) {
+            std::string backend = argv[++i];
+            if (backend != "vtk" && backend != "cpu") {
+                printUsage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            options.backend = backend == "cpu" ? RenderBackend::Cpu : RenderBackend::Vtk;
+        } else if (arg == "--threads" && i + 1 < argc) {
+            options.threads = std::stoi(argv[++i]);
+        } else if (arg == "--surface" && i + 1 < argc) {
+            options.surface = argv[++i];
+            SurfaceSpec spec;
+            if (!parseSurfaceSpec(options.surface, spec)) {
+                printUsage(argv[0]);
+                return EXIT_FAILURE;
+            }
+        } else if (arg == "--shards" && i + 1 < argc) {
+            shardPrefix = argv[++i];
+        } else if (arg == "--shard-size" && i + 1 < argc) {
+            shardBytes = std::max<uint64_t>(1, std::stoull(argv[++i])) << 20;
+        } else if (arg == "--codec" && i + 1 < argc) {
+            if (!ParseCodec(argv[++i], codec)) {
+                printUsage(argv[0]);
+                return EXIT_FAILURE;
+            }
+        } else if (arg == "--keypoints" && i + 1 < argc) {
+            annotation.grid = std::max(0, std::stoi(argv[++i]));
+        } else if (arg == "--occlusion") {
+            annotation.occlusion = true;
+        } else if (arg == "--encoders" && i + 1 < argc) {
+            encoders = std::max(1, std::stoi(argv[++i]));
+        } else if (arg == "--queue" && i + 1 < argc) {
+            queue = std::max(1, std::stoi(argv[++i]));
+        } else if (arg == "--store" && i + 1 < argc) {
+            storePath = argv[++i];
+        } else if (arg == "--image-cache" && i + 1 < argc) {
+            options.imageCacheBytes = static_cast<size_t>(std::max(0, std::stoi(argv[++i]))) << 20;
+        } else if (arg == "--trace" && i + 1 < argc) {
+            tracePath = argv[++i];
+        } else if (arg == "--stats" && i + 1 < argc) {
+            statsSeconds = std::max(0.0, std::stod(argv[++i]));
+        } else if (arg == "--log-level" && i + 1 < argc) {
+            LogLevel level;
+            if (!ParseLogLevel(argv[++i], level)) {
+                printUsage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            SetLogLevel(level);
+        } else if (arg == "--shard" && i + 1 < argc) {
+            if (!ParseWorkShard(argv[++i], shard)) {
+                printUsage(argv[0]);
+                return EXIT_FAILURE;
+            }
+        } else if (arg == "--seed" && i + 1 < argc) {
+            seed = std::stoull(argv[++i]);
+        } else if (arg == "--scale" && i + 1 < argc) {
+            auto range = split(argv[++i], ':');
+            if (range.size() != 2) {
+                printUsage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            scale = {std::stod(range[0]), std::stod(range[1])};
+        } else if (arg == "--validate") {
+            validate = true;
+        } else if (arg == "--drop-unreadable") {
+            validate = true;
+            dropUnreadable = true;
+        } else if (arg == "--symbol-threads" && i + 1 < argc) {
+            symbolThreads = std::max(1, std::stoi(argv[++i]));
+        } else if (arg == "--noise-threads" && i + 1 < argc) {
+            noiseThreads = std::max(1, std::stoi(argv[++i]));
+        } else if (arg == "--render-threads" && i + 1 < argc) {
+            renderThreads = std::max(1, std::stoi(argv[++i]));
+        } else {
+            positional.push_back(arg);
+        }
+    }
+    if (positional.size() < 3) {
+        printUsage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    const std::vector<BarcodeSpec> specs = ParseGenerateConfig(positional[0]);
+    std::vector<NamedStack> stacks = ParseNoizeConfig(positional[1]);
+    const std::vector<std::string> backgrounds =
+            listBackgrounds(std::vector<std::string>(positional.begin() + 2, positional.end()));
+    if (specs.empty() || stacks.empty() || backgrounds.empty()) {
+        std::cerr << "Нет штрих-кодов, стеков или фонов" << std::endl;
+        return EXIT_FAILURE;
+    }
+    // --seed сдвигает шум стеков так же, как в imgen
+    if (seed != 0) {
+        for (auto& named : stacks) {
+            named.stack->SetSeed(CombineSeed(seed, named.stack->GetSeed()));
+        }
+    }
+
+    // Ключ тройки — от имени штрих-кода и фона; хэши фонов считаются один раз
+    std::vector<uint64_t> backgroundKeys;
+    for (const auto& background : backgrounds) {
+        backgroundKeys.push_back(HashString(background));
+    }
+    auto tupleKey = [&](const std::string& barcode, size_t background) {
+        return CombineSeed(HashString(barcode), backgroundKeys[background]);
+    };
+    auto ownsAny = [&](const std::string& barcode) {
+        const uint64_t barcodeKey = HashString(barcode);
+        for (uint64_t backgroundKey : backgroundKeys) {
+            if (shard.Owns(CombineSeed(barcodeKey, backgroundKey))) {
+                return true;
+            }
+        }
+        return false;
+    };
+
+    const std::string outputDir = shardPrefix.empty() ? std::string("data")
+            : fs::path(shardPrefix).parent_path().string();
+    if (!outputDir.empty()) {
+        fs::create_directories(outputDir);
+    }
+    std::unique_ptr<Validator> validator;
+    if (validate) {
+        validator = std::make_unique<Validator>(outputDir.empty() ? "." : outputDir);
+    }
+    std::unique_ptr<ImageStore> store;
+    if (!storePath.empty()) {
+        store = std::make_unique<ImageStore>(storePath);
+        options.store = store.get();
+    }
+    // Один кэш фонов на все сцены, у каждой из них он был бы свой
+    ImageCache<vtkSmartPointer<vtkImageData>> images(options.imageCacheBytes);
+    options.images = &images;
+
+    std::unique_ptr<ShardWriter> shards;
+    if (!shardPrefix.empty()) {
+        shards = std::make_unique<ShardWriter>(shardPrefix, shardBytes);
+    }
+    AsyncWriter writer(makeEncoder(codec), CodecExtension(codec.codec), encoders, queue, shards.get());
+
+    TraceStart(tracePath, statsSeconds, std::cout);
+    Channel<Symbol> symbols(queue > 0 ? queue : 4 * noiseThreads);
+    Channel<RenderJob> jobs(queue > 0 ? queue : 4 * renderThreads);
+    std::atomic<size_t> nextSpec{0};
+    std::atomic<size_t> rendered{0};
+    std::atomic<size_t> failed{0};
+
+    // Потоки стадий создаются в порядке данных, а останавливаются по цепочке:
+    // последний поток стадии закрывает ее выходную очередь
+    Stage symbolStage(symbolThreads, [&](size_t) {
+        for (size_t i = nextSpec++; i < specs.size(); i = nextSpec++) {
+            // Штрих-коды, у которых нет ни одной тройки в этом шарде, не кодируются
+            bool owned = false;
+            for (const auto& named : stacks) {
+                owned = owned || ownsAny(specs[i].name + "_" + named.name);
+            }
+            if (!owned) {
+                continue;
+            }
+            cv::Mat image;
+            {
+                TRACE_SCOPE("symbol");
+                image = RenderBarcode(specs[i]);
+            }
+            if (image.empty()) {
+                ++failed;
+                continue;
+            }
+            symbols.Push({i, std::move(image)});
+            TRACE_GAUGE("symbol queue", symbols.Size());
+        }
+    }, [&] { symbols.Close(); });
+
+    Stage noiseStage(noiseThreads, [&](size_t) {
+        cv::Mat image;
+        for (Symbol symbol; symbols.Pop(symbol);) {
+            const BarcodeSpec& spec = specs[symbol.spec];
+            // Шум картинки зависит от ее имени, как в imgen --generate
+            const uint64_t sample = HashString(spec.name);
+            for (const auto& named : stacks) {
+                auto noised = std::make_shared<Noised>();
+                noised->name = spec.name + "_" + named.name;
+                if (!ownsAny(noised->name)) {
+                    continue;
+                }
+                {
+                    TRACE_SCOPE("distort");
+                    symbol.image.copyTo(image);
+                    named.stack->ProcessImage(image, sample);
+                }
+                if (validator) {
+                    TRACE_SCOPE("validate");
+                    if (!validator->Validate(noised->name, named.name, image, dropUnreadable) && dropUnreadable) {
+                        continue;
+                    }
+                }
+                noised->image = toVtkImage(image);
+                std::shared_ptr<const Noised> barcode = std::move(noised);
+                for (size_t background = 0; background < backgrounds.size(); ++background) {
+                    if (shard.Owns(tupleKey(barcode->name, background))) {
+                        jobs.Push({barcode, background});
+                        TRACE_GAUGE("render queue", jobs.Size());
+                    }
+                }
+            }
+        }
+    }, [&] { jobs.Close(); });
+
+    Stage renderStage(renderThreads, [&](size_t) {
+        Scene scene("mesh.obj", options);
+        for (RenderJob job; jobs.Pop(job);) {
+            Sample sample;
+            sample.barcode = job.barcode->name; // только имя, пиксели из памяти
+            sample.background = backgrounds[job.background];
+            sample.scale = scale;
+            sample.seed = CombineSeed(seed, tupleKey(sample.barcode, job.background));
+            if (renderSample(scene, writer, sample, annotation, job.barcode->image)) {
+                ++rendered;
+            } else {
+                ++failed;
+            }
+        }
+    });
+
+    symbolStage.Join();
+    noiseStage.Join();
+    renderStage.Join();
+    writer.Wait();
+    TraceStop(std::cout);
+    writer.Report(std::cout);
+    images.Report(std::cout);
+    if (validator) {
+        validator->Finish();
+    }
+    if (shards) {
+        shards->Close();
+    }
+    failed += writer.Failed();
+    std::cout << "Rendered " << rendered << " samples, " << failed << " failed\n";
+    return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -1,325 +1,237 @@
-#include <vtkActor.h>
-#include <vtkCamera.h>
-#include <vtkInteractorStyleTrackballCamera.h>
-#include <vtkJPEGReader.h>
-#include <vtkNew.h>
-#include <vtkOBJReader.h>
-#include <vtkPolyDataMapper.h>
-#include <vtkProperty.h>
-#include <vtkRenderWindow.h>
-#include <vtkRenderWindowInteractor.h>
-#include <vtkRenderer.h>
-#include <vtkTexture.h>
-#include <vtkTransform.h>
-#include <vtkTextureMapToPlane.h>
-#include <vtkCoordinate.h>
-#include <vtkPointData.h>
-#include <vtkPNGWriter.h>
-#include <vtkWindowToImageFilter.h>
-#include <vtkImageActor.h>
-#include <vtkImageReader2.h>
-#include <vtkImageReader2Factory.h>
-#include <vtkImageMapper3D.h>
 #include <vtkImageData.h>
-#include <vector>
-#include <tuple>
+#include <vtkSmartPointer.h>
+#include <cstdint>
+#include <cstdlib>
 #include <iostream>
-#include <fstream>
-#include <random>
-
-// Вспомогательная функция для вычисления барицентрических координат
-std::vector<double> computeBarycentricCoordinates(double x, double y,
-                                                  double x1, double y1,
-                                                  double x2, double y2,
-                                                  double x3, double y3) {
-    double detT = (y2 - y3)*(x1 - x3) + (x3 - x2)*(y1 - y3);
-    double lambda1 = ((y2 - y3)*(x - x3) + (x3 - x2)*(y - y3)) / detT;
-    double lambda2 = ((y3 - y1)*(x - x3) + (x1 - x3)*(y - y3)) / detT;
-    double lambda3 = 1.0 - lambda1 - lambda2;
-    return {lambda1, lambda2, lambda3};
-}
-
-// Функция для извлечения 3D точек, соответствующих углам штрих-кода
-std::vector<std::vector<double>> get_barcode_3d_corners(vtkPolyData* mesh, std::vector<const char*> barcodeCoords) {
-    std::vector<std::vector<double>> barcode_3d_points;
-
-    // Нормализованные границы текстурных координат штрих-кода
-    double top_left[2] = { std::stod(barcodeCoords[0]), std::stod(barcodeCoords[1]) };
-    double bottom_right[2] = { std::stod(barcodeCoords[2]), std::stod(barcodeCoords[3]) };
-
-    std::cout << "Top left: (" << top_left[0] << ", " << top_left[1] << ")\n";
-    std::cout << "Bottom right: (" << bottom_right[0] << ", " << bottom_right[1] << ")\n";
-
-    vtkPoints* points = mesh->GetPoints();
-    vtkDataArray* tcoords = mesh->GetPointData()->GetTCoords();
-
-    if (!points || !tcoords) {
-        std::cerr << "Error: Points or texture coordinates not found." << std::endl;
-        return barcode_3d_points; // Вернуть пустой вектор, если точки или текстурные координаты не найдены
-    }
-
-    std::cout << "Number of points: " << points->GetNumberOfPoints() << std::endl;
-    std::cout << "Number of cells: " << mesh->GetNumberOfCells() << std::endl;
-
-    // Поиск треугольников, пересекающих границы штрих-кода
-    for (vtkIdType i = 0; i < mesh->GetNumberOfCells(); ++i) {
-        vtkCell* cell = mesh->GetCell(i);
-        vtkIdList* ptIds = cell->GetPointIds();
+#include <memory>
+#include <string>
+#include <vector>
 
-        if (ptIds->GetNumberOfIds() != 3) {
-            continue; // Пропускаем, если не треугольник
+#include "AsyncWriter.hpp"
+#include "ImageStore.hpp"
+#include "Manifest.hpp"
+#include "Render.hpp"
+#include "Scene.hpp"
+#include "Seeds.hpp"
+#include "Trace.hpp"
+
+// Декодирует картинки один раз и складывает пиксели в ImageStore, который потом
+// отображают в память все рендереры узла (--store)
+int buildImageStore(const std::string& path, const std::vector<std::string>& images) {
+    ImageStoreWriter store(path);
+    size_t failed = 0;
+    for (const auto& source : images) {
+        vtkSmartPointer<vtkImageData> image = Scene::ReadImage(source);
+        int dims[3];
+        if (image) {
+            image->GetDimensions(dims);
         }
-
-        // Получаем координаты точек треугольника
-        double pt1[3], pt2[3], pt3[3];
-        double tc1[3], tc2[3], tc3[3];
-        points->GetPoint(ptIds->GetId(0), pt1);
-        points->GetPoint(ptIds->GetId(1), pt2);
-        points->GetPoint(ptIds->GetId(2), pt3);
-        tcoords->GetTuple(ptIds->GetId(0), tc1);
-        tcoords->GetTuple(ptIds->GetId(1), tc2);
-        tcoords->GetTuple(ptIds->GetId(2), tc3);
-
-        std::cout << "Triangle " << i << ":\n";
-        std::cout << "  Point 1: (" << pt1[0] << ", " << pt1[1] << ", " << pt1[2] << "), Texture Coords: (" << tc1[0] << ", " << tc1[1] << ")\n";
-        std::cout << "  Point 2: (" << pt2[0] << ", " << pt2[1] << ", " << pt2[2] << "), Texture Coords: (" << tc2[0] << ", " << tc2[1] << ")\n";
-        std::cout << "  Point 3: (" << pt3[0] << ", " << pt3[1] << ", " << pt3[2] << "), Texture Coords: (" << tc3[0] << ", " << tc3[1] << ")\n";
-
-        // Проверка, попадают ли текстурные координаты в границы штрих-кода
-        bool intersects = false;
-        for (int j = 0; j < 3; ++j) {
-            double* tc = (j == 0) ? tc1 : (j == 1) ? tc2 : tc3;
-            if (tc[0] >= top_left[0] && tc[0] <= bottom_right[0]) {
-                intersects = true;
-                break;
-            }
+        if (!image || !store.Add(source, static_cast<const uint8_t*>(image->GetScalarPointer()), dims[0], dims[1],
+                                 image->GetNumberOfScalarComponents(), true)) {
+            std::cerr << "Не удалось добавить в хранилище: " << source << std::endl;
+            ++failed;
         }
+    }
+    if (!store.Close()) {
+        return EXIT_FAILURE;
+    }
+    std::cout << "Stored " << store.Size() << " images in " << path << "\n";
+    return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
 
-        std::cout << "  Intersects with barcode bounding box: " << (intersects ? "Yes" : "No") << std::endl;
-
-        if (intersects) {
-            // Находим барицентрические координаты углов штрих-кода
-            std::vector<double> barcodeCorners = {
-                    top_left[0], top_left[1],
-                    bottom_right[0], top_left[1],
-                    bottom_right[0], bottom_right[1],
-                    top_left[0], bottom_right[1]
-            };
-
-            for (size_t j = 0; j < barcodeCorners.size(); j += 2) {
-                double bx = barcodeCorners[j];
-                double by = barcodeCorners[j + 1];
-                auto baryCoords = computeBarycentricCoordinates(bx, by, tc1[0], tc1[1], tc2[0], tc2[1], tc3[0], tc3[1]);
-
-                // Проверка валидности барицентрических координат
-                if (baryCoords[0] < 0 || baryCoords[0] > 1 || baryCoords[1] < 0 || baryCoords[1] > 1 || baryCoords[2] < 0 || baryCoords[2] > 1) {
-                    std::cout << "  Skipping invalid barycentric coordinates.\n";
-                    continue;
-                }
-
-                // Интерполируем координаты в 3D пространстве
-                double px = baryCoords[0] * pt1[0] + baryCoords[1] * pt2[0] + baryCoords[2] * pt3[0];
-                double py = baryCoords[0] * pt1[1] + baryCoords[1] * pt2[1] + baryCoords[2] * pt3[1];
-                double pz = baryCoords[0] * pt1[2] + baryCoords[1] * pt2[2] + baryCoords[2] * pt3[2];
+void printUsage(const char* program) {
+    std::cerr << "Usage:\n"
+              << "  " << program << " [options] <texture.jpg> <background> <tl_x> <tl_y> <br_x> <br_y>\n"
+              << "  " << program << " [options] <barcode> <background>\n"
+              << "  " << program << " [options] --batch <manifest>\n"
+              << "  " << program << " --build-store <store> <image>...\n"
+              << "Options:\n"
+              << "  --offscreen   render without a window or interactor (OSMesa/EGL if VTK has them)\n"
+              << "  --size WxH    default output resolution (800x600)\n"
+              << "  --backend B   vtk (default) or cpu, the built-in software rasterizer\n"
+              << "  --threads N   worker threads of the cpu backend\n"
+              << "  --surface S   render on a procedural surface instead of mesh.obj: plane, cylinder, folds\n"
+              << "                or crumple, with :key=value parameters (e.g. folds:count=2:noise=0.1)\n"
+              << "  --shards P    write samples to P-000000.tar, ... (+ .idx) instead of data/\n"
+              << "  --shard-size MB  roll over to the next shard at this size (1024)\n"
+              << "  --keypoints N annotate the N x N module grid of the barcode, not only its corners\n"
+              << "  --occlusion   test keypoints against the depth buffer, hidden ones get visible = 0\n"
+              << "  --codec C     png[:level] (default), jpg[:quality], qoi or raw\n"
+              << "  --encoders N  background encoder threads (2)\n"
+              << "  --queue N     frames waiting for the encoders before rendering blocks\n"
+              << "  --store S     take backgrounds and barcodes from a store made by --build-store, mapped\n"
+              << "                read-only and shared by all processes on the node\n"
+              << "  --image-cache MB  budget of the decoded image cache (512)\n"
+              << "  --trace F     write a Chrome trace (chrome://tracing, Perfetto) of every stage to F\n"
+              << "  --stats S     print a line of stage times, samples/s and queue depths every S seconds\n"
+              << "                (--trace and --stats need a build with -DPIPELINE_TRACE=ON)\n"
+              << "  --log-level L error, warning, info (default) or debug; debug prints the corners\n"
+              << "  --shard i/N   render only the samples of node i of N; nodes split a manifest without\n"
+              << "                a coordinator and their output names never collide\n"
+              << "  --seed S      seed of the random scale, position and surface of every sample (0)\n";
+}
 
-                barcode_3d_points.push_back({px, py, pz});
-                std::cout << "  Barcode corner " << (j / 2) * 2 << ": (" << px << ", " << py << ", " << pz << ")\n";
+int main(int argc, char* argv[]) {
+    std::vector<Sample> samples;
+    std::vector<std::string> positional;
+    std::string manifestPath;
+    SceneOptions options;
+    std::string shardPrefix;
+    uint64_t shardBytes = DEFAULT_SHARD_BYTES;
+    CodecOptions codec;
+    size_t encoders = 2;
+    size_t queue = 0;
+    AnnotationOptions annotation;
+    std::string buildStore;
+    std::string storePath;
+    std::string tracePath;
+    double statsSeconds = 0;
+    WorkShard shard;
+    uint64_t seed = 0;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--batch" && i + 1 < argc) {
+            manifestPath = argv[++i];
+        } else if (arg == "--offscreen") {
+            options.offscreen = true;
+        } else if (arg == "--size" && i + 1 < argc) {
+            auto size = split(argv[++i], 'x');
+            if (size.size() != 2) {
+                printUsage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            options.width = std::stoi(size[0]);
+            options.height = std::stoi(size[1]);
+        } else if (arg == "--backend" && i + 1 < argc) {
+            std::string backend = argv[++i];
+            if (backend != "vtk" && backend != "cpu") {
+                printUsage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            options.backend = backend == "cpu" ? RenderBackend::Cpu : RenderBackend::Vtk;
+        } else if (arg == "--threads" && i + 1 < argc) {
+            options.threads = std::stoi(argv[++i]);
+        } else if (arg == "--surface" && i + 1 < argc) {
+            options.surface = argv[++i];
+            SurfaceSpec spec;
+            if (!parseSurfaceSpec(options.surface, spec)) {
+                printUsage(argv[0]);
+                return EXIT_FAILURE;
+            }
+        } else if (arg == "--shards" && i + 1 < argc) {
+            shardPrefix = argv[++i];
+        } else if (arg == "--shard-size" && i + 1 < argc) {
+            shardBytes = std::max<uint64_t>(1, std::stoull(argv[++i])) << 20;
+        } else if (arg == "--codec" && i + 1 < argc) {
+            if (!ParseCodec(argv[++i], codec)) {
+                printUsage(argv[0]);
+                return EXIT_FAILURE;
+            }
+        } else if (arg == "--keypoints" && i + 1 < argc) {
+            annotation.grid = std::max(0, std::stoi(argv[++i]));
+        } else if (arg == "--occlusion") {
+            annotation.occlusion = true;
+        } else if (arg == "--encoders" && i + 1 < argc) {
+            encoders = std::max(1, std::stoi(argv[++i]));
+        } else if (arg == "--queue" && i + 1 < argc) {
+            queue = std::max(1, std::stoi(argv[++i]));
+        } else if (arg == "--build-store" && i + 1 < argc) {
+            buildStore = argv[++i];
+        } else if (arg == "--store" && i + 1 < argc) {
+            storePath = argv[++i];
+        } else if (arg == "--image-cache" && i + 1 < argc) {
+            options.imageCacheBytes = static_cast<size_t>(std::max(0, std::stoi(argv[++i]))) << 20;
+        } else if (arg == "--shard" && i + 1 < argc) {
+            if (!ParseWorkShard(argv[++i], shard)) {
+                printUsage(argv[0]);
+                return EXIT_FAILURE;
+            }
+        } else if (arg == "--seed" && i + 1 < argc) {
+            seed = std::stoull(argv[++i]);
+        } else if (arg == "--trace" && i + 1 < argc) {
+            tracePath = argv[++i];
+        } else if (arg == "--stats" && i + 1 < argc) {
+            statsSeconds = std::max(0.0, std::stod(argv[++i]));
+        } else if (arg == "--log-level" && i + 1 < argc) {
+            LogLevel level;
+            if (!ParseLogLevel(argv[++i], level)) {
+                printUsage(argv[0]);
+                return EXIT_FAILURE;
             }
+            SetLogLevel(level);
+        } else {
+            positional.push_back(arg);
         }
     }
 
-    return barcode_3d_points;
-}
-
-// Function to transform 3D coordinates to 2D screen coordinates
-std::vector<std::vector<double>> display_compute(const std::vector<std::vector<double>>& points, vtkRenderer* renderer, const std::tuple<int, int>& img_size) {
-    std::vector<std::vector<double>> points_display;
-    vtkNew<vtkCoordinate> coord;
-    coord->SetCoordinateSystemToWorld();
-
-    for (const auto& point : points) {
-        coord->SetValue(point.data());
-        double* display_coordinates = coord->GetComputedDoubleDisplayValue(renderer);
-
-        int img_height = std::get<1>(img_size);
-        points_display.push_back({display_coordinates[0], img_height - display_coordinates[1]});
+    if (!buildStore.empty()) {
+        return buildImageStore(buildStore, positional);
     }
 
-    return points_display;
-}
-
-// Функция для записи координат в JSON-формат
-void SaveCoordinatesAsJSON(const std::vector<std::vector<double>>& coordinates, const std::string& filename) {
-    std::ofstream outFile(filename);
-    if (!outFile.is_open()) {
-        std::cerr << "Не удалось открыть файл для записи." << std::endl;
-        return;
+    if (!manifestPath.empty()) {
+        samples = readManifest(manifestPath);
+    } else if (positional.size() == 6) {
+        Sample sample;
+        sample.texture = positional[0]; // Путь к текстуре со штрих-кодом
+        sample.background = positional[1]; // Путь к фоновому изображению
+        for (size_t i = 0; i < sample.box.size(); ++i) {
+            sample.box[i] = std::stod(positional[2 + i]);
+        }
+        samples.push_back(sample);
+    } else if (positional.size() == 2) {
+        // Штрих-код вклеивается в текстуру в памяти в случайное место, рамка считается сама
+        Sample sample;
+        sample.barcode = positional[0];
+        sample.background = positional[1];
+        samples.push_back(sample);
+    } else {
+        printUsage(argv[0]);
+        return EXIT_FAILURE;
     }
 
-    outFile << "{" << std::endl;
-    outFile << "  \"all_points_x\": [";
-    for (size_t i = 0; i < coordinates.size(); ++i) {
-        outFile << coordinates[i][0];
-        if (i < coordinates.size() - 1)
-            outFile << ", ";
+    const size_t listed = samples.size();
+    samples = selectSamples(samples, seed, shard);
+    if (shard.count > 1) {
+        std::cout << "Shard " << shard.index << "/" << shard.count << ": " << samples.size() << " of " << listed
+                  << " samples\n";
     }
-    outFile << "]," << std::endl;
 
-    outFile << "  \"all_points_y\": [";
-    for (size_t i = 0; i < coordinates.size(); ++i) {
-        outFile << coordinates[i][1];
-        if (i < coordinates.size() - 1)
-            outFile << ", ";
+    std::unique_ptr<ImageStore> store;
+    if (!storePath.empty()) {
+        store = std::make_unique<ImageStore>(storePath);
+        options.store = store.get();
     }
-    outFile << "]" << std::endl;
-    outFile << "}" << std::endl;
-
-    outFile.close();
-}
 
-std::string generateRandomString(size_t length) {
-    const std::string characters = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789";
-    std::string randomString;
-    std::random_device rd;
-    std::mt19937 generator(rd());
-    std::uniform_int_distribution<> distribution(0, characters.size() - 1);
-
-    for(size_t i = 0; i < length; ++i) {
-        randomString += characters[distribution(generator)];
+    // Пайплайн собирается один раз на весь прогон, дальше меняются только входы
+    Scene scene("mesh.obj", options);
+    std::unique_ptr<ShardWriter> shards;
+    if (!shardPrefix.empty()) {
+        shards = std::make_unique<ShardWriter>(shardPrefix, shardBytes);
     }
+    AsyncWriter writer(makeEncoder(codec), CodecExtension(codec.codec), encoders, queue, shards.get());
 
-    return randomString;
-}
-
-std::vector<std::string> split(const std::string& s, char delimiter) {
-    std::vector<std::string> tokens;
-    std::string token;
-    std::istringstream tokenStream(s);
-
-    while (std::getline(tokenStream, token, delimiter)) {
-        tokens.push_back(token);
+    TraceStart(tracePath, statsSeconds, std::cout);
+    size_t failed = 0;
+    for (const auto& sample : samples) {
+        if (!renderSample(scene, writer, sample, annotation)) {
+            ++failed;
+        }
     }
-
-    return tokens;
-}
-
-int main(int argc, char* argv[]) {
-    const char* modelFilePath = argv[1]; // Путь к 3D модели
-    const char* backgroundImageFilePath = argv[2]; // Путь к фоновому изображению
-    std::vector<const char*> barcodeCoords = { argv[3], argv[4], argv[5], argv[6] };
-
-    vtkNew<vtkOBJReader> objReader;
-    objReader->SetFileName("mesh.obj");
-    objReader->Update();
-
-    vtkNew<vtkTexture> texture;
-    vtkNew<vtkJPEGReader> jpegReader;
-    jpegReader->SetFileName(modelFilePath);
-    texture->SetInputConnection(jpegReader->GetOutputPort());
-
-    texture->InterpolateOn();
-    texture->RepeatOff();  // Отключаем повторение текстуры
-
-    vtkNew<vtkTextureMapToPlane> texturePlane;
-    texturePlane->SetInputConnection(objReader->GetOutputPort());
-    texturePlane->AutomaticPlaneGenerationOn();
-
-    // Apply the texture coordinates from the plane to the mesh
-    vtkNew<vtkPolyDataMapper> mapper;
-    mapper->SetInputConnection(texturePlane->GetOutputPort());
-
-    vtkNew<vtkActor> actor;
-    actor->SetMapper(mapper);
-    actor->SetTexture(texture);
-    actor->GetProperty()->BackfaceCullingOff();  // Отключаем отсечение задних граней
-    actor->GetProperty()->EdgeVisibilityOff();   // Отключаем отображение линий сетки
-    actor->GetProperty()->SetRepresentationToSurface(); // Отображаем только поверхность
-
-    vtkNew<vtkTransform> transform;
-    transform->Translate(-5, 0, 0); // Adjust the translation values as necessary
-    actor->SetUserTransform(transform);
-
-    vtkNew<vtkRenderer> renderer;
-    renderer->SetBackground(0.1, 0.1, 0.1); // Темный фон
-
-    // Create a camera and set its position and orientation
-    vtkNew<vtkCamera> camera;
-    camera->SetPosition(-7, -16, -40); // Position the camera #changable
-    camera->SetFocalPoint(0, 0, 0); // Look at the center of the object #changable
-    camera->SetViewUp(0, -1, 0); // Set the view up vector #changable
-
-    renderer->SetActiveCamera(camera); // Add the camera to the renderer
-
-    // Load background image
-    vtkNew<vtkImageReader2Factory> readerFactory;
-    vtkImageReader2* imageReader = readerFactory->CreateImageReader2(backgroundImageFilePath);
-    imageReader->SetFileName(backgroundImageFilePath);
-    imageReader->Update();
-
-    vtkNew<vtkImageActor> backgroundActor;
-    backgroundActor->SetInputData(imageReader->GetOutput());
-
-    // Создаем трансформацию для фоновой плоскости
-    vtkNew<vtkTransform> backgroundTransform;
-    backgroundTransform->PostMultiply(); // Применять масштабирование после других трансформаций
-    backgroundTransform->RotateX(1); // Тот же угол поворота, что и у объекта
-    backgroundActor->SetUserTransform(backgroundTransform); // Применяем трансформацию к фоновому актору
-
-    double shiftLeft = -280; // Смещение влево; отрицательное значение перемещает влево
-    double shiftUp = -180; // Смещение вверх; положительное значение перемещает вверх
-    backgroundTransform->Translate(shiftLeft, shiftUp, 330.0);
-
-    // Add background image actor first
-    renderer->AddActor(actor);
-    renderer->AddActor(backgroundActor);
-
-    vtkNew<vtkRenderWindow> renderWindow;
-    renderWindow->AddRenderer(renderer);
-    renderWindow->SetSize(800, 600);
-
-    vtkNew<vtkRenderWindowInteractor> renderWindowInteractor;
-    renderWindowInteractor->SetRenderWindow(renderWindow);
-
-    vtkNew<vtkInteractorStyleTrackballCamera> style;
-    renderWindowInteractor->SetInteractorStyle(style);
-
-    renderWindow->Render();
-
-    // Get 3D points corresponding to the barcode corners
-    auto barcode_3d_points = get_barcode_3d_corners(objReader->GetOutput(), barcodeCoords);
-
-    // Transform these points to 2D screen coordinates
-    auto barcode_2d_points = display_compute(barcode_3d_points, renderer, std::make_tuple(800, 600));
-
-    // Save the rendered window to an image
-    vtkNew<vtkWindowToImageFilter> windowToImageFilter;
-    windowToImageFilter->SetInput(renderWindow);
-    windowToImageFilter->Update();
-
-    std::ostringstream filePath;
-    auto imageName = split(backgroundImageFilePath, '/').back();
-    std::string randomString = generateRandomString(4);
-    filePath << "data/" << randomString << "_" << imageName; // надо добавить /.. перед data если запускать через IDE
-
-    vtkNew<vtkPNGWriter> writer;
-    writer->SetFileName(filePath.str().c_str());
-    writer->SetInputConnection(windowToImageFilter->GetOutputPort());
-    writer->Write();
-
-    // Print the 2D coordinates
-    for (size_t i = 0; i < barcode_2d_points.size(); ++i) {
-        std::cout << "Corner " << i << ": (" << barcode_2d_points[i][0] << ", " << barcode_2d_points[i][1] << ")\n";
+    writer.Wait();
+    TraceStop(std::cout);
+    writer.Report(std::cout);
+    scene.ReportImageCache(std::cout);
+    failed += writer.Failed();
+    if (shards) {
+        shards->Close();
     }
 
-    auto imageNameWithoutExtension = split(imageName, '.').front();
-
-    std::ostringstream jsonFilePath;
-    jsonFilePath << "data/" << randomString << "_"  << imageNameWithoutExtension << ".json";
-
-    SaveCoordinatesAsJSON(barcode_2d_points, jsonFilePath.str());
-
+    if (samples.size() > 1) {
+        std::cout << "Rendered " << samples.size() - failed << "/" << samples.size() << " samples\n";
+    }
 
-    // renderWindowInteractor->Start();
+    // scene.GetInteractor()->Start();
 
-    return EXIT_SUCCESS;
+    return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
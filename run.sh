@@ -1,55 +1,62 @@
 #!/bin/bash
 
-# Создаем папку для штрих-кодов, если она еще не существует
-mkdir -p barcodes
-
-# Вызываем Python скрипт для генерации штрих-кодов
-cd QR-Noize
-./build.sh && ./run.sh generate.config test test_mod noize.config
-mkdir -p ../barcodes
-cp -r test_mod/* ../barcodes/
-cd ..
-
-# Переходим к директории C++ проекта (измените на ваш путь)
-cd .
-
-mkdir build
+# Запуск на нескольких машинах: SHARD=i/N на каждой (i от 0 до N-1) и общий SEED.
+# Каждая машина берет свою часть работы без координатора, имена файлов не
+# пересекаются, упавший шард перезапускается отдельно с тем же результатом
+seed_args=()
+if [ -n "$SEED" ]; then
+    seed_args+=(--seed "$SEED")
+fi
+split_args=("${seed_args[@]}")
+if [ -n "$SHARD" ]; then
+    split_args+=(--shard "$SHARD")
+fi
+
+# Собираем C++ проект; datagen собирается, если есть OpenCV и zxing-cpp
+mkdir -p build
 cd build
-
-# Собираем C++ проект
 cmake ..
 make
-
-# Переходим обратно в директорию со скриптом
 cd -
 
-# Путь к исполняемому файлу C++ программы (измените на ваш путь)
-executable="./build/Tutorial_Step6"
-
 # Путь к папке с фонами
 backgrounds_path="photos/"
 
-# Цикл по всем файлам штрих-кодов в папке barcodes
-for barcode in barcodes/*.jpg; do
-    # Предполагаем, что фон для каждого штрих-кода один и тот же, замените на правильный путь
-    for background in "$backgrounds_path"*.jpg; do
-
-        combined_image="combined_${barcode##*/}"
-        python3 save_combined_image.py "$barcode" "$combined_image" > coords.txt
-
-        # Extract the coordinates from the file
-        read -r TOP_LEFT_X TOP_LEFT_Y BOTTOM_RIGHT_X BOTTOM_RIGHT_Y < coords.txt
-        rm coords.txt
-        # Вызываем C++ программу с аргументами штрих-кода и фона
-        $executable $combined_image $background $TOP_LEFT_X $TOP_LEFT_Y $BOTTOM_RIGHT_X $BOTTOM_RIGHT_Y
-
+# Фоны декодируются один раз в хранилище сырых пикселей, рендерер отображает его в память
+store="backgrounds.imgstore"
+./build/Tutorial_Step6 --build-store "$store" "$backgrounds_path"*.jpg
+
+if [ -x ./build/datagen ]; then
+    # Все стадии в одном процессе: штрих-код -> шум -> вклейка -> рендер -> запись,
+    # промежуточные картинки остаются в памяти
+    ./build/datagen --store "$store" --validate --drop-unreadable "${split_args[@]}" \
+        QR-Noize/generate.config QR-Noize/noize.config "$backgrounds_path"
+else
+    # Без OpenCV/zxing-cpp в сборке рендерера — по шагам: imgen, потом пакетный рендер
+    mkdir -p barcodes
+    cd QR-Noize
+    ./build.sh && ./run.sh generate.config test test_mod noize.config "${split_args[@]}"
+    cp -r test_mod/* ../barcodes/
+    cd ..
+
+    # Манифест для пакетного режима: одна строка на пару штрих-код x фон.
+    # Масштаб штрих-кода на текстуре случайный из диапазона, позиция тоже случайная
+    manifest="manifest.txt"
+    : > "$manifest"
+    for barcode in barcodes/*.jpg; do
+        for background in "$backgrounds_path"*.jpg; do
+            echo "barcode $barcode $background 0.8 1.2" >> "$manifest"
+        done
     done
 
-    # Здесь можно добавить логику сохранения или обработки результатов
-done
+    # Один процесс рендерит все пары; штрих-коды уже поделены между машинами,
+    # поэтому здесь только зерно
+    ./build/Tutorial_Step6 --offscreen --store "$store" --batch "$manifest" "${seed_args[@]}"
+    rm -f "$manifest"
+    rm -rf barcodes
+fi
 
-# Удаляем папку с штрих-кодами
-rm -rf barcodes
+rm -f "$store"
 rm -rf build
 
 echo "Обработка завершена."